@@ -37,6 +37,15 @@
 
 #include "iibmalloc_common.h"
 #include "iibmalloc_page_allocator.h"
+#include "iibmalloc_heap_profiler.h"
+#include "iibmalloc_size_histogram.h"
+#ifdef USE_PROFILED_BUCKET_SIZES
+#include "iibmalloc_profiled_bucket_sizes.h" // generated by test/size_class_gen.cpp from a size histogram (see SizeHistogram)
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
 
 namespace nodecpp::iibmalloc
 {
@@ -53,6 +62,9 @@ constexpr size_t PAGE_SIZE_MASK = expToMask(PAGE_SIZE_EXP);
 static_assert( ( 1 << PAGE_SIZE_EXP ) == PAGE_SIZE, "" );
 static_assert( 1 + PAGE_SIZE_MASK == PAGE_SIZE, "" );
 
+constexpr uint8_t HUGE_PAGE_SIZE_EXP = 21; // transparent huge pages of x86-64 (and of arm64 with 4K pages)
+constexpr size_t HUGE_PAGE_SIZE = ((size_t)1) << HUGE_PAGE_SIZE_EXP;
+
 
 template<class BasePageAllocator, class ItemT>
 class CollectionInPages : public BasePageAllocator
@@ -93,7 +105,7 @@ public:
 	{
 		if ( freeList == nullptr )
 		{
-			freeList = reinterpret_cast<ListItem*>( this->getFreeBlockNoCache( PAGE_SIZE ) );
+			freeList = reinterpret_cast<ListItem*>( this->getFreeBlock( PAGE_SIZE ) );
 			++pageCnt;
 			ListItem* item = freeList;
 			size_t itemCnt = PAGE_SIZE / sizeof( ListItem );
@@ -115,6 +127,17 @@ public:
 //		head->next = freeList;
 		return &(head->item);
 	}
+	void remove( const ItemT& item )
+	{
+		ListItem** prevNext = &head;
+		while ( *prevNext != nullptr && !( (*prevNext)->item == item ) )
+			prevNext = &((*prevNext)->next);
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, *prevNext != nullptr );
+		ListItem* removed = *prevNext;
+		*prevNext = removed->next;
+		removed->next = freeList;
+		freeList = removed;
+	}
 	template<class Functor>
 	void doForEach(Functor& f)
 	{
@@ -133,7 +156,7 @@ public:
 		while (pageStartHead)
 		{
 			ListItem* tmp = pageStartHead->next;
-			this->freeChunkNoCache( pageStartHead, PAGE_SIZE );
+			this->freeChunk( pageStartHead, PAGE_SIZE );
 			--pageCnt;
 			pageStartHead = tmp;
 		}
@@ -158,6 +181,18 @@ class SoundingAddressPageAllocator : public BasePageAllocator
 	static constexpr size_t commit_page_cnt = (1 << commit_page_cnt_exp);
 	static constexpr size_t commit_size = (1 << (commit_page_cnt_exp + PAGE_SIZE_EXP));
 	static_assert( commit_page_cnt_exp <= reservation_size_exp - bucket_cnt_exp - PAGE_SIZE_EXP, "value mismatch" );
+	static constexpr size_t multipages_per_bucket = pages_per_bucket / multipage_page_cnt;
+	static_assert( multipages_per_bucket <= 64, "revise implementation" ); // see PageBlockDescriptor::releasedMultipages
+	typedef std::conditional_t<multipages_per_bucket <= 8, uint8_t, uint64_t> MultipageMaskT; // bit per multipage of a bucket in a reservation
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+	static_assert( pages_per_bucket_exp + PAGE_SIZE_EXP == HUGE_PAGE_SIZE_EXP, "a bucket is expected to get a single huge page of each reservation" );
+	static constexpr size_t hot_bucket_region_cnt = 1; // a bucket that has started that many regions (its parts of reservations) is committed a whole huge page per next region
+#endif
+
+public:
+	static constexpr size_t multipage_size = multipage_page_cnt << PAGE_SIZE_EXP;
+
+private:
 
 	struct MemoryBlockHeader
 	{
@@ -171,28 +206,102 @@ class SoundingAddressPageAllocator : public BasePageAllocator
 		void* blockAddress = nullptr;
 		uint16_t nextToUse[ bucket_cnt ];
 		uint16_t nextToCommit[ bucket_cnt ];
+		MultipageMaskT releasedMultipages[ bucket_cnt ]; // bit mask of multipages (below nextToUse) that are released to OS and are to be reused first
+		CommitMode commitMode = CommitMode::remap;
 		static_assert( UINT16_MAX > pages_per_bucket , "revise implementation" );
 	};
 	CollectionInPages<BasePageAllocator,PageBlockDescriptor> pageBlockDescriptors;
 	PageBlockDescriptor pageBlockListStart;
 	PageBlockDescriptor* pageBlockListCurrent;
 	PageBlockDescriptor* indexHead[bucket_cnt];
+	size_t releasedMultipageCnt[bucket_cnt];
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+	size_t startedRegionCnt[bucket_cnt];
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	PageOwnerMap::OwnerIdT ownerId = PageOwnerMap::no_owner;
+#endif
+	CommitMode commitMode = CommitMode::remap; // of reservations to be made
+	void* scanBuffer = nullptr; // of releaseFreeMultipagesStep(), kept between calls (see getScanBuffer())
+	size_t scanBufferSize = 0;
+
+	// State of releasing free multipages of a bucket, which is done by bounded steps (see releaseFreeMultipagesStep())
+	struct ReservationScan
+	{
+		uintptr_t blockAddress;
+		PageBlockDescriptor* pb;
+		uint16_t freeItemCnt[ multipages_per_bucket ];
+		MultipageMaskT toRelease;
+	};
+	enum class ScanPhase : uint8_t { idle, counting, filtering, discarding };
+	struct FreeMultipageScan
+	{
+		ScanPhase phase = ScanPhase::idle;
+		uint8_t idx;
+		size_t itemsPerMultipage;
+		ReservationScan* scan; // sorted by address (at scanBuffer)
+		size_t blockCnt;
+		void* list; // items detached from a free list of a bucket; no one else takes or adds items there
+		void** cursor; // a link to a next item to look at (counting, filtering), or a last link of the list
+		void* dropped; // filtering: items of multipages to be released, unlinked from the list
+		void** droppedLast;
+		size_t toReleaseCnt;
+		size_t nextBlock; // discarding
+	};
+	FreeMultipageScan freeMultipageScan;
+	static constexpr size_t scan_step_item_cnt = 1024; // items looked at by a step of releaseFreeMultipagesStep()
+	static constexpr size_t scan_step_discard_cnt = 16; // multipages discarded by a step of releaseFreeMultipagesStep()
+
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+	static constexpr size_t reservation_alignment = HUGE_PAGE_SIZE; // thus, each region (a part of a reservation owned by a bucket) is a huge page
+#else
+	static constexpr size_t reservation_alignment = 0;
+#endif
+
+	static constexpr PageCache::Kind reservationKind( CommitMode mode ) { return mode == CommitMode::demandPaging ? PageCache::Kind::accessibleReservation : PageCache::Kind::reservation; }
 
 	void* getNextBlock()
 	{
-		void* pages = this->AllocateAddressSpace( reservation_size );
+		// a cached reservation is reset by deinitialize(), and keeps its advice
+		void* pages = this->getCachedBlock( reservation_size, reservationKind( commitMode ) );
+		if ( pages == nullptr )
+		{
+			pages = commitMode == CommitMode::demandPaging ? this->AllocateAccessibleAddressSpace( reservation_size, reservation_alignment ) : this->AllocateAddressSpace( reservation_size, reservation_alignment );
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+			// advising regions one by one would split a reservation into a mapping per region (see startRegion())
+			if ( commitMode == CommitMode::demandPaging )
+				this->AdviseHugePages( pages, reservation_size );
+#endif
+		}
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		PageOwnerMap::setOwner( pages, reservation_size, ownerId );
+#endif
 		return pages;
 	}
 
+	// a single buffer serves all buckets, and grows with a number of reservations
+	void* getScanBuffer( size_t sz )
+	{
+		if ( sz > scanBufferSize )
+		{
+			releaseScanBuffer();
+			scanBuffer = this->getFreeBlockNoCache( sz );
+			scanBufferSize = sz;
+		}
+		return scanBuffer;
+	}
+
 	void* createNextBlockAndGetPage( size_t reasonIdx )
 	{
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reasonIdx < bucket_cnt );
 //		PageBlockDescriptor* pb = new PageBlockDescriptor; // TODO: consider using our own allocator
 		PageBlockDescriptor* pb = pageBlockDescriptors.createNew();
 		pb->blockAddress = getNextBlock();
+		pb->commitMode = commitMode;
 //nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "createNextBlockAndGetPage(): descriptor allocated at 0x{:x}; block = 0x{:x}", (size_t)(pb), (size_t)(pb->blockAddress) );
 		memset( pb->nextToUse, 0, sizeof( uint16_t) * bucket_cnt );
 		memset( pb->nextToCommit, 0, sizeof( uint16_t) * bucket_cnt );
+		memset( pb->releasedMultipages, 0, sizeof( MultipageMaskT ) * bucket_cnt );
 		pb->next = nullptr;
 		pageBlockListCurrent->next = pb;
 		pageBlockListCurrent = pb;
@@ -201,10 +310,8 @@ class SoundingAddressPageAllocator : public BasePageAllocator
 //	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "createNextBlockAndGetPage(): before commit, {}, 0x{:x} -> 0x{:x}", reasonIdx, (size_t)(pb->blockAddress), (size_t)(ret) );
 //		void* ret2 = this->CommitMemory( ret, PAGE_SIZE );
 //		this->CommitMemory( ret, PAGE_SIZE );
-		commitRangeOfPageIndexes( pb->blockAddress, reasonIdx, 0, commit_page_cnt );
+		startRegion( pb, reasonIdx );
 		pb->nextToUse[ reasonIdx ] = 1;
-		static_assert( commit_page_cnt <= UINT16_MAX, "" );
-		pb->nextToCommit[ reasonIdx ] = (uint16_t)commit_page_cnt;
 *reinterpret_cast<uint8_t*>(ret) += 1; // test write
 //	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "createNextBlockAndGetPage(): after commit 0x{:x}", (size_t)(ret2) );
 		return ret;
@@ -217,11 +324,17 @@ class SoundingAddressPageAllocator : public BasePageAllocator
 			pageBlockListStart.nextToUse[i] = pages_per_bucket; // thus triggering switching to a next block whatever bucket is selected
 		for ( size_t i=0; i<bucket_cnt; ++i )
 			pageBlockListStart.nextToCommit[i] = pages_per_bucket; // thus triggering switching to a next block whatever bucket is selected
+		memset( pageBlockListStart.releasedMultipages, 0, sizeof( MultipageMaskT ) * bucket_cnt );
+		memset( releasedMultipageCnt, 0, sizeof( size_t) * bucket_cnt );
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+		memset( startedRegionCnt, 0, sizeof( size_t) * bucket_cnt );
+#endif
 		pageBlockListStart.next = nullptr;
 
 		pageBlockListCurrent = &pageBlockListStart;
 		for ( size_t i=0; i<bucket_cnt; ++i )
 			indexHead[i] = pageBlockListCurrent;
+		freeMultipageScan.phase = ScanPhase::idle;
 	}
 
 public:
@@ -271,8 +384,24 @@ public:
 		resetLists();
 	}
 
-	void commitRangeOfPageIndexes( void* blockptr, size_t bucketIdx, size_t pageIdx, size_t rangeSize )
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	void setOwnerId( PageOwnerMap::OwnerIdT id ) { ownerId = id; }
+#endif
+
+	// each reservation keeps a mode it was made with, so that it can be changed at any time
+	void setCommitMode( CommitMode mode ) { commitMode = mode; }
+
+	void setPageCache( PageCache* cache )
+	{
+		BasePageAllocator::setPageCache( cache );
+		pageBlockDescriptors.setPageCache( cache );
+	}
+
+	void commitRangeOfPageIndexes( PageBlockDescriptor* pb, size_t bucketIdx, size_t pageIdx, size_t rangeSize )
 	{
+		if ( pb->commitMode == CommitMode::demandPaging )
+			return;
+		void* blockptr = pb->blockAddress;
 		uint8_t* start = reinterpret_cast<uint8_t*>( idxToPageAddr( blockptr, bucketIdx, pageIdx ) );
 		uint8_t* prevNext = start;
 		uint8_t* next;
@@ -294,6 +423,25 @@ public:
 		this->CommitMemory( start, prevNext - start + PAGE_SIZE );
 	}
 
+	// commits first pages of a region of bucket idx in reservation pb (and, for a hot bucket, with IIBMALLOC_ENABLE_HUGE_PAGES, the whole
+	// region, advised to be a huge page: a hot bucket is likely to fill it, and a region that is committed in smaller runs either gets
+	// no huge page at all, or only after khugepaged collapses it). With CommitMode::demandPaging, nothing is committed, and a reservation
+	// is advised as a whole by getNextBlock().
+	void startRegion( PageBlockDescriptor* pb, size_t idx )
+	{
+		size_t commitCnt = commit_page_cnt;
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+		if ( startedRegionCnt[idx]++ >= hot_bucket_region_cnt )
+			commitCnt = pages_per_bucket;
+#endif
+		commitRangeOfPageIndexes( pb, idx, 0, commitCnt );
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+		if ( commitCnt == pages_per_bucket && pb->commitMode == CommitMode::remap ) // after committing, as it creates a new mapping
+			this->AdviseHugePages( idxToPageAddr( pb->blockAddress, idx, 0 ), pages_per_bucket << PAGE_SIZE_EXP );
+#endif
+		pb->nextToCommit[idx] = (uint16_t)commitCnt;
+	}
+
 	void* getPage( size_t idx )
 	{
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, idx < bucket_cnt );
@@ -303,7 +451,7 @@ public:
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, indexHead[idx]->nextToUse[idx] <= indexHead[idx]->nextToCommit[idx] );
 			if ( indexHead[idx]->nextToUse[idx] == indexHead[idx]->nextToCommit[idx] )
 			{
-				commitRangeOfPageIndexes( indexHead[idx]->blockAddress, idx, indexHead[idx]->nextToCommit[idx], commit_page_cnt );
+				commitRangeOfPageIndexes( indexHead[idx], idx, indexHead[idx]->nextToCommit[idx], commit_page_cnt );
 				indexHead[idx]->nextToCommit[ idx ] += commit_page_cnt;
 			}
 			void* ret = idxToPageAddr( indexHead[idx]->blockAddress, idx, indexHead[idx]->nextToUse[idx] );
@@ -331,9 +479,7 @@ public:
 //			void* ret = idxToPageAddr( indexHead[idx]->blockAddress, idx );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, indexHead[idx]->nextToUse[idx] == 0 );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, indexHead[idx]->nextToCommit[idx] == 0 );
-			if ( indexHead[idx]->nextToUse[idx] == indexHead[idx]->nextToCommit[idx] )
-			commitRangeOfPageIndexes( indexHead[idx]->blockAddress, idx, indexHead[idx]->nextToCommit[idx], commit_page_cnt );
-			indexHead[idx]->nextToCommit[idx] = commit_page_cnt;
+			startRegion( indexHead[idx], idx );
 			void* ret = idxToPageAddr( indexHead[idx]->blockAddress, idx, indexHead[idx]->nextToUse[idx] );
 			indexHead[idx]->nextToUse[idx] = 1;
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, indexHead[idx]->nextToUse[idx] <= indexHead[idx]->nextToCommit[idx] );
@@ -348,57 +494,271 @@ public:
 
 	void getMultipage( size_t idx, MultipageData& mpData )
 	{
+		if ( releasedMultipageCnt[idx] != 0 )
+		{
+			reuseReleasedMultipage( idx, mpData );
+			return;
+		}
+
 		// NOTE: current implementation just sits over repeated calls to getPage()
 		//       it is reasonably assumed that returned pages are within at most two connected segments
 		// TODO: it's possible to make it more optimal just by writing fram scratches by analogy with getPage() and calls from it
 		mpData.ptr1 = getPage( idx );
 		if constexpr ( multipage_page_cnt == 1 )
 		{
-			asserrt( mpData.ptr1 );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mpData.ptr1 );
 			mpData.sz1 = PAGE_SIZE;
 			mpData.ptr2 = nullptr;
 			mpData.sz2 = 0;
-			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mpData.sz1 + mpData.sz2 == ( multipage_page_cnt << PAGE_SIZE_EXP ) );
 			return;
 		}
 
-		void* nextPage;
-		size_t i=1;
 		mpData.sz1 = PAGE_SIZE;
-		for ( ; i<multipage_page_cnt; ++i )
+		mpData.ptr2 = nullptr;
+		mpData.sz2 = 0;
+		for ( size_t i=1; i<multipage_page_cnt; ++i )
 		{
-			nextPage = getPage( idx );
+			void* nextPage = getPage( idx );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, nextPage );
-			if ( reinterpret_cast<uint8_t*>(mpData.ptr1) + mpData.sz1 == reinterpret_cast<uint8_t*>(nextPage) )
+			if ( mpData.ptr2 == nullptr && reinterpret_cast<uint8_t*>(mpData.ptr1) + mpData.sz1 == reinterpret_cast<uint8_t*>(nextPage) )
 				mpData.sz1 += PAGE_SIZE;
-			else break;
+			else if ( mpData.ptr2 == nullptr )
+			{
+				mpData.ptr2 = nextPage;
+				mpData.sz2 = PAGE_SIZE;
+			}
+			else
+			{
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<uint8_t*>(mpData.ptr2) + mpData.sz2 == reinterpret_cast<uint8_t*>(nextPage) );
+				mpData.sz2 += PAGE_SIZE;
+			}
+		}
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mpData.sz1 + mpData.sz2 == multipage_size );
+	}
+
+	// fills mpData with a released multipage of bucket idx; requires releasedMultipageCnt[idx] != 0.
+	// releasedMultipageCnt[idx] is a number of bits set in releasedMultipages[idx] of all reservations (both change together,
+	// here and in releaseFreeMultipagesStep(), and reservations are not freed before deinitialize()), so such a multipage always exists
+	void reuseReleasedMultipage( size_t idx, MultipageData& mpData )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, releasedMultipageCnt[idx] != 0 );
+		PageBlockDescriptor* pb = pageBlockListStart.next;
+		for ( ; pb->releasedMultipages[idx] == 0; pb = pb->next )
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, pb->next != nullptr );
+		size_t mpIdx = 0;
+		while ( ( pb->releasedMultipages[idx] & ( ((MultipageMaskT)1) << mpIdx ) ) == 0 )
+			++mpIdx;
+		pb->releasedMultipages[idx] &= ~( ((MultipageMaskT)1) << mpIdx );
+		--(releasedMultipageCnt[idx]);
+		// released multipages are never the ones wrapped around a reservation end (see selectFreeMultipages())
+		mpData.ptr1 = idxToPageAddr( pb->blockAddress, idx, mpIdx << multipage_page_cnt_exp );
+		mpData.sz1 = multipage_size;
+		mpData.ptr2 = nullptr;
+		mpData.sz2 = 0;
+	}
+
+private:
+	ReservationScan* findReservationScan( void* item )
+	{
+		FreeMultipageScan& fs = freeMultipageScan;
+		ReservationScan* s = std::upper_bound( fs.scan, fs.scan + fs.blockCnt, (uintptr_t)(item), []( uintptr_t addr, const ReservationScan& rs ) { return addr < rs.blockAddress; } );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, s != fs.scan );
+		--s;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (uintptr_t)(item) - s->blockAddress < reservation_size );
+		return s;
+	}
+
+	static size_t itemMultipageIdx( void* item ) { return ( ( (uintptr_t)(item) >> PAGE_SIZE_EXP ) & ( pages_per_bucket - 1 ) ) >> multipage_page_cnt_exp; }
+
+	// Detaches a free list, and prepares per-reservation counters of its items
+	void startFreeMultipageScan( size_t idx, void** freeList, size_t itemsPerMultipage )
+	{
+		FreeMultipageScan& fs = freeMultipageScan;
+		size_t blockCnt = 0;
+		for ( PageBlockDescriptor* pb = pageBlockListStart.next; pb; pb = pb->next )
+			++blockCnt;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, blockCnt != 0 ); // as items exist
+		fs.scan = reinterpret_cast<ReservationScan*>( getScanBuffer( alignUpExp( blockCnt * sizeof( ReservationScan ), PAGE_SIZE_EXP ) ) );
+		size_t i = 0;
+		for ( PageBlockDescriptor* pb = pageBlockListStart.next; pb; pb = pb->next, ++i )
+		{
+			fs.scan[i].blockAddress = (uintptr_t)(pb->blockAddress);
+			fs.scan[i].pb = pb;
+			memset( fs.scan[i].freeItemCnt, 0, sizeof( fs.scan[i].freeItemCnt ) );
+			fs.scan[i].toRelease = 0;
 		}
-		if ( i == multipage_page_cnt )
+		std::sort( fs.scan, fs.scan + blockCnt, []( const ReservationScan& a, const ReservationScan& b ) { return a.blockAddress < b.blockAddress; } );
+		fs.phase = ScanPhase::counting;
+		fs.idx = (uint8_t)idx;
+		fs.itemsPerMultipage = itemsPerMultipage;
+		fs.blockCnt = blockCnt;
+		fs.list = *freeList;
+		*freeList = nullptr;
+		fs.cursor = &(fs.list);
+		fs.dropped = nullptr;
+		fs.droppedLast = &(fs.dropped);
+		fs.toReleaseCnt = 0;
+		fs.nextBlock = 0;
+	}
+
+	// Selects multipages which items are all free, and returns a number of them
+	size_t selectFreeMultipages()
+	{
+		FreeMultipageScan& fs = freeMultipageScan;
+		size_t ret = 0;
+		for ( size_t i=0; i<fs.blockCnt; ++i )
 		{
-			mpData.ptr2 = nullptr;
-			mpData.sz2 = 0;
-			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mpData.sz1 + mpData.sz2 == ( multipage_page_cnt << PAGE_SIZE_EXP ) );
-			return;
+			ReservationScan& rs = fs.scan[i];
+			// a multipage which pages are wrapped around a reservation end consists of two segments, and is never released
+			size_t baseOffset = ( rs.blockAddress >> PAGE_SIZE_EXP ) & ( ( 1 << ( reservation_size_exp - PAGE_SIZE_EXP ) ) - 1 );
+			size_t wrappedIdx = ( baseOffset & ( multipage_page_cnt - 1 ) ) ? ( baseOffset >> multipage_page_cnt_exp ) : SIZE_MAX;
+			size_t usedCnt = rs.pb->nextToUse[fs.idx] >> multipage_page_cnt_exp;
+			for ( size_t j=0; j<usedCnt; ++j )
+				if ( rs.freeItemCnt[j] == fs.itemsPerMultipage && ( ((size_t)(fs.idx)) << ( pages_per_bucket_exp - multipage_page_cnt_exp ) ) + j != wrappedIdx )
+				{
+					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( rs.pb->releasedMultipages[fs.idx] & ( ((MultipageMaskT)1) << j ) ) == 0 );
+					rs.toRelease |= ((MultipageMaskT)1) << j;
+					++ret;
+				}
 		}
-		mpData.ptr2 = nextPage;
-		mpData.sz2 = PAGE_SIZE;
-		++i;
-		for ( ; i<multipage_page_cnt; ++i )
+		return ret;
+	}
+
+	// Returns kept items to a free list, and ends a scan
+	void finishFreeMultipageScan( void** freeList )
+	{
+		FreeMultipageScan& fs = freeMultipageScan;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, *(fs.cursor) == nullptr );
+		if ( fs.list != nullptr )
 		{
-			nextPage = getPage( idx );
-			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, nextPage );
-			if ( reinterpret_cast<uint8_t*>(mpData.ptr2) + mpData.sz2 == reinterpret_cast<uint8_t*>(nextPage) )
-				mpData.sz2 += PAGE_SIZE;
-			else break;
+			*(fs.cursor) = *freeList;
+			*freeList = fs.list;
+		}
+		fs.phase = ScanPhase::idle;
+	}
+
+public:
+	// Releases multipages of bucket idx that have no item in use to OS (they remain reserved and committed, and are reused first
+	// by further getMultipage( idx ) calls), by bounded steps, so that a caller may stop between them:
+	// - a first step detaches the free list of a bucket (*freeList), so that the scan works on a list that does not change
+	//   between steps (the bucket collects items freed meanwhile at a new list, and a slow path of allocation takes the detached
+	//   list back by cancelFreeMultipageScan() if a new list runs out);
+	// - counting free items per multipage, and then unlinking items of multipages which items are all free, scan_step_item_cnt
+	//   items per step;
+	// - all such multipages are marked released at once, and then are discarded, scan_step_discard_cnt per step (a multipage that
+	//   has already been taken by getMultipage() meanwhile is skipped); kept items are returned to *freeList by a last step.
+	// itemsPerMultipage is a number of items that a bucket places at a page-aligned block of multipage_size bytes.
+	// While isScanningFreeMultipages(), next steps are to be made for the same bucket. Returns a number of bytes released.
+	size_t releaseFreeMultipagesStep( size_t idx, void** freeList, size_t itemsPerMultipage )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, idx < bucket_cnt );
+		FreeMultipageScan& fs = freeMultipageScan;
+		if ( fs.phase == ScanPhase::idle )
+		{
+			if ( *freeList == nullptr )
+				return 0;
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, itemsPerMultipage != 0 && itemsPerMultipage < UINT16_MAX );
+			startFreeMultipageScan( idx, freeList, itemsPerMultipage );
+		}
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, fs.idx == idx );
+
+		if ( fs.phase == ScanPhase::counting )
+		{
+			void** link = fs.cursor;
+			for ( size_t i=0; i<scan_step_item_cnt && *link != nullptr; ++i, link = reinterpret_cast<void**>(*link) )
+				++( findReservationScan( *link )->freeItemCnt[ itemMultipageIdx( *link ) ] );
+			fs.cursor = link;
+			if ( *link != nullptr )
+				return 0;
+			fs.toReleaseCnt = selectFreeMultipages();
+			if ( fs.toReleaseCnt == 0 )
+			{
+				finishFreeMultipageScan( freeList );
+				return 0;
+			}
+			fs.phase = ScanPhase::filtering;
+			fs.cursor = &(fs.list);
+			return 0;
+		}
+
+		if ( fs.phase == ScanPhase::filtering )
+		{
+			void** link = fs.cursor;
+			for ( size_t i=0; i<scan_step_item_cnt && *link != nullptr; ++i )
+			{
+				void* item = *link;
+				if ( findReservationScan( item )->toRelease & ( ((MultipageMaskT)1) << itemMultipageIdx( item ) ) )
+				{
+					*link = *reinterpret_cast<void**>(item);
+					*(fs.droppedLast) = item;
+					fs.droppedLast = reinterpret_cast<void**>(item);
+					*(fs.droppedLast) = nullptr;
+				}
+				else
+					link = reinterpret_cast<void**>(item);
+			}
+			fs.cursor = link;
+			if ( *link != nullptr )
+				return 0;
+			// from now on, dropped items are gone: their multipages are released (and may be reused right away)
+			for ( size_t i=0; i<fs.blockCnt; ++i )
+				fs.scan[i].pb->releasedMultipages[idx] |= fs.scan[i].toRelease;
+			releasedMultipageCnt[idx] += fs.toReleaseCnt;
+			fs.phase = ScanPhase::discarding;
+		}
+
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, fs.phase == ScanPhase::discarding );
+		size_t releasedCnt = 0;
+		for ( ; fs.nextBlock<fs.blockCnt && releasedCnt<scan_step_discard_cnt; ++fs.nextBlock )
+		{
+			ReservationScan& rs = fs.scan[fs.nextBlock];
+			for ( size_t j=0; rs.toRelease && releasedCnt<scan_step_discard_cnt; ++j )
+				if ( rs.toRelease & ( ((MultipageMaskT)1) << j ) )
+				{
+					rs.toRelease &= ~( ((MultipageMaskT)1) << j );
+					if ( rs.pb->releasedMultipages[idx] & ( ((MultipageMaskT)1) << j ) ) // not reused yet
+					{
+						this->DiscardMemory( idxToPageAddr( rs.pb->blockAddress, idx, j << multipage_page_cnt_exp ), multipage_size );
+						++releasedCnt;
+					}
+				}
+			if ( rs.toRelease )
+				break;
+		}
+		if ( fs.nextBlock == fs.blockCnt )
+			finishFreeMultipageScan( freeList );
+		return releasedCnt * multipage_size;
+	}
+
+	bool isScanningFreeMultipages() const { return freeMultipageScan.phase != ScanPhase::idle; }
+	bool isScanningFreeMultipages( size_t idx ) const { return freeMultipageScan.phase != ScanPhase::idle && freeMultipageScan.idx == idx; }
+	size_t scannedBucket() const { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isScanningFreeMultipages() ); return freeMultipageScan.idx; }
+
+	// Ends a scan of releaseFreeMultipagesStep() for bucket idx, returning items it holds to *freeList (which is empty, as it is
+	// called when a bucket runs out of items); multipages that are marked released remain released
+	void cancelFreeMultipageScan( size_t idx, void** freeList )
+	{
+		FreeMultipageScan& fs = freeMultipageScan;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isScanningFreeMultipages( idx ) );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, *freeList == nullptr );
+		if ( fs.phase == ScanPhase::filtering && fs.dropped != nullptr )
+		{
+			*(fs.droppedLast) = fs.list;
+			fs.list = fs.dropped;
 		}
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, i == multipage_page_cnt );
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mpData.sz1 + mpData.sz2 == ( multipage_page_cnt << PAGE_SIZE_EXP ) );
+		*freeList = fs.list;
+		fs.phase = ScanPhase::idle;
 	}
 
-	void freePage( MemoryBlockListItem* chk )
+	// returns the scan buffer of releaseFreeMultipagesStep() to OS (it is mapped again by a next scan)
+	void releaseScanBuffer()
 	{
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, false );
-		// TODO: decommit
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !isScanningFreeMultipages() );
+		if ( scanBuffer == nullptr )
+			return;
+		this->freeChunkNoCache( scanBuffer, scanBufferSize );
+		scanBuffer = nullptr;
+		scanBufferSize = 0;
 	}
 
 	void deinitialize()
@@ -408,7 +768,16 @@ public:
 		{
 //nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "in block 0x{:x} about to delete 0x{:x} of size 0x{:x}", (size_t)( next ), (size_t)( next->blockAddress ), PAGE_SIZE * bucket_cnt );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, next->blockAddress );
-			this->freeChunkNoCache( reinterpret_cast<MemoryBlockListItem*>( next->blockAddress ), reservation_size );
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+			PageOwnerMap::clearOwner( next->blockAddress, reservation_size );
+#endif
+			// a cached reservation is returned to a state it was made in
+			if ( !this->cacheBlock( next->blockAddress, reservation_size, reservationKind( next->commitMode ) ) )
+				this->freeChunkNoCache( reinterpret_cast<MemoryBlockListItem*>( next->blockAddress ), reservation_size );
+			else if ( next->commitMode == CommitMode::demandPaging )
+				this->DiscardMemory( next->blockAddress, reservation_size );
+			else
+				this->DecommitMemory( next->blockAddress, reservation_size );
 			PageBlockDescriptor* tmp = next->next;
 //			delete next;
 			next = tmp;
@@ -416,14 +785,81 @@ public:
 //		class F { private: BasePageAllocator* alloc; public: F(BasePageAllocator*alloc_) {alloc = alloc_;} void f(PageBlockDescriptor& h) {NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h.blockAddress != nullptr ); alloc->freeChunkNoCache( h.blockAddress, reservation_size ); } }; F f(this);
 //		pageBlockDescriptors.doForEach(f);
 		pageBlockDescriptors.deinitialize();
+		freeMultipageScan.phase = ScanPhase::idle; // items it might hold are gone with reservations
+		releaseScanBuffer();
 		resetLists();
 		BasePageAllocator::deinitialize();
 	}
 };
 
 
+// Index of the highest bit set in x (x != 0)
+NODECPP_FORCEINLINE uint8_t highestBitIndex( uint64_t x )
+{
+#if defined NODECPP_MSVC
+#if defined NODECPP_X86
+	unsigned long ix;
+	if ( _BitScanReverse( &ix, static_cast<uint32_t>( x >> 32 ) ) )
+		return static_cast<uint8_t>( ix + 32 );
+	_BitScanReverse( &ix, static_cast<uint32_t>( x ) );
+	return static_cast<uint8_t>( ix );
+#elif defined NODECPP_X64
+	unsigned long ix;
+	_BitScanReverse64( &ix, x );
+	return static_cast<uint8_t>( ix );
+#else
+#error Unknown 32/64 bits architecture
+#endif
+#elif (defined NODECPP_CLANG) || (defined NODECPP_GCC)
+	return static_cast<uint8_t>( 63ull - __builtin_clzll( x ) );
+#else
+#error Unknown compiler
+#endif
+}
+
+// Same as highestBitIndex(), with a bit scan spelled out to be usable in constant expressions
+constexpr uint8_t highestBitIndexAtCompileTime( uint64_t x )
+{
+	uint8_t ix = 63;
+	while ( ( x >> ix ) == 0 )
+		--ix;
+	return ix;
+}
+
+// Index of the lowest bit set in x (x != 0)
+NODECPP_FORCEINLINE uint8_t lowestBitIndex( uint64_t x )
+{
+#if defined NODECPP_MSVC
+#if defined NODECPP_X86
+	unsigned long ix;
+	if ( _BitScanForward( &ix, static_cast<uint32_t>( x ) ) )
+		return static_cast<uint8_t>( ix );
+	_BitScanForward( &ix, static_cast<uint32_t>( x >> 32 ) );
+	return static_cast<uint8_t>( ix + 32 );
+#elif defined NODECPP_X64
+	unsigned long ix;
+	_BitScanForward64( &ix, x );
+	return static_cast<uint8_t>( ix );
+#else
+#error Unknown 32/64 bits architecture
+#endif
+#elif (defined NODECPP_CLANG) || (defined NODECPP_GCC)
+	return static_cast<uint8_t>( __builtin_ctzll( x ) );
+#else
+#error Unknown compiler
+#endif
+}
+
 //#define BULKALLOCATOR_HEAVY_DEBUG
 
+// Limits of caches of freed chunks that BulkAllocator has allocated directly from OS (that is, above max_pages); process-wide,
+// can be changed at any time (and take effect at next operations of heaps)
+struct DirectChunkCacheLimits
+{
+	static inline std::atomic<size_t> maxBytes = ((size_t)64) << 20; // per heap; 0 disables caching
+	static inline std::atomic<uint64_t> maxAgeNs = 2000000000; // a mapping that has not been reused for that long is unmapped
+};
+
 template<class BasePageAllocator, size_t commited_block_size, uint16_t max_pages>
 class BulkAllocator : public BasePageAllocator
 {
@@ -432,32 +868,96 @@ class BulkAllocator : public BasePageAllocator
 	static_assert( max_pages < PAGE_SIZE );
 	static constexpr size_t pagesPerAllocatedBlock = commited_block_size >> PAGE_SIZE_EXP;
 
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+	// Chunk headers are kept out of band: blocks are aligned by commited_block_size and start with a table of headers, an entry
+	// per page of a block (entries of pages of the table itself are unused); a chunk that starts at page i has its header at entry i.
+	// A chunk allocated directly from OS is mapped at the same alignment with an extra page in front, and its header is entry 1
+	// of that page. Thus, a header is found by an address of a chunk alone, and chunks (and user data) are page-aligned.
+	static constexpr size_t header_entry_size_exp = 5;
+	static constexpr size_t firstChunkPage = ( pagesPerAllocatedBlock << header_entry_size_exp ) >> PAGE_SIZE_EXP;
+	static constexpr size_t directChunkHeaderSize = PAGE_SIZE;
+	static_assert( ( commited_block_size & ( commited_block_size - 1 ) ) == 0 );
+	static_assert( firstChunkPage > 1 && firstChunkPage < pagesPerAllocatedBlock );
+#else
+	static constexpr size_t firstChunkPage = 0;
+	static constexpr size_t directChunkHeaderSize = 0;
+#endif
+	static constexpr size_t chunkPagesPerBlock = pagesPerAllocatedBlock - firstChunkPage;
+
+public:
+	struct AnyChunkHeader;
+
+private:
+	// Translation between chunks (page-aligned addresses) and their headers; both are the same unless headers are out of band
+	static NODECPP_FORCEINLINE AnyChunkHeader* headerOf( const void* chunk )
+	{
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		uintptr_t blockStart = (uintptr_t)(chunk) & ~( (uintptr_t)(commited_block_size) - 1 );
+		return reinterpret_cast<AnyChunkHeader*>( blockStart + ( ( ( (uintptr_t)(chunk) - blockStart ) >> PAGE_SIZE_EXP ) << header_entry_size_exp ) );
+#else
+		return reinterpret_cast<AnyChunkHeader*>( const_cast<void*>( chunk ) );
+#endif
+	}
+
+	static NODECPP_FORCEINLINE uint8_t* chunkOf( const AnyChunkHeader* h )
+	{
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		uintptr_t blockStart = (uintptr_t)(h) & ~( (uintptr_t)(commited_block_size) - 1 );
+		return reinterpret_cast<uint8_t*>( blockStart + ( ( ( (uintptr_t)(h) - blockStart ) >> header_entry_size_exp ) << PAGE_SIZE_EXP ) );
+#else
+		return reinterpret_cast<uint8_t*>( const_cast<AnyChunkHeader*>( h ) );
+#endif
+	}
+
+	// header of a chunk that starts pageCount pages after a chunk of h
+	template<class HeaderT>
+	static NODECPP_FORCEINLINE HeaderT* headerAfter( HeaderT* h, size_t pageCount )
+	{
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		return reinterpret_cast<HeaderT*>( (uintptr_t)(h) + ( pageCount << header_entry_size_exp ) );
+#else
+		return reinterpret_cast<HeaderT*>( (uintptr_t)(h) + ( pageCount << PAGE_SIZE_EXP ) );
+#endif
+	}
+
 public:
+	// Links to neighbours in a block are kept as addresses of chunks (page-aligned), with a page count and flags in low bits
 	struct AnyChunkHeader
 	{
 	private:
 		uintptr_t prev;
 		uintptr_t next;
 	public:
-		AnyChunkHeader* prevInBlock() {return (AnyChunkHeader*)( prev & ~((uintptr_t)(PAGE_SIZE_MASK)) ); }
-		const AnyChunkHeader* prevInBlock() const {return (const AnyChunkHeader*)( prev & ~((uintptr_t)(PAGE_SIZE_MASK)) ); }
-		AnyChunkHeader* nextInBlock() {return (AnyChunkHeader*)( next & ~((uintptr_t)(PAGE_SIZE_MASK) ) ); }
-		const AnyChunkHeader* nextInBlock() const {return (const AnyChunkHeader*)( next & ~((uintptr_t)(PAGE_SIZE_MASK) ) ); }
-		void setPrevInBlock( AnyChunkHeader* prev_ ) { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((uintptr_t)prev_ & PAGE_SIZE_MASK) == 0 ); prev = ( (uintptr_t)prev_ & ~(uintptr_t)(PAGE_SIZE_MASK) ) + (prev & ((uintptr_t)(PAGE_SIZE_MASK))); }
+		AnyChunkHeader* prevInBlock() {return headerOf( (void*)( prev & ~((uintptr_t)(PAGE_SIZE_MASK)) ) ); }
+		const AnyChunkHeader* prevInBlock() const {return headerOf( (void*)( prev & ~((uintptr_t)(PAGE_SIZE_MASK)) ) ); }
+		AnyChunkHeader* nextInBlock() {return headerOf( (void*)( next & ~((uintptr_t)(PAGE_SIZE_MASK) ) ) ); }
+		const AnyChunkHeader* nextInBlock() const {return headerOf( (void*)( next & ~((uintptr_t)(PAGE_SIZE_MASK) ) ) ); }
+		void setPrevInBlock( AnyChunkHeader* prev_ ) { uintptr_t prevChunk = (uintptr_t)chunkOf( prev_ ); NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (prevChunk & PAGE_SIZE_MASK) == 0 ); prev = prevChunk + (prev & ((uintptr_t)(PAGE_SIZE_MASK))); }
 		uint16_t getPageCount() const { return prev & ((uintptr_t)(PAGE_SIZE_MASK)); }
-		bool isFree() const { return next & ((uintptr_t)(PAGE_SIZE_MASK)); }
+		bool isFree() const { return next & 1; }
+		bool isDiscarded() const { return next & 2; } // pages of a free chunk (except the first one, if it holds a header) have been returned to OS
+		void setDiscarded() { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isFree() ); next |= 2; }
 		void set( AnyChunkHeader* prevInBlock_, AnyChunkHeader* nextInBlock_, uint16_t pageCount, bool isFree )
 		{
-			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((uintptr_t)prevInBlock_ & PAGE_SIZE_MASK) == 0 );
-			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((uintptr_t)nextInBlock_ & PAGE_SIZE_MASK) == 0 );
+			uintptr_t prevChunk = (uintptr_t)chunkOf( prevInBlock_ );
+			uintptr_t nextChunk = (uintptr_t)chunkOf( nextInBlock_ );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (prevChunk & PAGE_SIZE_MASK) == 0 );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (nextChunk & PAGE_SIZE_MASK) == 0 );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, pageCount <= (commited_block_size>>PAGE_SIZE_EXP) );
-			prev = ((uintptr_t)prevInBlock_) + pageCount;
-			next = ((uintptr_t)nextInBlock_) + isFree;
+			prev = prevChunk + pageCount;
+			next = nextChunk + isFree;
 		}
+		// a chunk allocated directly from OS has a page count of 0, and keeps its size instead of links
+		void setDirectlyAllocated( size_t size ) { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (size & PAGE_SIZE_MASK) == 0 ); prev = size; next = 0; }
+		size_t getDirectlyAllocatedSize() const { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, getPageCount() == 0 ); return prev; }
 	};
 
 	constexpr size_t maxAllocatableSize() {return ((size_t)max_pages) << PAGE_SIZE_EXP; }
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+	static constexpr size_t reservedSizeAtPageStart() { return 0; }
+#else
 	static constexpr size_t reservedSizeAtPageStart() { return sizeof( AnyChunkHeader ); }
+#endif
 
 private:
 //	std::vector<AnyChunkHeader*> blockList;
@@ -468,7 +968,269 @@ private:
 		FreeChunkHeader* prevFree;
 		FreeChunkHeader* nextFree;
 	};
-	FreeChunkHeader* freeListBegin[ max_pages + 1 ];
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+	static_assert( sizeof( FreeChunkHeader ) <= ( ((size_t)1) << header_entry_size_exp ) );
+#endif
+	// Chunks of up to max_pages pages are listed by page count; larger ones are at freeListBegin[max_pages], or, once their pages
+	// are discarded by trim(), at freeListBegin[discarded_free_list] (so that they are used last, and trim() never looks at them again)
+	static constexpr size_t discarded_free_list = max_pages + 1;
+	static constexpr size_t free_list_cnt = max_pages + 2;
+	FreeChunkHeader* freeListBegin[ free_list_cnt ];
+
+	// Two-level bitmap of non-empty free lists (a bit per list, and a bit per non-zero word of them), so that the smallest
+	// non-empty list at or above a given one is found by at most two bit scans
+	static constexpr size_t free_list_mask_word_cnt = ( free_list_cnt + 63 ) / 64;
+	static_assert( free_list_mask_word_cnt <= 64 );
+	uint64_t freeListMask[ free_list_mask_word_cnt ];
+	uint64_t freeListWordMask;
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	PageOwnerMap::OwnerIdT ownerId = PageOwnerMap::no_owner;
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+	PageOwnerMap::OwnerIdT ownerEntry() const { return ownerId | PageOwnerMap::large_object_flag; }
+#else
+	PageOwnerMap::OwnerIdT ownerEntry() const { return ownerId; }
+#endif
+#endif
+#ifdef IIBMALLOC_ENABLE_STATS
+	SizeClassStats classStats[ max_pages + 1 ]; // by page count of a chunk; the last one is for chunks allocated directly from OS
+	SizeClassStats blockStats; // blocks of commited_block_size that chunks of up to max_pages are carved from
+#endif
+
+	// Freed chunks above max_pages are kept mapped for a while (see DirectChunkCacheLimits) rather than unmapped right away;
+	// an allocation takes a cached mapping of the same size class (sizes within 1/4 of each other), remapping it to a required
+	// size if it differs. A descriptor of a cached mapping is kept in its first page; other pages are discarded lazily as soon
+	// as a mapping is cached, so that the cache holds no memory that OS needs. Expired mappings are unmapped on any operation
+	// with the cache (and by trim()).
+	struct CachedMapping
+	{
+		CachedMapping* prev; // in order of caching, the most recent one first
+		CachedMapping* next;
+		CachedMapping* prevInClass;
+		CachedMapping* nextInClass;
+		size_t size; // of the whole mapping
+		std::chrono::steady_clock::time_point cachedAt;
+	};
+	static constexpr size_t cache_class_cnt = 128;
+	CachedMapping* cacheHead;
+	CachedMapping* cacheTail;
+	CachedMapping* cacheClasses[ cache_class_cnt ];
+	size_t cachedBytes;
+
+	static size_t cacheClass( size_t pageCount ) // 4 classes per power of 2 of a page count; cache_class_cnt if too large to be cached
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, pageCount > max_pages );
+		size_t msb = highestBitIndex( pageCount - 1 );
+		size_t ret = ( ( msb - highestBitIndexAtCompileTime( max_pages ) ) << 2 ) + ( ( ( pageCount - 1 ) >> ( msb - 2 ) ) & 3 );
+		return ret < cache_class_cnt ? ret : cache_class_cnt;
+	}
+
+	static size_t chunkPageCountOfMapping( size_t mappedSize ) { return ( mappedSize - directChunkHeaderSize ) >> PAGE_SIZE_EXP; }
+
+	void initializeCache()
+	{
+		cacheHead = nullptr;
+		cacheTail = nullptr;
+		memset( cacheClasses, 0, sizeof( cacheClasses ) );
+		cachedBytes = 0;
+	}
+
+	void unlinkCached( CachedMapping* m )
+	{
+		if ( m->prev )
+			m->prev->next = m->next;
+		else
+			cacheHead = m->next;
+		if ( m->next )
+			m->next->prev = m->prev;
+		else
+			cacheTail = m->prev;
+		if ( m->prevInClass )
+			m->prevInClass->nextInClass = m->nextInClass;
+		else
+			cacheClasses[ cacheClass( chunkPageCountOfMapping( m->size ) ) ] = m->nextInClass;
+		if ( m->nextInClass )
+			m->nextInClass->prevInClass = m->prevInClass;
+		cachedBytes -= m->size;
+	}
+
+	void unmapCached( CachedMapping* m )
+	{
+		unlinkCached( m );
+		size_t size = m->size;
+#ifdef IIBMALLOC_ENABLE_STATS
+		classStats[max_pages].registerRelease( 1 ); // other pages are released by cacheMapping()
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		PageOwnerMap::clearOwner( m, size );
+#endif
+		this->freeChunkNoCache( m, size );
+	}
+
+	// Resizes a mapping of a chunk allocated directly from OS, keeping PageOwnerMap entries in sync: as soon as mremap() releases
+	// a range, another heap may map it and record itself as its owner, so entries of pages being released are cleared before
+	// mremap(), and only them (a mapping is tried to be grown in place first; if it has to move, it is released as a whole)
+	void* remapDirectMapping( void* ptr, size_t oldSize, size_t newSize )
+	{
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		uint8_t* p = reinterpret_cast<uint8_t*>( ptr );
+		if ( newSize <= oldSize ) // shrinking never moves a mapping
+		{
+			PageOwnerMap::clearOwner( p + newSize, oldSize - newSize );
+			void* ret = this->reallocateBlockNoCache( ptr, oldSize, newSize );
+			if ( ret == nullptr )
+				PageOwnerMap::setOwner( p + newSize, oldSize - newSize, ownerEntry() );
+			return ret;
+		}
+		if ( this->reallocateBlockNoCache( ptr, oldSize, newSize, false ) != nullptr )
+		{
+			PageOwnerMap::setOwner( p + oldSize, newSize - oldSize, ownerEntry() );
+			return ptr;
+		}
+		PageOwnerMap::clearOwner( ptr, oldSize );
+		void* ret = this->reallocateBlockNoCache( ptr, oldSize, newSize );
+		PageOwnerMap::setOwner( ret != nullptr ? ret : ptr, ret != nullptr ? newSize : oldSize, ownerEntry() );
+		return ret;
+#else
+		return this->reallocateBlockNoCache( ptr, oldSize, newSize );
+#endif
+	}
+
+	// Unmaps the least recently cached mappings above the limit of bytes, and ones that have been cached for too long
+	void evictCached( std::chrono::steady_clock::time_point now )
+	{
+		size_t maxBytes = DirectChunkCacheLimits::maxBytes.load( std::memory_order_relaxed );
+		std::chrono::nanoseconds maxAge( DirectChunkCacheLimits::maxAgeNs.load( std::memory_order_relaxed ) );
+		while ( cacheTail != nullptr && ( cachedBytes > maxBytes || now - cacheTail->cachedAt > maxAge ) )
+			unmapCached( cacheTail );
+	}
+
+	// Returns false if the mapping is not to be cached (then a caller unmaps it)
+	bool cacheMapping( uint8_t* mapped, size_t mappedSize )
+	{
+		size_t cls = cacheClass( chunkPageCountOfMapping( mappedSize ) );
+		if ( cls == cache_class_cnt || mappedSize > DirectChunkCacheLimits::maxBytes.load( std::memory_order_relaxed ) )
+			return false;
+		CachedMapping* m = reinterpret_cast<CachedMapping*>( mapped );
+		m->size = mappedSize;
+		m->cachedAt = std::chrono::steady_clock::now();
+		this->DiscardMemoryLazily( mapped + PAGE_SIZE, mappedSize - PAGE_SIZE );
+#ifdef IIBMALLOC_ENABLE_STATS
+		classStats[max_pages].registerRelease( ( mappedSize - PAGE_SIZE ) >> PAGE_SIZE_EXP );
+#endif
+		m->prev = nullptr;
+		m->next = cacheHead;
+		if ( cacheHead )
+			cacheHead->prev = m;
+		else
+			cacheTail = m;
+		cacheHead = m;
+		m->prevInClass = nullptr;
+		m->nextInClass = cacheClasses[cls];
+		if ( cacheClasses[cls] )
+			cacheClasses[cls]->prevInClass = m;
+		cacheClasses[cls] = m;
+		cachedBytes += mappedSize;
+		evictCached( m->cachedAt );
+		return true;
+	}
+
+	// Returns a mapping of exactly mappedSize bytes taken from the cache, or nullptr
+	uint8_t* takeCachedMapping( size_t mappedSize )
+	{
+		if ( cacheTail == nullptr )
+			return nullptr;
+		evictCached( std::chrono::steady_clock::now() );
+		size_t cls = cacheClass( chunkPageCountOfMapping( mappedSize ) );
+		if ( cls == cache_class_cnt )
+			return nullptr;
+		CachedMapping* m = nullptr;
+		for ( CachedMapping* curr = cacheClasses[cls]; curr != nullptr; curr = curr->nextInClass )
+		{
+			if ( curr->size == mappedSize )
+			{
+				m = curr;
+				break;
+			}
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+			if ( m == nullptr && curr->size > mappedSize ) // growing might move a mapping, and it would lose its alignment
+#else
+			if ( m == nullptr )
+#endif
+				m = curr;
+		}
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		if ( m == nullptr && cls + 1 < cache_class_cnt )
+			m = cacheClasses[cls + 1]; // any one is larger
+#endif
+		if ( m == nullptr )
+			return nullptr;
+		unlinkCached( m );
+		uint8_t* ret = reinterpret_cast<uint8_t*>( m );
+		size_t oldSize = m->size;
+#ifdef IIBMALLOC_ENABLE_STATS
+		classStats[max_pages].registerRefill( ( oldSize - PAGE_SIZE ) >> PAGE_SIZE_EXP ); // back from lazy discarding, if not taken by OS yet
+#endif
+		if ( oldSize != mappedSize )
+		{
+			uint8_t* remapped = reinterpret_cast<uint8_t*>( remapDirectMapping( ret, oldSize, mappedSize ) );
+			if ( remapped == nullptr )
+			{
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+				PageOwnerMap::clearOwner( ret, oldSize );
+#endif
+#ifdef IIBMALLOC_ENABLE_STATS
+				classStats[max_pages].registerRelease( oldSize >> PAGE_SIZE_EXP );
+#endif
+				this->freeChunkNoCache( ret, oldSize );
+				return nullptr;
+			}
+#ifdef IIBMALLOC_ENABLE_STATS
+			if ( mappedSize > oldSize )
+				classStats[max_pages].registerRefill( ( mappedSize - oldSize ) >> PAGE_SIZE_EXP );
+			else
+				classStats[max_pages].registerRelease( ( oldSize - mappedSize ) >> PAGE_SIZE_EXP );
+#endif
+			ret = remapped;
+		}
+		return ret;
+	}
+
+	void markFreeListNonEmpty( size_t idx )
+	{
+		freeListMask[ idx >> 6 ] |= 1ull << ( idx & 63 );
+		freeListWordMask |= 1ull << ( idx >> 6 );
+	}
+
+	void markFreeListEmpty( size_t idx )
+	{
+		freeListMask[ idx >> 6 ] &= ~( 1ull << ( idx & 63 ) );
+		if ( freeListMask[ idx >> 6 ] == 0 )
+			freeListWordMask &= ~( 1ull << ( idx >> 6 ) );
+	}
+
+	bool isFreeListMarkedNonEmpty( size_t idx ) const { return ( freeListMask[ idx >> 6 ] >> ( idx & 63 ) ) & 1; }
+
+	// Returns free_list_cnt if all lists starting from idx are empty
+	NODECPP_FORCEINLINE size_t findNonEmptyFreeList( size_t idx ) const
+	{
+		size_t word = idx >> 6;
+		uint64_t bits = freeListMask[ word ] & ( ~0ull << ( idx & 63 ) );
+		if ( bits )
+			return ( word << 6 ) + lowestBitIndex( bits );
+		uint64_t words = word + 1 < 64 ? freeListWordMask & ( ~0ull << ( word + 1 ) ) : 0;
+		if ( words == 0 )
+			return free_list_cnt;
+		word = lowestBitIndex( words );
+		return ( word << 6 ) + lowestBitIndex( freeListMask[ word ] );
+	}
+
+	static size_t freeListIndex( const FreeChunkHeader* item )
+	{
+		size_t pageCount = item->getPageCount();
+		if ( pageCount <= max_pages )
+			return pageCount - 1;
+		return item->isDiscarded() ? discarded_free_list : max_pages;
+	}
 
 	void removeFromFreeList( FreeChunkHeader* item )
 	{
@@ -479,13 +1241,13 @@ private:
 		}
 		else
 		{
-			uint16_t idx = item->getPageCount() - 1;
-			if ( idx >= max_pages )
-				idx = max_pages;
+			size_t idx = freeListIndex( item );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[idx] == item );
 			freeListBegin[idx] = item->nextFree;
 			if ( freeListBegin[idx] != nullptr )
 				freeListBegin[idx]->prevFree = nullptr;
+			else
+				markFreeListEmpty( idx );
 		}
 		if ( item->nextFree )
 		{
@@ -494,6 +1256,18 @@ private:
 		}
 	}
 
+	void addToFreeList( FreeChunkHeader* item )
+	{
+		size_t idx = freeListIndex( item );
+		item->prevFree = nullptr;
+		item->nextFree = freeListBegin[idx];
+		if ( freeListBegin[idx] != nullptr )
+			freeListBegin[idx]->prevFree = item;
+		else
+			markFreeListNonEmpty( idx );
+		freeListBegin[idx] = item;
+	}
+
 	void dbgValidateBlock( const AnyChunkHeader* h )
 	{
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != nullptr );
@@ -508,7 +1282,7 @@ private:
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, next > curr );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !(curr->isFree() && next->isFree()) );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, next->prevInBlock() == curr );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<const uint8_t*>(curr) + (curr->getPageCount() << PAGE_SIZE_EXP) == reinterpret_cast<const uint8_t*>( next ) );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, headerAfter( curr, curr->getPageCount() ) == next );
 			}
 			curr = next;
 		}
@@ -523,11 +1297,11 @@ private:
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, prev < curr );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !(prev->isFree() && curr->isFree()) );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, prev->nextInBlock() == curr );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<const uint8_t*>(prev) + (prev->getPageCount() << PAGE_SIZE_EXP) == reinterpret_cast<const uint8_t*>( curr ) );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, headerAfter( prev, prev->getPageCount() ) == curr );
 			}
 			curr = prev;
 		}
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, (szTotal << PAGE_SIZE_EXP) == commited_block_size );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, szTotal == chunkPagesPerBlock );
 	}
 
 #ifdef BULKALLOCATOR_HEAVY_DEBUG
@@ -568,11 +1342,15 @@ private:
 
 	void dbgValidateAllFreeLists()
 	{
-		for ( uint16_t i=0; i<=max_pages; ++i )
+		for ( uint16_t i=0; i<free_list_cnt; ++i )
 		{
 			FreeChunkHeader* h = freeListBegin[i];
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( h != nullptr ) == isFreeListMarkedNonEmpty( i ) );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( freeListMask[ i >> 6 ] != 0 ) == ( ( freeListWordMask >> ( i >> 6 ) ) & 1 ) );
+			for ( const FreeChunkHeader* curr = h; curr && i >= max_pages; curr = curr->nextFree )
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, curr->isDiscarded() == ( i == discarded_free_list ) );
 			if ( h !=nullptr )
-				dbgValidateFreeList( h, i + 1 );
+				dbgValidateFreeList( h, i < max_pages ? i + 1 : max_pages + 1 );
 		}
 	}
 
@@ -580,9 +1358,17 @@ public:
 	void initialize( uint8_t blockSizeExp )
 	{
 		BasePageAllocator::initialize( blockSizeExp );
-		for ( size_t i=0; i<=max_pages; ++i )
+		for ( size_t i=0; i<free_list_cnt; ++i )
 			freeListBegin[i] = nullptr;
-//		new ( &blockList ) std::vector<AnyChunkHeader*>;
+		memset( freeListMask, 0, sizeof( freeListMask ) );
+		freeListWordMask = 0;
+		initializeCache();
+#ifdef IIBMALLOC_ENABLE_STATS
+		for ( size_t i=0; i<=max_pages; ++i )
+			classStats[i] = SizeClassStats();
+		blockStats = SizeClassStats();
+#endif
+//		new ( &blockList ) std::vector<AnyChunkHeader*>;
 		blocks.initialize( PAGE_SIZE_EXP );
 #ifdef BULKALLOCATOR_HEAVY_DEBUG
 		dbgValidateAllBlocks();
@@ -590,7 +1376,12 @@ public:
 #endif
 	}
 
-	AnyChunkHeader* allocate( size_t szIncludingHeader )
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	void setOwnerId( PageOwnerMap::OwnerIdT id ) { ownerId = id; }
+#endif
+
+	// Returns an address of a chunk (page-aligned); user data start at reservedSizeAtPageStart() from it
+	void* allocate( size_t szIncludingHeader )
 	{
 #ifdef BULKALLOCATOR_HEAVY_DEBUG
 		dbgValidateAllBlocks();
@@ -606,68 +1397,94 @@ public:
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, pageCount <= UINT16_MAX );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, pageCount <= max_pages );
 
-			if ( freeListBegin[pageCount - 1] == nullptr )
+			// a chunk of an exact size, if any; otherwise, a larger chunk to be split: preferably one of above max_pages (splitting
+			// chunks of exact lists leaves small remainders), resident ones first, then one of the smallest larger exact list; a new
+			// block is obtained only if there is no chunk of at least pageCount pages at all
+			size_t idx = findNonEmptyFreeList( pageCount - 1 );
+			if ( idx != pageCount - 1 && isFreeListMarkedNonEmpty( max_pages ) )
+				idx = max_pages;
+			else if ( idx != pageCount - 1 && isFreeListMarkedNonEmpty( discarded_free_list ) )
+				idx = discarded_free_list;
+			if ( idx == free_list_cnt )
 			{
-				if ( freeListBegin[ max_pages ] == nullptr )
+				// a cached block is discarded by releaseBlock(), and keeps its advice
+				uint8_t* block = reinterpret_cast<uint8_t*>( this->getCachedBlock( commited_block_size, PageCache::Kind::bulkBlock ) );
+				if ( block == nullptr )
 				{
-					FreeChunkHeader* h = reinterpret_cast<FreeChunkHeader*>( this->getFreeBlockNoCache( commited_block_size ) );
-					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h!= nullptr );
-//					blockList.push_back( h );
-					*(blocks.createNew()) = h;
-					freeListBegin[ max_pages ] = h;
-					freeListBegin[ max_pages ]->set( nullptr, nullptr, pagesPerAllocatedBlock, true );
-					freeListBegin[ max_pages ]->nextFree = nullptr;
-					freeListBegin[ max_pages ]->prevFree = nullptr;
+#if defined IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+					block = reinterpret_cast<uint8_t*>( this->getAlignedBlockNoCache( commited_block_size, commited_block_size ) );
+#elif defined IIBMALLOC_ENABLE_HUGE_PAGES
+					block = reinterpret_cast<uint8_t*>( this->getAlignedBlockNoCache( commited_block_size, HUGE_PAGE_SIZE ) );
+#else
+					block = reinterpret_cast<uint8_t*>( this->getFreeBlockNoCache( commited_block_size ) );
+#endif
+					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, block != nullptr );
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+					this->AdviseHugePages( block, commited_block_size );
+#endif
 				}
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+				PageOwnerMap::setOwner( block, commited_block_size, ownerEntry() );
+#endif
+//				blockList.push_back( h );
+				*(blocks.createNew()) = reinterpret_cast<AnyChunkHeader*>( block );
+#ifdef IIBMALLOC_ENABLE_STATS
+				blockStats.registerRefill( pagesPerAllocatedBlock );
+#endif
+				FreeChunkHeader* h = static_cast<FreeChunkHeader*>( headerOf( block + ( firstChunkPage << PAGE_SIZE_EXP ) ) );
+				h->set( nullptr, nullptr, chunkPagesPerBlock, true );
+				addToFreeList( h );
+				idx = max_pages;
+			}
 
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[ max_pages ] != nullptr );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[ max_pages ]->getPageCount() > max_pages );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[ max_pages ]->prevFree == nullptr );
-
-				ret = freeListBegin[ max_pages ];
-				freeListBegin[ max_pages ] = freeListBegin[ max_pages ]->nextFree; // pop
-				if ( freeListBegin[ max_pages ] != nullptr )
-					freeListBegin[ max_pages ]->prevFree = nullptr;
-				FreeChunkHeader* updatedBegin = reinterpret_cast<FreeChunkHeader*>( reinterpret_cast<uint8_t*>(ret) + (pageCount << PAGE_SIZE_EXP) );
+			FreeChunkHeader* chunk = freeListBegin[idx];
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, chunk != nullptr );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, chunk->prevFree == nullptr );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, chunk->getPageCount() >= pageCount );
+			removeFromFreeList( chunk ); // pop
+			ret = chunk;
+			if ( ret->getPageCount() > pageCount )
+			{
+				FreeChunkHeader* updatedBegin = static_cast<FreeChunkHeader*>( headerAfter( ret, pageCount ) );
 				updatedBegin->set( ret, ret->nextInBlock(), ret->getPageCount() - (uint16_t)pageCount, true );
-				updatedBegin->prevFree = nullptr;
-				updatedBegin->nextFree = nullptr;
-
+				if ( ret->isDiscarded() )
+					updatedBegin->setDiscarded(); // all its pages but the first one are still not resident
+				if ( ret->nextInBlock() )
+					ret->nextInBlock()->setPrevInBlock( updatedBegin );
 				ret->set( ret->prevInBlock(), updatedBegin, (uint16_t)pageCount, false );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[ max_pages ] != updatedBegin );
-
-				uint16_t remainingPageCnt = updatedBegin->getPageCount();
-				if ( remainingPageCnt > max_pages )
-				{
-					updatedBegin->nextFree = freeListBegin[ max_pages ];
-					if ( freeListBegin[ max_pages ] != nullptr )
-						freeListBegin[ max_pages ]->prevFree = updatedBegin;
-					freeListBegin[ max_pages ] = updatedBegin;
-				}
-				else
-				{
-					updatedBegin->nextFree = freeListBegin[ remainingPageCnt - 1 ];
-					if ( freeListBegin[ remainingPageCnt - 1 ] != nullptr )
-						freeListBegin[ remainingPageCnt - 1 ]->prevFree = updatedBegin;
-					freeListBegin[ remainingPageCnt - 1 ] = updatedBegin;
-				}
+				addToFreeList( updatedBegin );
 			}
 			else
-			{
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[pageCount - 1]->nextFree == nullptr || freeListBegin[pageCount - 1]->nextFree->prevFree == freeListBegin[pageCount - 1] );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, freeListBegin[pageCount - 1]->prevFree == nullptr );
-				ret = freeListBegin[pageCount - 1];
-				freeListBegin[pageCount - 1] = freeListBegin[pageCount - 1]->nextFree;
-				if ( freeListBegin[pageCount - 1] != nullptr )
-					freeListBegin[pageCount - 1]->prevFree = nullptr;
-			}
+				ret->set( ret->prevInBlock(), ret->nextInBlock(), (uint16_t)pageCount, false );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ret->getPageCount() <= max_pages );
+#ifdef IIBMALLOC_ENABLE_STATS
+			classStats[pageCount - 1].registerAlloc();
+#endif
 		}
 		else
 		{
-			ret = reinterpret_cast<FreeChunkHeader*>( this->getFreeBlockNoCache( pageCount << PAGE_SIZE_EXP ) );
-			ret->set( (FreeChunkHeader*)(void*)(pageCount<<PAGE_SIZE_EXP), nullptr, 0, false );
+			size_t mappedSize = ( pageCount << PAGE_SIZE_EXP ) + directChunkHeaderSize;
+			uint8_t* mapped = takeCachedMapping( mappedSize );
+			if ( mapped == nullptr )
+			{
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+				mapped = reinterpret_cast<uint8_t*>( this->getAlignedBlockNoCache( mappedSize, commited_block_size ) );
+#else
+				mapped = reinterpret_cast<uint8_t*>( this->getFreeBlockNoCache( mappedSize ) );
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+				PageOwnerMap::setOwner( mapped, mappedSize, ownerEntry() );
+#endif
+#ifdef IIBMALLOC_ENABLE_STATS
+				classStats[max_pages].registerRefill( pageCount );
+#endif
+			}
+			ret = headerOf( mapped + directChunkHeaderSize );
+			ret->setDirectlyAllocated( pageCount << PAGE_SIZE_EXP );
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ret->getPageCount() == 0 );
+#ifdef IIBMALLOC_ENABLE_STATS
+			classStats[max_pages].registerAlloc();
+#endif
 		}
 
 
@@ -676,12 +1493,12 @@ public:
 		dbgValidateAllFreeLists();
 #endif
 
-		return ret;
+		return chunkOf( ret );
 	}
 
 	void deallocate( void* ptr )
 	{
-		AnyChunkHeader* h = reinterpret_cast<AnyChunkHeader*>( ptr );
+		AnyChunkHeader* h = headerOf( ptr );
 		if ( h->getPageCount() != 0 )
 		{
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h->getPageCount() <= max_pages );
@@ -689,15 +1506,20 @@ public:
 		dbgValidateAllBlocks();
 		dbgValidateAllFreeLists();
 #endif
+#ifdef IIBMALLOC_ENABLE_STATS
+			classStats[h->getPageCount() - 1].registerDealloc();
+#endif
 
 			AnyChunkHeader* prev = h->prevInBlock();
 			if ( prev && prev->isFree() )
 			{
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, prev->prevInBlock() == nullptr || !prev->prevInBlock()->isFree() );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, prev->nextInBlock() == h );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<uint8_t*>(prev->prevInBlock()) + (prev->prevInBlock()->getPageCount() << PAGE_SIZE_EXP) == reinterpret_cast<uint8_t*>( h ) );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, headerAfter( prev, prev->getPageCount() ) == h );
 				removeFromFreeList( reinterpret_cast<FreeChunkHeader*>(prev) );
 				prev->set( prev->prevInBlock(), h->nextInBlock(), prev->getPageCount() + h->getPageCount(), true );
+				if ( prev->nextInBlock() )
+					prev->nextInBlock()->setPrevInBlock( prev );
 				h = prev;
 			}
 			AnyChunkHeader* next = h->nextInBlock();
@@ -705,20 +1527,15 @@ public:
 			{
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, next->nextInBlock() == nullptr || !next->nextInBlock()->isFree() );
 				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, next->prevInBlock() == h );
-				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, reinterpret_cast<uint8_t*>(h) + (h->getPageCount() << PAGE_SIZE_EXP) == reinterpret_cast<uint8_t*>( next ) );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, headerAfter( h, h->getPageCount() ) == next );
 				removeFromFreeList( reinterpret_cast<FreeChunkHeader*>(next) );
 				h->set( h->prevInBlock(), next->nextInBlock(), h->getPageCount() + next->getPageCount(), true );
+				if ( h->nextInBlock() )
+					h->nextInBlock()->setPrevInBlock( h );
 			}
 
-			FreeChunkHeader* hfree = reinterpret_cast<FreeChunkHeader*>(h);
-			uint16_t idx = hfree->getPageCount() - 1;
-			if ( idx >= max_pages )
-				idx = max_pages;
-			hfree->prevFree = nullptr;
-			hfree->nextFree = freeListBegin[idx];
-			if ( freeListBegin[idx] != nullptr )
-				freeListBegin[idx]->prevFree = hfree;
-			freeListBegin[idx] = hfree;
+			h->set( h->prevInBlock(), h->nextInBlock(), h->getPageCount(), true ); // might be not merged at all
+			addToFreeList( reinterpret_cast<FreeChunkHeader*>(h) );
 
 #ifdef BULKALLOCATOR_HEAVY_DEBUG
 		dbgValidateAllBlocks();
@@ -727,15 +1544,216 @@ public:
 		}
 		else
 		{
-			size_t deallocSize = (size_t)(h->prevInBlock());
-			this->freeChunkNoCache( ptr, deallocSize );
+			size_t deallocSize = h->getDirectlyAllocatedSize();
+			uint8_t* mapped = reinterpret_cast<uint8_t*>( ptr ) - directChunkHeaderSize;
+#ifdef IIBMALLOC_ENABLE_STATS
+			classStats[max_pages].registerDealloc();
+#endif
+			if ( cacheMapping( mapped, deallocSize + directChunkHeaderSize ) )
+				return;
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+			PageOwnerMap::clearOwner( mapped, deallocSize + directChunkHeaderSize );
+#endif
+#ifdef IIBMALLOC_ENABLE_STATS
+			classStats[max_pages].registerRelease( deallocSize >> PAGE_SIZE_EXP );
+#endif
+			this->freeChunkNoCache( mapped, deallocSize + directChunkHeaderSize );
 		}
 
 	}
 
+	// Tries to resize a chunk without moving it: shrinking returns a tail to free lists (merging it with a free next chunk, if any);
+	// growing absorbs (a part of) a free next chunk. Returns false if not possible (then the chunk remains intact).
+	bool reallocateInPlace( void* ptr, size_t szIncludingHeader )
+	{
+		AnyChunkHeader* h = headerOf( ptr );
+		size_t pageCount = ((uintptr_t)(-((intptr_t)((((uintptr_t)(-((intptr_t)szIncludingHeader))))) >> PAGE_SIZE_EXP )));
+		uint16_t currentPageCount = h->getPageCount();
+		if ( currentPageCount == 0 || pageCount > max_pages )
+			return false; // either is not in a block, or is not to be in a block
+		if ( pageCount == currentPageCount )
+			return true;
+
+#ifdef BULKALLOCATOR_HEAVY_DEBUG
+		dbgValidateAllBlocks();
+		dbgValidateAllFreeLists();
+#endif
+
+		AnyChunkHeader* next = h->nextInBlock();
+		if ( pageCount < currentPageCount )
+		{
+			FreeChunkHeader* tail = static_cast<FreeChunkHeader*>( headerAfter( h, pageCount ) );
+			uint16_t tailPageCount = currentPageCount - (uint16_t)pageCount;
+			if ( next && next->isFree() )
+			{
+				removeFromFreeList( reinterpret_cast<FreeChunkHeader*>(next) );
+				tailPageCount += next->getPageCount();
+				next = next->nextInBlock();
+			}
+			tail->set( h, next, tailPageCount, true );
+			if ( next )
+				next->setPrevInBlock( tail );
+			h->set( h->prevInBlock(), tail, (uint16_t)pageCount, false );
+			addToFreeList( tail );
+		}
+		else
+		{
+			if ( next == nullptr || !next->isFree() || currentPageCount + next->getPageCount() < pageCount )
+				return false;
+			removeFromFreeList( reinterpret_cast<FreeChunkHeader*>(next) );
+			uint16_t remainingPageCount = currentPageCount + next->getPageCount() - (uint16_t)pageCount;
+			AnyChunkHeader* nextNext = next->nextInBlock();
+			if ( remainingPageCount )
+			{
+				FreeChunkHeader* rest = static_cast<FreeChunkHeader*>( headerAfter( h, pageCount ) );
+				rest->set( h, nextNext, remainingPageCount, true );
+				if ( nextNext )
+					nextNext->setPrevInBlock( rest );
+				h->set( h->prevInBlock(), rest, (uint16_t)pageCount, false );
+				addToFreeList( rest );
+			}
+			else
+			{
+				if ( nextNext )
+					nextNext->setPrevInBlock( h );
+				h->set( h->prevInBlock(), nextNext, (uint16_t)pageCount, false );
+			}
+		}
+#ifdef IIBMALLOC_ENABLE_STATS
+		classStats[currentPageCount - 1].registerDealloc();
+		classStats[pageCount - 1].registerAlloc();
+#endif
+
+#ifdef BULKALLOCATOR_HEAVY_DEBUG
+		dbgValidateAllBlocks();
+		dbgValidateAllFreeLists();
+#endif
+		return true;
+	}
+
+	// Resizes a chunk that has been allocated directly from OS (that is, above max_pages);
+	// returns a new chunk address, or nullptr if not possible (then the chunk remains intact)
+	void* reallocateLarge( void* ptr, size_t szIncludingHeader )
+	{
+		AnyChunkHeader* h = headerOf( ptr );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h->getPageCount() == 0 );
+		size_t pageCount = ((uintptr_t)(-((intptr_t)((((uintptr_t)(-((intptr_t)szIncludingHeader))))) >> PAGE_SIZE_EXP )));
+		if ( pageCount <= max_pages )
+			return nullptr; // let it go to blocks
+		size_t oldSize = h->getDirectlyAllocatedSize();
+		size_t newSize = pageCount << PAGE_SIZE_EXP;
+		if ( newSize == oldSize )
+			return ptr;
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		return nullptr; // a remapped chunk would lose alignment its header is found by
+#else
+		AnyChunkHeader* ret = reinterpret_cast<AnyChunkHeader*>( remapDirectMapping( ptr, oldSize, newSize ) );
+		if ( ret == nullptr )
+			return nullptr;
+		ret->setDirectlyAllocated( newSize );
+#ifdef IIBMALLOC_ENABLE_STATS
+		classStats[max_pages].registerDealloc();
+		classStats[max_pages].registerRelease( oldSize >> PAGE_SIZE_EXP );
+		classStats[max_pages].registerAlloc();
+		classStats[max_pages].registerRefill( pageCount );
+#endif
+		return ret;
+#endif // IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+	}
+
+#ifdef IIBMALLOC_ENABLE_STATS
+	const SizeClassStats& getSizeClassStats( size_t pageCount ) const { return classStats[ ( pageCount == 0 || pageCount > max_pages ) ? max_pages : pageCount - 1 ]; } // 0: chunks allocated directly from OS
+	const SizeClassStats& getBlockStats() const { return blockStats; }
+
+	void printSizeClassStats() const
+	{
+		blockStats.printStats( "bulk blocks of size", commited_block_size );
+		for ( size_t i=0; i<max_pages; ++i )
+			classStats[i].printStats( "bulk chunks of pages", i + 1 );
+		classStats[max_pages].printStats( "bulk chunks above pages", max_pages );
+	}
+#endif
+
+	// Part of trim(): unmaps cached mappings that have expired (pages of others are discarded already, see cacheMapping())
+	size_t trimCache()
+	{
+		size_t cachedBefore = cachedBytes;
+		evictCached( std::chrono::steady_clock::now() );
+		return cachedBefore - cachedBytes;
+	}
+
+	// Returns free memory to OS: cached mappings of chunks above max_pages are unmapped if they have expired; blocks that are
+	// entirely free are unmapped; free chunks above max_pages get all their pages but the first one (with a chunk header, unless
+	// headers are out of band) discarded, and are moved to a list of discarded chunks. A chunk at a time, until byteBudget bytes
+	// are released, or deadline is reached (checked before each chunk but a first one, so that repeated calls make progress), or
+	// there is nothing left (see hasChunksToTrim()). Returns a number of bytes released.
+	size_t trim( size_t byteBudget, std::chrono::steady_clock::time_point deadline )
+	{
+#ifdef BULKALLOCATOR_HEAVY_DEBUG
+		dbgValidateAllBlocks();
+		dbgValidateAllFreeLists();
+#endif
+		size_t released = trimCache();
+		FreeChunkHeader* curr;
+		while ( released < byteBudget && ( released == 0 || std::chrono::steady_clock::now() < deadline ) && ( curr = freeListBegin[ max_pages ] ) != nullptr )
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !curr->isDiscarded() );
+			removeFromFreeList( curr );
+			if ( curr->getPageCount() == chunkPagesPerBlock )
+			{
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, curr->prevInBlock() == nullptr && curr->nextInBlock() == nullptr );
+				uint8_t* block = chunkOf( curr ) - ( firstChunkPage << PAGE_SIZE_EXP );
+				blocks.remove( reinterpret_cast<AnyChunkHeader*>( block ) );
+				releaseBlock( block );
+				released += commited_block_size;
+#ifdef IIBMALLOC_ENABLE_STATS
+				blockStats.registerRelease( pagesPerAllocatedBlock );
+#endif
+			}
+			else
+			{
+				constexpr size_t headerPageCnt = firstChunkPage == 0 ? 1 : 0; // a page with an in-band header is kept
+				size_t sz = ( curr->getPageCount() - headerPageCnt ) << PAGE_SIZE_EXP;
+				this->DiscardMemory( chunkOf( curr ) + ( headerPageCnt << PAGE_SIZE_EXP ), sz );
+				curr->setDiscarded();
+				addToFreeList( curr );
+				released += sz;
+#ifdef IIBMALLOC_ENABLE_STATS
+				blockStats.registerRelease( curr->getPageCount() - headerPageCnt );
+#endif
+			}
+		}
+#ifdef BULKALLOCATOR_HEAVY_DEBUG
+		dbgValidateAllBlocks();
+		dbgValidateAllFreeLists();
+#endif
+		return released;
+	}
+
+	// true if trim() has chunks left to discard or blocks to unmap
+	bool hasChunksToTrim() const { return freeListBegin[ max_pages ] != nullptr; }
+
+	void setPageCache( PageCache* cache )
+	{
+		BasePageAllocator::setPageCache( cache );
+		blocks.setPageCache( cache );
+	}
+
+	// returns a block, no longer listed in blocks, to the page cache (with its pages discarded) or to OS
+	void releaseBlock( uint8_t* block )
+	{
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		PageOwnerMap::clearOwner( block, commited_block_size );
+#endif
+		if ( this->cacheBlock( block, commited_block_size, PageCache::Kind::bulkBlock ) )
+			this->DiscardMemory( block, commited_block_size );
+		else
+			this->freeChunkNoCache( block, commited_block_size );
+	}
+
 	size_t getAllocatedSize( void* ptr )
 	{
-		AnyChunkHeader* h = reinterpret_cast<AnyChunkHeader*>( ptr );
+		AnyChunkHeader* h = headerOf( ptr );
 		if ( h->getPageCount() != 0 )
 		{
 			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h->getPageCount() <= max_pages );
@@ -743,14 +1761,16 @@ public:
 		}
 		else
 		{
-			return (size_t)(h->prevInBlock());
+			return h->getDirectlyAllocatedSize();
 		}
 
 	}
 
 	void deinitialize()
 	{
-		class F { private: BasePageAllocator* alloc; public: F(BasePageAllocator*alloc_) {alloc = alloc_;} void f(AnyChunkHeader* h) {NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != nullptr ); alloc->freeChunkNoCache( h, commited_block_size ); } }; F f(this);
+		while ( cacheTail != nullptr )
+			unmapCached( cacheTail );
+		class F { private: BulkAllocator* alloc; public: F(BulkAllocator*alloc_) {alloc = alloc_;} void f(AnyChunkHeader* h) {NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, h != nullptr ); alloc->releaseBlock( reinterpret_cast<uint8_t*>( h ) ); } }; F f(this);
 		blocks.doForEach(f);
 		blocks.deinitialize();
 /*		for ( size_t i=0; i<blockList.size(); ++i )
@@ -759,8 +1779,10 @@ public:
 			this->freeChunkNoCache( blockList[i], commited_block_size );
 		}
 		blockList.clear();*/
-		for ( size_t i=0; i<=max_pages; ++i )
+		for ( size_t i=0; i<free_list_cnt; ++i )
 			freeListBegin[i] = nullptr;
+		memset( freeListMask, 0, sizeof( freeListMask ) );
+		freeListWordMask = 0;
 #ifdef BULKALLOCATOR_HEAVY_DEBUG
 		dbgValidateAllBlocks();
 		dbgValidateAllFreeLists();
@@ -768,285 +1790,789 @@ public:
 	}
 };
 
+// Size-class (bucket size) schemas; any of them can be used as a BucketSizes parameter of IibAllocatorBase.
+// A schema maps bucket indexes to sizes with indexToBucketSize() (non-decreasing, multiples of 8), and sizes to the smallest
+// fitting index with sizeToIndex( sz, msb ), where sz > 8 and msb is an index of the highest bit set in sz - 1 (to let
+// a caller choose how to find it: by an intrinsic at runtime, or by a loop in constant expressions).
+// Sizes up to IibAllocatorBase::MaxBucketSize must map to indexes below a bucket count (this is checked at compile time).
+
+// 8, 16, 32, 64, ...
+struct ExpBucketSizes
+{
+	static constexpr size_t indexToBucketSize( uint8_t ix )
+	{
+		return 1ULL << (ix + 3);
+	}
+	static constexpr uint8_t sizeToIndex( uint64_t sz, uint8_t msb )
+	{
+		return static_cast<uint8_t>(msb - 2);
+	}
+};
+
+// 8, 16, 24, 32, 48, 64, 96, 128, ...
+struct HalfExpBucketSizes
+{
+	static constexpr size_t indexToBucketSize( uint8_t ix )
+	{
+		size_t ret = ( 1ULL << ((ix>>1) + 3) ) + ( ( ( ( ix + 1 ) & 1 ) - 1 ) & ( 1ULL << ((ix>>1) + 2) ) );
+		return alignUpExp( ret, 3 ); // this is because of case ix = 1, ret = 12 (keeping 8-byte alignment)
+	}
+	static constexpr uint8_t sizeToIndex( uint64_t sz, uint8_t msb )
+	{
+		uint8_t addition = 1ull & ( ( sz - 1 ) >> (msb-1) );
+		return static_cast<uint8_t>(((msb-2)<<1) + addition - 1);
+	}
+};
+
+// 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, ...
+struct QuarterExpBucketSizes
+{
+	static constexpr size_t indexToBucketSize( uint8_t ix )
+	{
+		ix += 3;
+		size_t ret = ( 4ULL << ((ix>>2)) ) + ((ix&3)+1) * (1ULL << ((ix>>2)));
+		return alignUpExp( ret, 3 ); // this is because of case ix = 1, ret = 12 (keeping 8-byte alignment), etc
+	}
+	static constexpr uint8_t sizeToIndex( uint64_t sz, uint8_t msb )
+	{
+		uint8_t addition = 3ull & ( ( sz - 1 ) >> (msb-2) );
+		return static_cast<uint8_t>(((msb-2)<<2) + addition - 3);
+	}
+};
+
 //#define USE_EXP_BUCKET_SIZES
 #define USE_HALF_EXP_BUCKET_SIZES
 //#define USE_QUAD_EXP_BUCKET_SIZES
+// USE_PROFILED_BUCKET_SIZES (project-level) takes precedence: a table of iibmalloc_profiled_bucket_sizes.h is used
+
+#ifdef USE_PROFILED_BUCKET_SIZES
+typedef ProfiledBucketSizes DefaultBucketSizes;
+#elif defined USE_EXP_BUCKET_SIZES
+typedef ExpBucketSizes DefaultBucketSizes;
+#elif defined USE_HALF_EXP_BUCKET_SIZES
+typedef HalfExpBucketSizes DefaultBucketSizes;
+#elif defined USE_QUAD_EXP_BUCKET_SIZES
+typedef QuarterExpBucketSizes DefaultBucketSizes;
+#else
+#error "Undefined bucket size schema"
+#endif
+
+// Part of a heap that is the same for all bucket size schemas (heaps of different schemas may coexist, and free each other's pointers)
+class IibAllocatorCommon
+{
+protected:
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	// Each heap has a process-unique id that is recorded in PageOwnerMap for all pages it hands out.
+	// Pointers freed by a non-owning thread are pushed to an owner's remoteFreeList (lock-free MPSC stack,
+	// with 'next' kept in the freed item itself) and are taken over by the owner at its slow paths.
+	PageOwnerMap::OwnerIdT heapId = PageOwnerMap::no_owner;
+	std::atomic<void*> remoteFreeList;
+	size_t (*bucketSizeOf)( uint8_t ix ) = nullptr; // of a bucket size schema of a heap, which may differ from one of a heap at hand
+
+	static inline std::atomic<IibAllocatorCommon*> heapsById[ PageOwnerMap::max_owner_cnt ];
+
+	static PageOwnerMap::OwnerIdT acquireHeapId( IibAllocatorCommon* heap )
+	{
+		for ( size_t i=1; i<PageOwnerMap::max_owner_cnt; ++i )
+		{
+			IibAllocatorCommon* expected = nullptr;
+			if ( heapsById[i].load( std::memory_order_relaxed ) == nullptr && heapsById[i].compare_exchange_strong( expected, heap, std::memory_order_acq_rel ) )
+				return (PageOwnerMap::OwnerIdT)i;
+		}
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "too many heaps (max = {})", PageOwnerMap::max_owner_cnt - 1 );
+		throw std::bad_alloc();
+	}
+
+	static void releaseHeapId( PageOwnerMap::OwnerIdT id )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, id != PageOwnerMap::no_owner );
+		heapsById[id].store( nullptr, std::memory_order_release );
+	}
+
+	void postRemoteFree( void* ptr )
+	{
+		void* head = remoteFreeList.load( std::memory_order_relaxed );
+		do
+		{
+			*reinterpret_cast<void**>( ptr ) = head;
+		}
+		while ( !remoteFreeList.compare_exchange_weak( head, ptr, std::memory_order_release, std::memory_order_relaxed ) );
+	}
+
+	NODECPP_NOINLINE void deallocateForeign( void* ptr, PageOwnerMap::OwnerIdT ownerId )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ownerId != PageOwnerMap::no_owner ); // not allocated by any of heaps
+		IibAllocatorCommon* owner = ownerId != PageOwnerMap::no_owner ? heapsById[ownerId].load( std::memory_order_acquire ) : nullptr;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, owner != nullptr );
+		if ( owner == nullptr ) // unknown pointer, or its heap has already been released: leaked rather than written to
+		{
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "deallocation of {} that belongs to no live heap (owner id = {}); ignored", ptr, ownerId );
+			return;
+		}
+		owner->postRemoteFree( ptr );
+	}
 
-class IibAllocatorBase
+	// size of a bucket item of another heap (see IibAllocatorBase::getAllocatedSize())
+	NODECPP_NOINLINE static size_t foreignBucketSize( PageOwnerMap::OwnerIdT ownerId, uint8_t ix )
+	{
+		IibAllocatorCommon* owner = ownerId != PageOwnerMap::no_owner ? heapsById[ownerId].load( std::memory_order_acquire ) : nullptr;
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, owner != nullptr );
+		return owner != nullptr ? owner->bucketSizeOf( ix ) : 0;
+	}
+#endif // IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+};
+
+template<class BucketSizes = DefaultBucketSizes>
+class IibAllocatorBase : public IibAllocatorCommon
 {
 protected:
-	static constexpr size_t MaxBucketSize = PAGE_SIZE * 2;
+	static constexpr size_t MaxBucketSize = PAGE_SIZE * 2; // larger items go to BulkAllocator: a bucket owns only 1/BucketCount of each reservation
+	// larger requests fail with std::bad_alloc before any arithmetic on their sizes (they could not be mapped anyway), so that
+	// adding headers, alignment and rounding up to pages never wraps around
+	static constexpr size_t MaxAllocationSize = SIZE_MAX >> 1;
 	static constexpr size_t BucketCountExp = 6;
 	static constexpr size_t BucketCount = 1 << BucketCountExp;
 	void* buckets[BucketCount];
+	uint8_t nextBucketToTrim = 0; // a bucket which free list is being scanned by trim(), if any (see isScanningFreeMultipages())
+	size_t trimScansLeft = BucketCount; // in a current round of trim() over all buckets
+
+	struct BumpRange
+	{
+		uint8_t* cursor;
+		uint8_t* end;
+		uint8_t* nextBlock; // second segment of a multipage, if any
+		size_t nextBlockSz;
+	};
+	BumpRange bumpRanges[BucketCount];
+#ifdef IIBMALLOC_ENABLE_STATS
+	SizeClassStats bucketStats[BucketCount];
+#endif
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+	int64_t bytesUntilSample = 0; // an allocation that makes it negative is sampled (see HeapProfiler)
+	uint64_t samplerRngState = 0; // 0: not seeded yet
+#endif
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+	SizeHistogram sizeHistogram;
+	static_assert( SizeHistogram::max_size == MaxBucketSize );
+#endif
 
 	static constexpr size_t reservation_size_exp = 23;
 	typedef BulkAllocator<PageAllocatorWithCaching, 1 << reservation_size_exp, 32> BulkAllocatorT;
 	BulkAllocatorT bulkAllocator;
 
-	typedef SoundingAddressPageAllocator<PageAllocatorWithCaching, BucketCountExp, reservation_size_exp, 4, 3> PageAllocatorT;
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+	static constexpr size_t page_reservation_size_exp = BucketCountExp + HUGE_PAGE_SIZE_EXP; // a bucket gets a whole huge page of each reservation (128MB of address space)
+#else
+	static constexpr size_t page_reservation_size_exp = reservation_size_exp;
+#endif
+	typedef SoundingAddressPageAllocator<PageAllocatorWithCaching, BucketCountExp, page_reservation_size_exp, 4, 3> PageAllocatorT;
 	PageAllocatorT pageAllocator;
 
-protected:
+	PageCache ownPageCache;
+	PageCache* sharedPageCache = nullptr; // if set by setPageCache()
+	PageCache* activePageCache() { return sharedPageCache != nullptr ? sharedPageCache : &ownPageCache; }
+
 public:
-#ifdef USE_EXP_BUCKET_SIZES
 	static constexpr
 	NODECPP_FORCEINLINE size_t indexToBucketSize(uint8_t ix) // Note: currently is used once per page formatting
 	{
-		return 1ULL << (ix + 3);
+		return BucketSizes::indexToBucketSize( ix );
 	}
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-	static constexpr
-	NODECPP_FORCEINLINE size_t indexToBucketSizeHalfExp(uint8_t ix) // Note: currently is used once per page formatting
+
+	static
+	NODECPP_FORCEINLINE uint8_t sizeToIndex(size_t sz)
 	{
-		size_t ret = ( 1ULL << ((ix>>1) + 3) ) + ( ( ( ( ix + 1 ) & 1 ) - 1 ) & ( 1ULL << ((ix>>1) + 2) ) );
-		return alignUpExp( ret, 3 ); // this is because of case ix = 1, ret = 12 (keeping 8-byte alignment)
+		if ( sz <= 8 )
+			return 0;
+		return BucketSizes::sizeToIndex( sz, highestBitIndex( sz - 1 ) );
 	}
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-	static constexpr
-	NODECPP_FORCEINLINE size_t indexToBucketSizeQuarterExp(uint8_t ix) // Note: currently is used once per page formatting
+
+	// Same mapping as sizeToIndex() above, usable in constant expressions
+	static constexpr uint8_t sizeToIndexAtCompileTime(uint64_t sz)
 	{
-		ix += 3;
-		size_t ret = ( 4ULL << ((ix>>2)) ) + ((ix&3)+1) * (1ULL << ((ix>>2)));
-//		size_t ret = ( 4ULL << ((ix>>2)) ) + ( ( ( ( ix+1) & 1 ) - 1 ) & (1ULL << ((ix>>2))) ) + ( ( ( ((ix>>1)+1) & 1 ) - 1 ) & (2ULL << ((ix>>2))) ) + (1ULL << ((ix>>2)));
-		return alignUpExp( ret, 3 ); // this is because of case ix = 1, ret = 12 (keeping 8-byte alignment), etc
+		if ( sz <= 8 )
+			return 0;
+		return BucketSizes::sizeToIndex( sz, highestBitIndexAtCompileTime( sz - 1 ) );
 	}
+
+	static_assert( sizeToIndexAtCompileTime( MaxBucketSize ) < BucketCount, "bucket size schema has too many buckets" );
+	static_assert( indexToBucketSize( sizeToIndexAtCompileTime( MaxBucketSize ) ) >= MaxBucketSize );
+
+public:
+	IibAllocatorBase() { initialize(); }
+	IibAllocatorBase(const IibAllocatorBase&) = delete;
+	IibAllocatorBase(IibAllocatorBase&&) = default;
+	IibAllocatorBase& operator=(const IibAllocatorBase&) = delete;
+	IibAllocatorBase& operator=(IibAllocatorBase&&) = default;
+
+	void enable() {}
+	void disable() {}
+
+	static constexpr size_t maxBucketSize() { return MaxBucketSize; } // larger objects are allocated by bulkAllocator
+
+	// Large chunks are recognized by an offset of user data in a page (items of buckets never start there, see allocateFromBumpRange());
+	// with IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS, user data of large chunks start at a page, and their pages are marked in PageOwnerMap;
+	// otherwise, so are pages where allocateAlignedLarge() places user data (see isInnerChunkPointer())
+	static NODECPP_FORCEINLINE bool isLargeChunkPointer( void* ptr )
+	{
+		constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		static_assert( memForbidden == 0 );
+		return PageAllocatorT::getOffsetInPage( ptr ) == 0 && PageOwnerMap::isLargeObjectPage( ptr );
+#elif defined IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		size_t offset = PageAllocatorT::getOffsetInPage( ptr );
+		return offset == memForbidden || ( offset == 0 && PageOwnerMap::isLargeObjectPage( ptr ) );
 #else
-#error "Undefined bucket size schema"
+		return PageAllocatorT::getOffsetInPage( ptr ) == memForbidden;
 #endif
+	}
 
-#if defined NODECPP_MSVC
-#if defined NODECPP_X86
-#ifdef USE_EXP_BUCKET_SIZES
-	static
-		NODECPP_FORCEINLINE uint8_t sizeToIndex(uint32_t sz)
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	// same, for callers that have already read pageEntry, the entry of ptr's page in PageOwnerMap
+	static NODECPP_FORCEINLINE bool isLargeChunkPointer( void* ptr, PageOwnerMap::OwnerIdT pageEntry )
 	{
-		unsigned long ix;
-		uint8_t r = _BitScanReverse(&ix, sz - 1);
-		return (sz <= 8) ? 0 : static_cast<uint8_t>(ix - 2);
+		constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+		size_t offset = PageAllocatorT::getOffsetInPage( ptr );
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		static_assert( memForbidden == 0 );
+		return offset == 0 && ( pageEntry & PageOwnerMap::large_object_flag ) != 0;
+#else
+		return offset == memForbidden || ( offset == 0 && ( pageEntry & PageOwnerMap::large_object_flag ) != 0 );
+#endif
 	}
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-#error "not implemented"
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-#error "not implemented"
+#endif
+
+	// for a large chunk pointer, true if allocateAlignedLarge() has placed it inside a chunk rather than at its start
+	// (then, the address of the chunk's first page is stored right before it)
+	static NODECPP_FORCEINLINE bool isInnerChunkPointer( void* ptr )
+	{
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		return ( PageOwnerMap::getEntry( ptr ) & PageOwnerMap::inner_page_flag ) != 0; // all their pages are marked as large
+#elif defined IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		return PageAllocatorT::getOffsetInPage( ptr ) == 0;
 #else
-#error Undefined bucket size schema
+		return false;
 #endif
-#elif defined NODECPP_X64
-#ifdef USE_EXP_BUCKET_SIZES
-	static
-	NODECPP_FORCEINLINE uint8_t sizeToIndex(uint64_t sz)
+	}
+
+	// for a large chunk pointer, the address of the chunk's first page (which is what BulkAllocator accepts)
+	static NODECPP_FORCEINLINE void* largeChunkPageStart( void* ptr )
 	{
-		unsigned long ix;
-		uint8_t r = _BitScanReverse64(&ix, sz - 1);
-		return (sz <= 8) ? 0 : static_cast<uint8_t>(ix - 2);
+		if ( isInnerChunkPointer( ptr ) )
+			return reinterpret_cast<void**>( ptr )[-1];
+		return PageAllocatorT::ptrToPageStart( ptr );
 	}
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-	static
-	NODECPP_FORCEINLINE uint8_t sizeToIndexHalfExp(uint64_t sz)
+
+
+	// number of items that allocateFromBumpRange() hands out from a page-aligned block of blockSz bytes
+	static constexpr size_t itemCountInPageAlignedBlock( size_t blockSz, size_t bucketSz )
 	{
-		if ( sz <= 8 )
-			return 0;
-		sz -= 1;
-		unsigned long ix;
-		uint8_t r = _BitScanReverse64(&ix, sz);
-//		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "ix = {}", ix );
-		uint8_t addition = 1 & ( sz >> (ix-1) );
-		ix = ((ix-2)<<1) + addition - 1;
-		return static_cast<uint8_t>(ix);
+		constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+		size_t itemCnt = blockSz / bucketSz;
+		if( memForbidden == 0 || ( bucketSz & (memForbidden*2-1) ) == 0 )
+			return itemCnt;
+		size_t ret = itemCnt;
+		for ( size_t i=1; i<itemCnt; ++i )
+			if ( ( ( i * bucketSz ) & PAGE_SIZE_MASK ) == memForbidden )
+				--ret;
+		return ret;
 	}
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-	static
-	NODECPP_FORCEINLINE uint8_t sizeToIndexQuarterExp(uint64_t sz)
+
+
+	// Items of freshly obtained pages are handed out by moving a cursor rather than being linked into a bucket list up front
+	// (which would touch all pages of a multipage at once); only items that are freed get to bucket lists
+	NODECPP_FORCEINLINE void* allocateFromBumpRange( size_t bucketSz, uint8_t szidx )
 	{
-		if ( sz <= 8 )
-			return 0;
-		sz -= 1;
-		unsigned long ix;
-		uint8_t r = _BitScanReverse64(&ix, sz);
-//		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "ix = {}", ix );
-		uint8_t addition = 3 & ( sz >> (ix-2) );
-		ix = ((ix-2)<<2) + addition - 3;
-		return static_cast<uint8_t>(ix);
+		constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+		BumpRange& range = bumpRanges[szidx];
+		for (;;)
+		{
+			uint8_t* item = range.cursor;
+			if ( memForbidden != 0 && ( ((uintptr_t)item) & PAGE_SIZE_MASK ) == memForbidden )
+				item += bucketSz;
+			if ( range.end - item >= (ptrdiff_t)bucketSz )
+			{
+				range.cursor = item + bucketSz;
+				return item;
+			}
+			if ( range.nextBlock == nullptr )
+				return nullptr;
+			range.cursor = range.nextBlock;
+			range.end = range.nextBlock + range.nextBlockSz;
+			range.nextBlock = nullptr;
+			range.nextBlockSz = 0;
+		}
+	}
+
+	void refillBucket( size_t bucketSz, uint8_t szidx )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, bucketSz >= sizeof( void* ) );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, bumpRanges[szidx].nextBlock == nullptr );
+		PageAllocatorT::MultipageData mpData;
+//		uint8_t* block = reinterpret_cast<uint8_t*>( pageAllocator.getPage( szidx ) );
+		pageAllocator.getMultipage( szidx, mpData );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, mpData.ptr1 != nullptr );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( ((uintptr_t)(mpData.ptr1)) & PAGE_SIZE_MASK ) == 0 );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( ((uintptr_t)(mpData.ptr2)) & PAGE_SIZE_MASK ) == 0 );
+		BumpRange& range = bumpRanges[szidx];
+		range.cursor = reinterpret_cast<uint8_t*>( mpData.ptr1 );
+		range.end = range.cursor + mpData.sz1;
+		range.nextBlock = reinterpret_cast<uint8_t*>( mpData.ptr2 );
+		range.nextBlockSz = mpData.sz2;
+#ifdef IIBMALLOC_ENABLE_STATS
+		bucketStats[szidx].registerRefill( ( mpData.sz1 + mpData.sz2 ) >> PAGE_SIZE_EXP );
+#endif
+	}
+
+	// trim() is in the middle of scanning items of bucket szidx, which runs out of items meanwhile: takes them back; the bucket
+	// is in use, and is skipped till a next round of trim()
+	void cancelTrimScan( uint8_t szidx )
+	{
+		pageAllocator.cancelFreeMultipageScan( szidx, &(buckets[szidx]) );
+		nextBucketToTrim = ( szidx + 1 ) & ( BucketCount - 1 );
+		--trimScansLeft;
+	}
+
+	NODECPP_NOINLINE void* allocateInCaseNoFreeBucket( size_t sz, uint8_t szidx )
+	{
+		if ( pageAllocator.isScanningFreeMultipages( szidx ) )
+		{
+			cancelTrimScan( szidx );
+			if ( buckets[szidx] )
+			{
+				void* ret = buckets[szidx];
+				buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+				return ret;
+			}
+		}
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		if ( remoteFreeList.load( std::memory_order_relaxed ) != nullptr )
+		{
+			drainRemoteFrees();
+			if ( buckets[szidx] )
+			{
+				void* ret = buckets[szidx];
+				buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+				return ret;
+			}
+		}
+#endif
+		size_t bucketSz = indexToBucketSize( szidx );
+		void* ret = allocateFromBumpRange( bucketSz, szidx );
+		if ( ret != nullptr )
+			return ret;
+		refillBucket( bucketSz, szidx );
+		ret = allocateFromBumpRange( bucketSz, szidx );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ret != nullptr );
+		return ret;
+	}
+
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+	// Picks a next sampling point; returns false if a current allocation is not to be sampled
+	// (sampling is off, or the sampler is just being seeded at a first allocation of a heap)
+	bool prepareNextSample()
+	{
+		bool seeded = samplerRngState != 0;
+		if ( !seeded )
+			samplerRngState = ( (uintptr_t)(this) * 0x9E3779B97F4A7C15ull ) | 1;
+		bytesUntilSample = (int64_t)( HeapProfiler::nextSamplingDistance( samplerRngState ) );
+		return seeded && HeapProfiler::getSamplingInterval() != 0;
+	}
+
+	NODECPP_NOINLINE void* allocateSampled( size_t sz )
+	{
+		bool sample = prepareNextSample();
+		bytesUntilSample += (int64_t)sz; // allocate() below is not to reach a sampling point again
+		void* ret = allocate( sz );
+		if ( sample )
+			HeapProfiler::recordAllocation( ret, sz );
+		return ret;
+	}
+
+	NODECPP_NOINLINE void sampleAllocated( void* ptr, size_t sz ) // for allocations that are made other than by allocate()
+	{
+		if ( prepareNextSample() )
+			HeapProfiler::recordAllocation( ptr, sz );
+	}
+
+	// Counts down bytes of items of a batch one by one, as allocate() would do, so that each item reaching a sampling point is sampled
+	NODECPP_FORCEINLINE void sampleBatch( void** items, size_t n, size_t sz )
+	{
+		if ( NODECPP_LIKELY( bytesUntilSample >= (int64_t)( sz * n ) ) )
+		{
+			bytesUntilSample -= (int64_t)( sz * n );
+			return;
+		}
+		for ( size_t i=0; i<n; ++i )
+			if ( ( bytesUntilSample -= (int64_t)sz ) < 0 )
+				sampleAllocated( items[i], sz );
+	}
+#endif
+
+	NODECPP_NOINLINE void* allocateInCaseTooLargeForBucket(size_t sz)
+	{
+		if ( sz > MaxAllocationSize )
+			throw std::bad_alloc();
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		if ( remoteFreeList.load( std::memory_order_relaxed ) != nullptr )
+			drainRemoteFrees(); // chunks being returned might be merged and reused right now
+#endif
+		constexpr size_t memStart = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+		void* block = bulkAllocator.allocate( sz + memStart );
+
+		return reinterpret_cast<uint8_t*>(block) + memStart;
+	}
+
+	NODECPP_FORCEINLINE void* allocate(size_t sz)
+	{
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+		if ( NODECPP_UNLIKELY( ( bytesUntilSample -= (int64_t)sz ) < 0 ) )
+			return allocateSampled( sz );
+#endif
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+		sizeHistogram.record( sz );
+#endif
+		if ( sz <= MaxBucketSize )
+		{
+			uint8_t szidx = sizeToIndex( sz );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, szidx < BucketCount );
+#ifdef IIBMALLOC_ENABLE_STATS
+			bucketStats[szidx].registerAlloc();
+#endif
+			if ( buckets[szidx] )
+			{
+				void* ret = buckets[szidx];
+				buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+				return ret;
+			}
+			else
+				return allocateInCaseNoFreeBucket( sz, szidx );
+		}
+		else
+			return allocateInCaseTooLargeForBucket( sz );
+
+		return nullptr;
 	}
-#else
-#error Undefined bucket size schema
+
+	// Items of a bucket are laid out starting from a page-aligned address with a stride of a bucket size;
+	// therefore, any bucket which size is a multiple of a requested alignment (not above PAGE_SIZE) yields aligned items.
+	// Larger requests, and ones of alignments above PAGE_SIZE, are served by allocateAlignedLarge() with page-aligned user data.
+	// Without IIBMALLOC_ENABLE_CROSS_THREAD_FREE, the latter returns nullptr, and it is up to a caller to use some other means.
+	NODECPP_NOINLINE void* allocateAligned(size_t sz, size_t alignment)
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, alignment != 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+		if ( alignment <= ALIGNMENT )
+			return allocate( sz );
+		if ( sz > MaxAllocationSize || alignment > MaxAllocationSize - sz ) // see allocateAlignedLarge()
+			throw std::bad_alloc();
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+		sizeHistogram.record( sz );
 #endif
-#else
-#error Unknown 32/64 bits architecture
+		if ( alignment > PAGE_SIZE )
+			return allocateAlignedLarge( sz, alignment );
+		if ( sz < alignment )
+			sz = alignment;
+		if ( sz > MaxBucketSize )
+			return allocateAlignedLarge( sz, alignment );
+		uint8_t szidx = sizeToIndex( sz );
+		for ( ; szidx < BucketCount; ++szidx )
+		{
+			size_t bucketSz = indexToBucketSize( szidx );
+			if ( bucketSz > MaxBucketSize )
+				return allocateAlignedLarge( sz, alignment );
+			if ( ( bucketSz & ( alignment - 1 ) ) == 0 )
+			{
+#ifdef IIBMALLOC_ENABLE_STATS
+				bucketStats[szidx].registerAlloc();
+#endif
+				void* ret;
+				if ( buckets[szidx] )
+				{
+					ret = buckets[szidx];
+					buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+				}
+				else
+					ret = allocateInCaseNoFreeBucket( bucketSz, szidx );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)(ret) & ( alignment - 1 ) ) == 0 );
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+				if ( ( bytesUntilSample -= (int64_t)sz ) < 0 )
+					sampleAllocated( ret, sz );
 #endif
+				return ret;
+			}
+		}
+		return allocateAlignedLarge( sz, alignment );
+	}
 
-#elif (defined NODECPP_CLANG) || (defined NODECPP_GCC)
-#if defined NODECPP_X86
-#ifdef USE_EXP_BUCKET_SIZES
-	static
-		NODECPP_FORCEINLINE uint8_t sizeToIndex(uint32_t sz)
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	// Places user data at the first page after chunkPageStart that is aligned as requested, with the chunk's first page address
+	// stored right before them; their page gets pageEntry in PageOwnerMap (see isInnerChunkPointer())
+	static void* placeInsideChunk( void* chunkPageStart, size_t alignment, PageOwnerMap::OwnerIdT pageEntry )
 	{
-		uint32_t ix = __builtin_clzl(sz - 1);
-		return (sz <= 8) ? 0 : static_cast<uint8_t>(29ul - ix);
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, alignment >= PAGE_SIZE );
+		void* ret = reinterpret_cast<void*>( ( (uintptr_t)(chunkPageStart) + alignment ) & ~( (uintptr_t)(alignment) - 1 ) );
+		reinterpret_cast<void**>( ret )[-1] = chunkPageStart;
+		PageOwnerMap::setOwner( ret, PAGE_SIZE, pageEntry );
+		return ret;
 	}
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-#error "not implemented"
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-#error "not implemented"
-#else
-#error Undefined bucket size schema
 #endif
-#elif defined NODECPP_X64
-#ifdef USE_EXP_BUCKET_SIZES
-	static
-		NODECPP_FORCEINLINE uint8_t sizeToIndex(uint64_t sz)
+
+	NODECPP_FORCEINLINE void* allocateAlignedLarge(size_t sz, size_t alignment) // for allocateAligned() with alignment above ALIGNMENT
 	{
-		uint64_t ix = __builtin_clzll(sz - 1);
-		return (sz <= 8) ? 0 : static_cast<uint8_t>(61ull - ix);
+		void* ret;
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+		if ( alignment <= PAGE_SIZE )
+		{
+			ret = allocateInCaseTooLargeForBucket( sz );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PageAllocatorT::getOffsetInPage( ret ) == 0 );
+		}
+		else
+		{
+			// a chunk gets enough extra pages for an aligned page to be among them; if the chunk itself is aligned, it is used as is
+			ret = allocateInCaseTooLargeForBucket( sz + alignment - PAGE_SIZE );
+			if ( ( (uintptr_t)(ret) & ( alignment - 1 ) ) != 0 )
+				ret = placeInsideChunk( ret, alignment, heapId | PageOwnerMap::large_object_flag | PageOwnerMap::inner_page_flag );
+		}
+#elif defined IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		// Header of a chunk precedes its user data within the first page; so user data are placed at a page after it
+		if ( alignment < PAGE_SIZE )
+			alignment = PAGE_SIZE;
+		ret = placeInsideChunk( PageAllocatorT::ptrToPageStart( allocateInCaseTooLargeForBucket( sz + alignment ) ), alignment, heapId | PageOwnerMap::large_object_flag );
+#else
+		return nullptr;
+#endif
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+		if ( ( bytesUntilSample -= (int64_t)sz ) < 0 )
+			sampleAllocated( ret, sz );
+#endif
+		return ret;
 	}
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-	static
-		NODECPP_FORCEINLINE uint8_t sizeToIndexHalfExp(uint64_t sz)
+
+	NODECPP_FORCEINLINE void deallocateLarge(void* ptr)
 	{
-		if ( sz <= 8 )
-			return 0;
-		sz -= 1;
-//		uint64_t ix = __builtin_clzll(sz - 1);
-//		return (sz <= 8) ? 0 : static_cast<uint8_t>(61ull - ix);
-		uint64_t ix = __builtin_clzll(sz);
-		ix = 63ull - ix;
-//		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "ix = {}", ix );
-		uint8_t addition = 1ull & ( sz >> (ix-1) );
-		ix = ((ix-2)<<1) + addition - 1;
-		return static_cast<uint8_t>(ix);
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		if ( isInnerChunkPointer( ptr ) ) // see allocateAlignedLarge()
+		{
+			void* chunkPageStart = reinterpret_cast<void**>( ptr )[-1];
+			PageOwnerMap::setOwner( ptr, PAGE_SIZE, PageOwnerMap::getEntry( chunkPageStart ) ); // as set by BulkAllocator for all pages of a chunk
+			bulkAllocator.deallocate( chunkPageStart );
+			return;
+		}
+#endif
+		bulkAllocator.deallocate( PageAllocatorT::ptrToPageStart( ptr ) );
 	}
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-	static
-		NODECPP_FORCEINLINE uint8_t sizeToIndexQuarterExp(uint64_t sz)
+
+	// Allocates n blocks of the same size sz to out[0..n-1]; for sizes served by buckets, a bucket is resolved once,
+	// and items are detached from its free list as a run (then taken from fresh pages, if the list is short).
+	NODECPP_NOINLINE void allocateBatch(size_t sz, size_t n, void** out)
 	{
-		if ( sz <= 8 )
-			return 0;
-		sz -= 1;
-//		uint64_t ix = __builtin_clzll(sz - 1);
-//		return (sz <= 8) ? 0 : static_cast<uint8_t>(61ull - ix);
-		uint64_t ix = __builtin_clzll(sz);
-		ix = 63ull - ix;
-//		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "ix = {}", ix );
-		uint8_t addition = 3ull & ( sz >> (ix-2) );
-		ix = ((ix-2)<<2) + addition - 3;
-		return static_cast<uint8_t>(ix);
-	}
-#else
-#error Undefined bucket size schema
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+		sizeHistogram.record( sz, n );
 #endif
-#else
-#error Unknown 32/64 bits architecture
-#endif	
-
-#else
-#error Unknown compiler
+		if ( sz > MaxBucketSize )
+		{
+			for ( size_t i=0; i<n; ++i )
+				out[i] = allocateInCaseTooLargeForBucket( sz );
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+			sampleBatch( out, n, sz );
 #endif
-	
-public:
-	IibAllocatorBase() { initialize(); }
-	IibAllocatorBase(const IibAllocatorBase&) = delete;
-	IibAllocatorBase(IibAllocatorBase&&) = default;
-	IibAllocatorBase& operator=(const IibAllocatorBase&) = delete;
-	IibAllocatorBase& operator=(IibAllocatorBase&&) = default;
-
-	void enable() {}
-	void disable() {}
-
+			return;
+		}
+		uint8_t szidx = sizeToIndex( sz );
+		size_t bucketSz = indexToBucketSize( szidx );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, szidx < BucketCount );
+#ifdef IIBMALLOC_ENABLE_STATS
+		bucketStats[szidx].registerAlloc( n );
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		if ( remoteFreeList.load( std::memory_order_relaxed ) != nullptr )
+			drainRemoteFrees();
+#endif
+		size_t i = 0;
+		for (;;)
+		{
+			void* item = buckets[szidx];
+			while ( item != nullptr && i < n )
+			{
+				out[i++] = item;
+				item = *reinterpret_cast<void**>(item);
+			}
+			buckets[szidx] = item;
+			if ( i < n && pageAllocator.isScanningFreeMultipages( szidx ) )
+			{
+				cancelTrimScan( szidx );
+				continue;
+			}
+			while ( i < n && ( item = allocateFromBumpRange( bucketSz, szidx ) ) != nullptr )
+				out[i++] = item;
+			if ( i == n )
+				break;
+			refillBucket( bucketSz, szidx );
+		}
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+		sampleBatch( out, n, sz );
+#endif
+	}
 
-	bool formatAllocatedPageAlignedBlock( uint8_t* block, size_t blockSz, size_t bucketSz, uint8_t bucketidx )
+	// Deallocates n blocks (nullptr-s are skipped); items of buckets are grouped by bucket (in any order they come in)
+	// into local lists, and each list is spliced into a respective bucket at once.
+	NODECPP_NOINLINE void deallocateBatch(void** ptrs, size_t n)
 	{
-		constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
-		if ( block == nullptr )
-			return false;
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( ((uintptr_t)block) & PAGE_SIZE_MASK ) == 0 );
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( blockSz & PAGE_SIZE_MASK ) == 0 );
-		if( ( bucketSz & (memForbidden*2-1) ) == 0 ) // that is, (K * bucketSz) % PAGE_SIZE != memForbidden for any K
+		static_assert( BucketCount <= 64 );
+		void* runHeads[BucketCount];
+		void* runTails[BucketCount];
+		uint64_t runMask = 0; // buckets with a non-empty list
+		for ( size_t i=0; i<n; ++i )
 		{
-			size_t itemCnt = blockSz / bucketSz;
-			if ( itemCnt )
+			void* ptr = ptrs[i];
+			if ( ptr == nullptr )
+				continue;
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+			HeapProfiler::onDeallocation( ptr );
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+			PageOwnerMap::OwnerIdT pageEntry = PageOwnerMap::getEntry( ptr );
+			PageOwnerMap::OwnerIdT ownerId = PageOwnerMap::entryToOwner( pageEntry );
+			if ( ownerId != heapId )
 			{
-				for ( size_t i=0; i<(itemCnt-1)*bucketSz; i+=bucketSz )
-				{
-					NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ((i + bucketSz) & PAGE_SIZE_MASK) != memForbidden );
-					*reinterpret_cast<void**>(block + i) = block + i + bucketSz;
-				}
-				*reinterpret_cast<void**>(block + (itemCnt-1)*bucketSz) = nullptr;
-				buckets[bucketidx] = block;
-				return true;
+				deallocateForeign( ptr, ownerId );
+				continue;
+			}
+			if ( isLargeChunkPointer( ptr, pageEntry ) )
+#else
+			if ( isLargeChunkPointer( ptr ) )
+#endif
+			{
+				deallocateLarge( ptr );
+				continue;
 			}
+			size_t idx = PageAllocatorT::addressToIdx( ptr );
+#ifdef IIBMALLOC_ENABLE_STATS
+			bucketStats[idx].registerDealloc();
+#endif
+			if ( runMask & ( 1ull << idx ) )
+				*reinterpret_cast<void**>( ptr ) = runHeads[idx];
 			else
-				return false;
+			{
+				runMask |= 1ull << idx;
+				runTails[idx] = ptr;
+			}
+			runHeads[idx] = ptr;
+		}
+		while ( runMask )
+		{
+			size_t idx = lowestBitIndex( runMask );
+			runMask &= runMask - 1;
+			*reinterpret_cast<void**>( runTails[idx] ) = buckets[idx];
+			buckets[idx] = runHeads[idx];
+		}
+	}
+
+	// Returns ptr itself if a current bucket still fits a new size (and is not more than twice as large),
+	// or if a large chunk can be resized in place; otherwise, allocates, copies and frees.
+	NODECPP_NOINLINE void* reallocate(void* ptr, size_t sz)
+	{
+		if ( ptr == nullptr )
+			return allocate( sz );
+		if ( sz > MaxAllocationSize ) // before sz + memStart below
+			throw std::bad_alloc();
+		size_t currentSz = getAllocatedSize( ptr );
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		if ( !isOwnPointer( ptr ) ) // can be neither reused nor resized by this heap
+			return moveToNewAllocation( ptr, currentSz, sz );
+#endif
+		constexpr size_t memStart = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
+		if ( !isLargeChunkPointer( ptr ) )
+		{
+			if ( sz <= currentSz && sz * 2 >= currentSz )
+				return ptr;
+			return moveToNewAllocation( ptr, currentSz, sz );
 		}
 		else
 		{
-			size_t itemCnt = blockSz / bucketSz;
-			if ( itemCnt )
+			if ( sz <= MaxBucketSize ) // would waste at least a page otherwise
+				return moveToNewAllocation( ptr, currentSz, sz );
+			void* pageStart = largeChunkPageStart( ptr );
+			if ( reinterpret_cast<uint8_t*>(pageStart) + memStart != ptr ) // placed by allocateAlignedLarge()
+				return moveToNewAllocation( ptr, currentSz, sz );
+			if ( bulkAllocator.reallocateInPlace( pageStart, sz + memStart ) )
+				return ptr;
+			if ( bulkAllocator.getAllocatedSize( pageStart ) > bulkAllocator.maxAllocatableSize() )
 			{
-				for ( size_t i=0; i<(itemCnt-1)*bucketSz; i+=bucketSz )
-				{
-					if ( ((i + bucketSz) & PAGE_SIZE_MASK) != memForbidden )
-						*reinterpret_cast<void**>(block + i) = block + i + bucketSz;
-					else
-					{ 
-						NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, i != itemCnt - 2 ); // for small buckets such a bucket could not happen at the end anyway
-						*reinterpret_cast<void**>(block + i) = block + i + bucketSz + bucketSz;
-						i += bucketSz;
-					}
-				}
-				*reinterpret_cast<void**>(block + (itemCnt-1)*bucketSz) = nullptr;
-				buckets[bucketidx] = block;
-				return true;
+				void* newPageStart = bulkAllocator.reallocateLarge( pageStart, sz + memStart );
+				if ( newPageStart != nullptr )
+					return reinterpret_cast<uint8_t*>(newPageStart) + memStart;
 			}
-			else
-				return false;
+			return moveToNewAllocation( ptr, currentSz, sz );
 		}
 	}
 
-	NODECPP_NOINLINE void* allocateInCaseNoFreeBucket( size_t sz, uint8_t szidx )
+	void* moveToNewAllocation(void* ptr, size_t currentSz, size_t sz)
 	{
-#ifdef USE_EXP_BUCKET_SIZES
-		size_t bucketSz = indexToBucketSize( szidx );
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-		size_t bucketSz = indexToBucketSizeHalfExp( szidx );
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-		size_t bucketSz = indexToBucketSizeQuarterExp( szidx );
-#else
-#error Undefined bucket size schema
-#endif
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, bucketSz >= sizeof( void* ) );
-		PageAllocatorT::MultipageData mpData;
-//		uint8_t* block = reinterpret_cast<uint8_t*>( pageAllocator.getPage( szidx ) );
-		pageAllocator.getMultipage( szidx, mpData );
-		formatAllocatedPageAlignedBlock( reinterpret_cast<uint8_t*>( mpData.ptr1 ), mpData.sz1, bucketSz, szidx );
-		formatAllocatedPageAlignedBlock( reinterpret_cast<uint8_t*>( mpData.ptr2 ), mpData.sz2, bucketSz, szidx );
-		void* ret = buckets[szidx];
-		buckets[szidx] = *reinterpret_cast<void**>(buckets[szidx]);
+		void* ret = allocate( sz );
+		memcpy( ret, ptr, sz < currentSz ? sz : currentSz );
+		deallocate( ptr );
 		return ret;
 	}
 
-	NODECPP_NOINLINE void* allocateInCaseTooLargeForBucket(size_t sz)
+	NODECPP_FORCEINLINE void deallocateOwned(void* ptr, bool isLarge)
 	{
-		constexpr size_t memStart = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
-		void* block = bulkAllocator.allocate( sz + memStart );
-
-		return reinterpret_cast<uint8_t*>(block) + memStart;
+		if ( !isLarge )
+		{
+			size_t idx = PageAllocatorT::addressToIdx( ptr );
+#ifdef IIBMALLOC_ENABLE_STATS
+			bucketStats[idx].registerDealloc();
+#endif
+			*reinterpret_cast<void**>( ptr ) = buckets[idx];
+			buckets[idx] = ptr;
+		}
+		else
+			deallocateLarge( ptr );
 	}
 
-	NODECPP_FORCEINLINE void* allocate(size_t sz)
+	NODECPP_FORCEINLINE void deallocate(void* ptr)
 	{
-		if ( sz <= MaxBucketSize )
+		if(ptr)
 		{
-#ifdef USE_EXP_BUCKET_SIZES
-			uint8_t szidx = sizeToIndex( sz );
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-			uint8_t szidx = sizeToIndexHalfExp( sz );
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-			uint8_t szidx = sizeToIndexQuarterExp( sz );
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+			HeapProfiler::onDeallocation( ptr );
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+			PageOwnerMap::OwnerIdT pageEntry = PageOwnerMap::getEntry( ptr );
+			PageOwnerMap::OwnerIdT ownerId = PageOwnerMap::entryToOwner( pageEntry );
+			if ( ownerId != heapId )
+			{
+				deallocateForeign( ptr, ownerId );
+				return;
+			}
+			deallocateOwned( ptr, isLargeChunkPointer( ptr, pageEntry ) );
 #else
-#error Undefined bucket size schema
+			deallocateOwned( ptr, isLargeChunkPointer( ptr ) );
+#endif
+		}
+	}
+
+	// Versions for sizes known at compile time (say, sizeof(T)): a bucket index is a constant, and no size-to-index
+	// computation is made at runtime. Memory obtained this way can be freed by any other means, and deallocate<sz>()
+	// accepts memory from allocate(sz) as well (but not from allocateAligned() or reallocate() to a different size).
+	template<size_t sz>
+	NODECPP_FORCEINLINE void* allocate()
+	{
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+		if ( NODECPP_UNLIKELY( ( bytesUntilSample -= (int64_t)sz ) < 0 ) )
+			return allocateSampled( sz );
+#endif
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+		sizeHistogram.record( sz );
+#endif
+		if constexpr ( sz <= MaxBucketSize )
+		{
+			constexpr uint8_t szidx = sizeToIndexAtCompileTime( sz );
+			static_assert( szidx < BucketCount );
+			static_assert( indexToBucketSize( szidx ) >= sz );
+#ifdef IIBMALLOC_ENABLE_STATS
+			bucketStats[szidx].registerAlloc();
 #endif
-			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, szidx < BucketCount );
 			if ( buckets[szidx] )
 			{
 				void* ret = buckets[szidx];
@@ -1058,66 +2584,202 @@ public:
 		}
 		else
 			return allocateInCaseTooLargeForBucket( sz );
-
-		return nullptr;
 	}
 
+	template<size_t sz>
 	NODECPP_FORCEINLINE void deallocate(void* ptr)
 	{
 		if(ptr)
 		{
-			size_t offsetInPage = PageAllocatorT::getOffsetInPage( ptr );
-			constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
-			if ( offsetInPage != memForbidden )
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+			HeapProfiler::onDeallocation( ptr );
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+			PageOwnerMap::OwnerIdT pageEntry = PageOwnerMap::getEntry( ptr );
+			PageOwnerMap::OwnerIdT ownerId = PageOwnerMap::entryToOwner( pageEntry );
+			if ( ownerId != heapId )
 			{
-				size_t idx = PageAllocatorT::addressToIdx( ptr );
-				*reinterpret_cast<void**>( ptr ) = buckets[idx];
-				buckets[idx] = ptr;
+				deallocateForeign( ptr, ownerId );
+				return;
 			}
-			else
+#endif
+			if constexpr ( sz <= MaxBucketSize )
 			{
-				void* pageStart = PageAllocatorT::ptrToPageStart( ptr );
-				bulkAllocator.deallocate( pageStart );
+				constexpr uint8_t szidx = sizeToIndexAtCompileTime( sz );
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, PageAllocatorT::addressToIdx( ptr ) == szidx );
+#ifdef IIBMALLOC_ENABLE_STATS
+				bucketStats[szidx].registerDealloc();
+#endif
+				*reinterpret_cast<void**>( ptr ) = buckets[szidx];
+				buckets[szidx] = ptr;
 			}
+			else
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+				deallocateOwned( ptr, isLargeChunkPointer( ptr, pageEntry ) );
+#else
+				deallocateOwned( ptr, isLargeChunkPointer( ptr ) );
+#endif
+		}
+	}
+
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	NODECPP_FORCEINLINE bool isOwnPointer(const void* ptr) const
+	{
+		return PageOwnerMap::getOwner( ptr ) == heapId;
+	}
+
+	// Takes over all pointers freed by other threads so far; called implicitly at slow paths of allocation,
+	// and can be called explicitly (say, when a thread is idle) to make returned memory available sooner
+	void drainRemoteFrees()
+	{
+		void* item = remoteFreeList.exchange( nullptr, std::memory_order_acquire );
+		while ( item )
+		{
+			void* next = *reinterpret_cast<void**>( item );
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isOwnPointer( item ) );
+			deallocateOwned( item, isLargeChunkPointer( item ) );
+			item = next;
 		}
 	}
+#endif // IIBMALLOC_ENABLE_CROSS_THREAD_FREE
 
 	NODECPP_FORCEINLINE size_t getAllocatedSize(void* ptr)
 	{
 		if(ptr)
 		{
-			size_t offsetInPage = PageAllocatorT::getOffsetInPage( ptr );
-			constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
-			if ( offsetInPage != memForbidden )
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+			PageOwnerMap::OwnerIdT pageEntry = PageOwnerMap::getEntry( ptr );
+			if ( !isLargeChunkPointer( ptr, pageEntry ) )
 			{
 				size_t idx = PageAllocatorT::addressToIdx( ptr );
-#ifdef USE_EXP_BUCKET_SIZES
+				PageOwnerMap::OwnerIdT ownerId = PageOwnerMap::entryToOwner( pageEntry );
+				if ( NODECPP_UNLIKELY( ownerId != heapId ) ) // its heap might be of another bucket size schema
+					return foreignBucketSize( ownerId, (uint8_t)idx );
 				return indexToBucketSize(idx);
-#elif defined USE_HALF_EXP_BUCKET_SIZES
-				return indexToBucketSizeHalfExp(idx);
-#elif defined USE_QUAD_EXP_BUCKET_SIZES
-				return indexToBucketSizeQuarterExp(idx);
+			}
 #else
-#error Undefined bucket size schema
+			if ( !isLargeChunkPointer( ptr ) )
+				return indexToBucketSize( PageAllocatorT::addressToIdx( ptr ) );
 #endif
-			}
 			else
 			{
-				void* pageStart = PageAllocatorT::ptrToPageStart( ptr );
-				return bulkAllocator.getAllocatedSize( pageStart );
+				void* pageStart = largeChunkPageStart( ptr );
+				return bulkAllocator.getAllocatedSize( pageStart ) - ( reinterpret_cast<uint8_t*>(ptr) - reinterpret_cast<uint8_t*>(pageStart) ); // chunk header is not a part of usable size
 			}
 		}
 		else
 			return 0;
 	}
+
+	// A bounded step of releasing pages of bucket szidx that have no item in use (see SoundingAddressPageAllocator::releaseFreeMultipagesStep())
+	size_t releaseEmptyBucketPagesStep( uint8_t szidx )
+	{
+		size_t bucketSz = indexToBucketSize( szidx );
+		size_t released = pageAllocator.releaseFreeMultipagesStep( szidx, &(buckets[szidx]), itemCountInPageAlignedBlock( PageAllocatorT::multipage_size, bucketSz ) );
+#ifdef IIBMALLOC_ENABLE_STATS
+		bucketStats[szidx].registerRelease( released >> PAGE_SIZE_EXP );
+#endif
+		return released;
+	}
+
+	// Returns to OS pages of buckets that have no item in use; the pages are reused first when respective buckets need more memory.
+	// Scans free lists (that is, not intended to be called at a hot path); returns a number of bytes released.
+	NODECPP_NOINLINE size_t releaseEmptyBucketPages()
+	{
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		drainRemoteFrees();
+#endif
+		size_t released = 0;
+		if ( pageAllocator.isScanningFreeMultipages() ) // a scan started by trim()
+		{
+			uint8_t szidx = (uint8_t)( pageAllocator.scannedBucket() );
+			while ( pageAllocator.isScanningFreeMultipages() )
+				released += releaseEmptyBucketPagesStep( szidx );
+		}
+		for ( uint8_t szidx=0; szidx<BucketCount; ++szidx )
+			do
+				released += releaseEmptyBucketPagesStep( szidx );
+			while ( pageAllocator.isScanningFreeMultipages() );
+		pageAllocator.releaseScanBuffer();
+		return released;
+	}
+
+	// Incremental version of releasing free memory to OS, for calling when a thread is idle: returns free space of BulkAllocator
+	// (see BulkAllocator::trim()), then empty bucket pages (a bucket at a time, starting from where a previous call stopped,
+	// by bounded steps, see releaseEmptyBucketPagesStep()). Stops as soon as byteBudget bytes are released, or nsBudget
+	// nanoseconds are spent (checked before each step; a first step is made anyway, so that repeated calls make progress), or
+	// a round over all buckets is completed. Returns a number of bytes released. If isComplete is given, it is set to true when
+	// a round is completed, and there is nothing left to release from BulkAllocator (with nsBudget, a call may release nothing
+	// while there is something left, so that it makes sense to call it until 0 only without nsBudget).
+	NODECPP_NOINLINE size_t trim( size_t byteBudget = SIZE_MAX, uint64_t nsBudget = UINT64_MAX, bool* isComplete = nullptr )
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto deadline = nsBudget < (uint64_t)(std::chrono::nanoseconds::max().count() / 2) ? start + std::chrono::nanoseconds( nsBudget ) : std::chrono::steady_clock::time_point::max();
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		drainRemoteFrees(); // chunks being returned might be merged into entirely free blocks
+#endif
+		size_t released = bulkAllocator.trim( byteBudget, deadline );
+		bool mustStep = released == 0; // that is, BulkAllocator has nothing to trim, and at least one step is made anyway
+		while ( trimScansLeft != 0 && released < byteBudget && ( mustStep || std::chrono::steady_clock::now() < deadline ) )
+		{
+			mustStep = false;
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !pageAllocator.isScanningFreeMultipages() || pageAllocator.scannedBucket() == nextBucketToTrim );
+			released += releaseEmptyBucketPagesStep( nextBucketToTrim );
+			if ( !pageAllocator.isScanningFreeMultipages() )
+			{
+				nextBucketToTrim = ( nextBucketToTrim + 1 ) & ( BucketCount - 1 );
+				--trimScansLeft;
+			}
+		}
+		// not counted in a value returned: a next scan maps it again, and calls until 0 would never end otherwise
+		if ( !pageAllocator.isScanningFreeMultipages() )
+			pageAllocator.releaseScanBuffer();
+		bool roundIsCompleted = trimScansLeft == 0;
+		if ( roundIsCompleted )
+			trimScansLeft = BucketCount; // a next call starts a new one
+		if ( isComplete != nullptr )
+			*isComplete = roundIsCompleted && !bulkAllocator.hasChunksToTrim();
+		return released;
+	}
 	
 	const BlockStats& getStats() const { return pageAllocator.getStats(); }
+	const BlockStats& getBulkStats() const { return bulkAllocator.getStats(); }
+
+	// Applies to reservations of bucket pages made afterwards (see CommitMode); initially, CommitModeDefault::mode
+	void setCommitMode( CommitMode mode ) { pageAllocator.setCommitMode( mode ); }
+
+	// Makes the heap keep blocks it frees in cache (rather than in one of its own) for reuse; heaps of the same thread may share a
+	// cache, which then must outlive them, and takes blocks of a heap being deinitialized. nullptr: back to the own cache.
+	void setPageCache( PageCache* cache )
+	{
+		sharedPageCache = cache;
+		pageAllocator.setPageCache( activePageCache() );
+		bulkAllocator.setPageCache( activePageCache() );
+	}
+	const PageCache& getPageCache() const { return sharedPageCache != nullptr ? *sharedPageCache : ownPageCache; }
+#ifdef IIBMALLOC_ENABLE_STATS
+	const SizeClassStats& getBucketStats( uint8_t szidx ) const { return bucketStats[szidx]; }
+	const SizeClassStats& getBulkSizeClassStats( size_t pageCount ) const { return bulkAllocator.getSizeClassStats( pageCount ); } // 0: chunks allocated directly from OS
+	const SizeClassStats& getBulkBlockStats() const { return bulkAllocator.getBlockStats(); }
+#endif
 	
 	void printStats() const 
 	{
 		pageAllocator.printStats();
+		bulkAllocator.printStats();
+		getPageCache().printStats();
+#ifdef IIBMALLOC_ENABLE_STATS
+		for ( uint8_t szidx=0; szidx<BucketCount; ++szidx )
+			bucketStats[szidx].printStats( "bucket of size", indexToBucketSize( szidx ) );
+		bulkAllocator.printSizeClassStats();
+#endif
 	}
 
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+	// adds sizes allocated by this heap so far to process-wide totals (see SizeHistogram::write()); done on deinitialize() as well
+	void flushSizeHistogram() { sizeHistogram.flush(); }
+#endif
+
 	void initialize(size_t size)
 	{
 		initialize();
@@ -1126,14 +2788,50 @@ public:
 	void initialize()
 	{
 		memset( buckets, 0, sizeof( void* ) * BucketCount );
+		memset( bumpRanges, 0, sizeof( BumpRange ) * BucketCount );
+#ifdef IIBMALLOC_ENABLE_STATS
+		for ( size_t i=0; i<BucketCount; ++i )
+			bucketStats[i] = SizeClassStats();
+#endif
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+		sizeHistogram.clear();
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		bucketSizeOf = &BucketSizes::indexToBucketSize; // before the heap is published
+		if ( heapId == PageOwnerMap::no_owner )
+			heapId = acquireHeapId( this );
+		remoteFreeList.store( nullptr, std::memory_order_relaxed );
+		pageAllocator.setOwnerId( heapId );
+		bulkAllocator.setOwnerId( heapId );
+#endif
+		pageAllocator.setCommitMode( CommitModeDefault::mode.load( std::memory_order_relaxed ) );
 		pageAllocator.initialize( PAGE_SIZE_EXP );
 		bulkAllocator.initialize( PAGE_SIZE_EXP );
+		setPageCache( sharedPageCache );
 	}
 
 	void deinitialize()
 	{
+		// NOTE: with IIBMALLOC_ENABLE_CROSS_THREAD_FREE, other threads must not free pointers from this heap once it is being deinitialized
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+		sizeHistogram.flush();
+#endif
+		if ( sharedPageCache == nullptr ) // blocks would go nowhere but to OS anyway
+		{
+			pageAllocator.setPageCache( nullptr );
+			bulkAllocator.setPageCache( nullptr );
+		}
 		pageAllocator.deinitialize();
 		bulkAllocator.deinitialize();
+		ownPageCache.clear();
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+		if ( heapId != PageOwnerMap::no_owner )
+		{
+			releaseHeapId( heapId );
+			heapId = PageOwnerMap::no_owner;
+		}
+		remoteFreeList.store( nullptr, std::memory_order_relaxed );
+#endif
 	}
 
 	~IibAllocatorBase()
@@ -1148,8 +2846,19 @@ public:
 
 constexpr size_t guaranteed_prefix_size = 8;
 
-class SafeIibAllocator : protected IibAllocatorBase
+template<class BucketSizes = DefaultBucketSizes>
+class SafeIibAllocator : protected IibAllocatorBase<BucketSizes>
 {
+	typedef IibAllocatorBase<BucketSizes> Base;
+	using typename Base::PageAllocatorT;
+	using typename Base::BulkAllocatorT;
+	using Base::BucketCount;
+	using Base::buckets;
+	using Base::bulkAllocator;
+#ifdef IIBMALLOC_ENABLE_STATS
+	using Base::bucketStats;
+#endif
+
 	static_assert( guaranteed_prefix_size >= sizeof(void*) ); // required to keep zombie list item pointer 'next' inside a block
 protected:
 	void** zombieBucketsFirst[BucketCount];
@@ -1166,25 +2875,59 @@ public:
 	void enable() {}
 	void disable() {}
 
+	static constexpr size_t maxBucketSize() { return Base::maxBucketSize(); }
+
 
 	NODECPP_FORCEINLINE void* allocate(size_t sz)
 	{
-		return IibAllocatorBase::allocate( sz );
+		return Base::allocate( sz );
+	}
+
+	NODECPP_FORCEINLINE void deallocate(void* ptr )
+	{
+		Base::deallocate( ptr );
+	}
+
+	template<size_t sz>
+	NODECPP_FORCEINLINE void* allocate()
+	{
+		return Base::template allocate<sz>();
 	}
 
+	template<size_t sz>
 	NODECPP_FORCEINLINE void deallocate(void* ptr )
 	{
-		IibAllocatorBase::deallocate( ptr );
+		Base::template deallocate<sz>( ptr );
+	}
+
+	void* allocateAligned(size_t sz, size_t alignment)
+	{
+		return Base::allocateAligned( sz, alignment );
+	}
+
+	void* reallocate(void* ptr, size_t sz)
+	{
+		return Base::reallocate( ptr, sz );
+	}
+
+	void allocateBatch(size_t sz, size_t n, void** out)
+	{
+		Base::allocateBatch( sz, n, out );
+	}
+
+	void deallocateBatch(void** ptrs, size_t n)
+	{
+		Base::deallocateBatch( ptrs, n );
 	}
 
 	NODECPP_FORCEINLINE size_t isPointerInBlock(void* allocatedPtr, void* ptr )
 	{
-		return ptr >= allocatedPtr && reinterpret_cast<uint8_t*>(ptr) < reinterpret_cast<uint8_t*>(allocatedPtr) + IibAllocatorBase::getAllocatedSize( ptr );
+		return ptr >= allocatedPtr && reinterpret_cast<uint8_t*>(ptr) < reinterpret_cast<uint8_t*>(allocatedPtr) + Base::getAllocatedSize( ptr );
 	}
 
 	NODECPP_FORCEINLINE void* zombieableAllocate(size_t sz)
 	{
-		void* ret = IibAllocatorBase::allocate( sz + guaranteed_prefix_size );
+		void* ret = Base::allocate( sz + guaranteed_prefix_size );
 		return reinterpret_cast<uint8_t*>(ret) + guaranteed_prefix_size;
 	}
 
@@ -1194,11 +2937,22 @@ public:
 		void* ptr = reinterpret_cast<uint8_t*>(userPtr) - guaranteed_prefix_size;
 		if(ptr)
 		{
-			size_t offsetInPage = PageAllocatorT::getOffsetInPage( ptr );
-			constexpr size_t memForbidden = alignUpExp( BulkAllocatorT::reservedSizeAtPageStart(), ALIGNMENT_EXP );
-			if ( offsetInPage != memForbidden ) // small and medium size
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+			if ( !isOwnPointer( ptr ) ) // zombie lists are per-heap; a foreign pointer is returned to its owner right away
+			{
+				Base::deallocate( ptr );
+				return;
+			}
+#endif
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+			HeapProfiler::onDeallocation( ptr );
+#endif
+			if ( !Base::isLargeChunkPointer( ptr ) ) // small and medium size
 			{
 				size_t idx = PageAllocatorT::addressToIdx( ptr );
+#ifdef IIBMALLOC_ENABLE_STATS
+				bucketStats[idx].registerDealloc();
+#endif
 				if ( zombieBucketsFirst[idx] ) // LIKELY
 				{
 					if ( zombieBucketsLast[idx] )
@@ -1224,7 +2978,7 @@ public:
 	NODECPP_FORCEINLINE size_t isZombieablePointerInBlock(void* allocatedPtr, void* ptr )
 	{
 		void* trueAllocatedPtr = reinterpret_cast<void**>(allocatedPtr) - 1;
-		return ptr >= allocatedPtr && reinterpret_cast<uint8_t*>(ptr) < reinterpret_cast<uint8_t*>(allocatedPtr) + IibAllocatorBase::getAllocatedSize( trueAllocatedPtr );
+		return ptr >= allocatedPtr && reinterpret_cast<uint8_t*>(ptr) < reinterpret_cast<uint8_t*>(allocatedPtr) + Base::getAllocatedSize( trueAllocatedPtr );
 	}
 
 	NODECPP_FORCEINLINE void killAllZombies()
@@ -1248,9 +3002,34 @@ public:
 		}
 	}
 	
-	const BlockStats& getStats() const { return IibAllocatorBase::getStats(); }
+	NODECPP_FORCEINLINE size_t getAllocatedSize(void* ptr)
+	{
+		return Base::getAllocatedSize( ptr );
+	}
+
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	NODECPP_FORCEINLINE bool isOwnPointer(const void* ptr) const { return Base::isOwnPointer( ptr ); }
+	void drainRemoteFrees() { Base::drainRemoteFrees(); }
+#endif
+
+	size_t releaseEmptyBucketPages() { return Base::releaseEmptyBucketPages(); }
+	size_t trim( size_t byteBudget = SIZE_MAX, uint64_t nsBudget = UINT64_MAX, bool* isComplete = nullptr ) { return Base::trim( byteBudget, nsBudget, isComplete ); }
+
+	const BlockStats& getStats() const { return Base::getStats(); }
+	const BlockStats& getBulkStats() const { return Base::getBulkStats(); }
+	void setCommitMode( CommitMode mode ) { Base::setCommitMode( mode ); }
+	void setPageCache( PageCache* cache ) { Base::setPageCache( cache ); }
+	const PageCache& getPageCache() const { return Base::getPageCache(); }
+#ifdef IIBMALLOC_ENABLE_STATS
+	const SizeClassStats& getBucketStats( uint8_t szidx ) const { return Base::getBucketStats( szidx ); }
+	const SizeClassStats& getBulkSizeClassStats( size_t pageCount ) const { return Base::getBulkSizeClassStats( pageCount ); }
+	const SizeClassStats& getBulkBlockStats() const { return Base::getBulkBlockStats(); }
+#endif
 	
-	void printStats() const { IibAllocatorBase::printStats(); }
+	void printStats() const { Base::printStats(); }
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+	void flushSizeHistogram() { Base::flushSizeHistogram(); }
+#endif
 
 	void initialize(size_t size)
 	{
@@ -1259,7 +3038,7 @@ public:
 
 	void initialize()
 	{
-		IibAllocatorBase::initialize();
+		Base::initialize();
 		for ( size_t i=0; i<BucketCount; ++i)
 		{
 			zombieBucketsFirst[i] = nullptr;
@@ -1270,7 +3049,7 @@ public:
 
 	void deinitialize()
 	{
-		IibAllocatorBase::deinitialize();
+		Base::deinitialize();
 	}
 
 	~SafeIibAllocator()
@@ -1282,13 +3061,37 @@ public:
 
 
 #ifndef ENABLE_SAFE_ALLOCATION_MEANS
-typedef IibAllocatorBase ThreadLocalAllocatorT;
+typedef IibAllocatorBase<> ThreadLocalAllocatorT;
 #else
-typedef SafeIibAllocator ThreadLocalAllocatorT;
+typedef SafeIibAllocator<> ThreadLocalAllocatorT;
 #endif // ENABLE_SAFE_ALLOCATION_MEANS
 
 extern thread_local ThreadLocalAllocatorT g_AllocManager;
 
+// Mixin for classes which objects are to be allocated from a bucket chosen at compile time:
+//   class Node : public IibAllocated<Node> { ... };
+// Classes derived from T (which sizes differ from sizeof(T)) fall back to allocations with a size known at runtime
+template<class T>
+class IibAllocated
+{
+public:
+	static void* operator new(size_t sz)
+	{
+		static_assert( alignof(T) <= ALIGNMENT, "over-aligned types are not supported" );
+		if ( sz == sizeof(T) )
+			return g_AllocManager.allocate<sizeof(T)>();
+		else
+			return g_AllocManager.allocate( sz );
+	}
+	static void operator delete(void* ptr, size_t sz)
+	{
+		if ( sz == sizeof(T) )
+			g_AllocManager.deallocate<sizeof(T)>( ptr );
+		else
+			g_AllocManager.deallocate( ptr );
+	}
+};
+
 } // namespace nodecpp::iibmalloc
 
 
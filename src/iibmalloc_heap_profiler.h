@@ -0,0 +1,348 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * Per-thread bucket allocator
+ * Sampling heap profiler:
+ *     - each heap counts down allocated bytes to a next sampling point
+ *       (distances are exponentially distributed, so that sampling is a Poisson
+ *       process over allocated bytes, like in tcmalloc)
+ *     - for a sampled allocation, a call stack is captured and the object is
+ *       registered in a process-wide table of live samples (keyed by pointer),
+ *       which is checked on deallocation
+ *     - a profile of live samples, aggregated by call stack, is written on
+ *       demand in a text format of gperftools (readable by pprof)
+ * 
+ * -------------------------------------------------------------------------------*/
+
+ 
+#ifndef IIBMALLOC_HEAP_PROFILER_H
+#define IIBMALLOC_HEAP_PROFILER_H
+
+#include "iibmalloc_page_allocator.h"
+
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+
+#include <cmath>
+#include <cstring>
+
+namespace nodecpp::iibmalloc
+{
+
+class HeapProfiler
+{
+public:
+	static constexpr size_t max_frames = 32;
+	static constexpr size_t disabled_sampling_distance = ((size_t)1) << 20; // with sampling off, heaps recheck whether it is on after this many bytes
+	static constexpr size_t max_sampling_interval = ((size_t)1) << 40;
+
+private:
+	struct StackEntry
+	{
+		uint64_t hash;
+		uint64_t depth;
+		uint64_t allocCount;
+		uint64_t allocBytes;
+		uint64_t liveCount;
+		uint64_t liveBytes;
+		void* frames[max_frames];
+	};
+	struct LiveEntry
+	{
+		void* ptr;
+		size_t size;
+		size_t stackIdx;
+	};
+
+	static constexpr size_t stack_table_size_exp = 14;
+	static constexpr size_t stack_table_size = ((size_t)1) << stack_table_size_exp;
+	static constexpr size_t live_table_size_exp = 18; // kept at most half full
+	static constexpr size_t live_table_size = ((size_t)1) << live_table_size_exp;
+	static constexpr size_t filter_size_exp = 16;
+
+	static inline std::atomic<size_t> samplingInterval = 0;
+	static inline std::atomic<size_t> liveSampleCount = 0;
+	// number of live samples per pointer hash; lets deallocations of non-sampled objects skip locking
+	static inline std::atomic<uint16_t> filter[ ((size_t)1) << filter_size_exp ];
+	static inline std::atomic_flag lock = ATOMIC_FLAG_INIT;
+	static inline StackEntry* stacks = nullptr; // allocated on first enabling; never released
+	static inline size_t stackCount = 0;
+	static inline LiveEntry* live = nullptr;
+	static inline uint64_t droppedCount = 0; // samples not registered as tables are full
+
+	static void acquireLock() { while ( lock.test_and_set( std::memory_order_acquire ) ) {} }
+	static void releaseLock() { lock.clear( std::memory_order_release ); }
+
+	static NODECPP_FORCEINLINE size_t hashPtr( const void* ptr, size_t exp ) { return (size_t)( ( ((uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ull ) >> ( 64 - exp ) ); }
+
+	static size_t findOrAddStack( void* const* frames, size_t depth )
+	{
+		uint64_t hash = depth;
+		for ( size_t i=0; i<depth; ++i )
+			hash = ( hash ^ (uintptr_t)(frames[i]) ) * 0x100000001B3ull;
+		size_t mask = stack_table_size - 1;
+		for ( size_t i=hash & mask; ; i=(i+1) & mask )
+		{
+			StackEntry& e = stacks[i];
+			if ( e.depth == 0 )
+			{
+				if ( stackCount >= stack_table_size / 2 )
+					return SIZE_MAX;
+				++stackCount;
+				e.hash = hash;
+				e.depth = depth;
+				memcpy( e.frames, frames, depth * sizeof(void*) );
+				return i;
+			}
+			if ( e.hash == hash && e.depth == depth && memcmp( e.frames, frames, depth * sizeof(void*) ) == 0 )
+				return i;
+		}
+	}
+
+	static size_t findLive( const void* ptr )
+	{
+		size_t mask = live_table_size - 1;
+		for ( size_t i=hashPtr( ptr, live_table_size_exp ); ; i=(i+1) & mask )
+		{
+			if ( live[i].ptr == ptr )
+				return i;
+			if ( live[i].ptr == nullptr )
+				return SIZE_MAX;
+		}
+	}
+
+	static void removeLive( size_t idx ) // backward shift deletion (linear probing)
+	{
+		size_t mask = live_table_size - 1;
+		size_t hole = idx;
+		for ( size_t i=(idx+1) & mask; live[i].ptr != nullptr; i=(i+1) & mask )
+		{
+			size_t home = hashPtr( live[i].ptr, live_table_size_exp );
+			if ( ( ( i - home ) & mask ) >= ( ( i - hole ) & mask ) )
+			{
+				live[hole] = live[i];
+				hole = i;
+			}
+		}
+		live[hole].ptr = nullptr;
+	}
+
+	NODECPP_NOINLINE static void checkDeallocation( void* ptr )
+	{
+		size_t fidx = hashPtr( ptr, filter_size_exp );
+		if ( filter[fidx].load( std::memory_order_relaxed ) == 0 )
+			return;
+		acquireLock();
+		size_t idx = findLive( ptr );
+		if ( idx != SIZE_MAX )
+		{
+			StackEntry& stack = stacks[live[idx].stackIdx];
+			--(stack.liveCount);
+			stack.liveBytes -= live[idx].size;
+			removeLive( idx );
+			filter[fidx].store( filter[fidx].load( std::memory_order_relaxed ) - 1, std::memory_order_relaxed );
+			liveSampleCount.fetch_sub( 1, std::memory_order_relaxed );
+		}
+		releaseLock();
+	}
+
+	static char* formatDec( char* out, uint64_t val )
+	{
+		char buff[24];
+		size_t len = 0;
+		do { buff[len++] = '0' + val % 10; val /= 10; } while ( val );
+		while ( len )
+			*out++ = buff[--len];
+		return out;
+	}
+
+	static char* formatHex( char* out, uint64_t val )
+	{
+		*out++ = '0';
+		*out++ = 'x';
+		char buff[16];
+		size_t len = 0;
+		do { buff[len++] = "0123456789abcdef"[val & 0xf]; val >>= 4; } while ( val );
+		while ( len )
+			*out++ = buff[--len];
+		return out;
+	}
+
+	static char* formatCounts( char* out, uint64_t liveCnt, uint64_t liveBytes, uint64_t allocCnt, uint64_t allocBytes )
+	{
+		out = formatDec( out, liveCnt );
+		*out++ = ':'; *out++ = ' ';
+		out = formatDec( out, liveBytes );
+		*out++ = ' '; *out++ = '[';
+		out = formatDec( out, allocCnt );
+		*out++ = ':'; *out++ = ' ';
+		out = formatDec( out, allocBytes );
+		*out++ = ']'; *out++ = ' '; *out++ = '@';
+		return out;
+	}
+
+	// OS specific implementations (see page_allocator_*.cpp); none of them allocates, except, possibly, the first call to captureStackTrace()
+	static size_t captureStackTrace( void** frames, size_t maxFrames );
+	static bool writeMemoryMap( intptr_t file ); // a list of mapped binaries (to be used by pprof for symbolization), if available
+
+public:
+	// Sets a mean distance (in bytes) between sampled allocations; 0 disables sampling (objects that are sampled by then are still tracked until freed).
+	// Heaps pick a new value at their next sampling point, that is, with sampling being off, after at most disabled_sampling_distance bytes.
+	static void setSamplingInterval( size_t bytes )
+	{
+		if ( bytes > max_sampling_interval )
+			bytes = max_sampling_interval;
+		if ( bytes != 0 )
+		{
+			void* frames[max_frames];
+			captureStackTrace( frames, max_frames ); // the first call may load unwinding libraries (and allocate); better not to do it from inside allocate()
+			acquireLock();
+			if ( stacks == nullptr )
+			{
+				stacks = reinterpret_cast<StackEntry*>( VirtualMemory::allocate( sizeof( StackEntry ) * stack_table_size ) ); // zero-filled
+				live = reinterpret_cast<LiveEntry*>( VirtualMemory::allocate( sizeof( LiveEntry ) * live_table_size ) );
+			}
+			releaseLock();
+		}
+		samplingInterval.store( bytes, std::memory_order_relaxed );
+	}
+
+	static size_t getSamplingInterval() { return samplingInterval.load( std::memory_order_relaxed ); }
+
+	// Returns a number of bytes to be allocated by a heap before its next sample is taken
+	static size_t nextSamplingDistance( uint64_t& rngState )
+	{
+		size_t interval = samplingInterval.load( std::memory_order_relaxed );
+		if ( interval == 0 )
+			return disabled_sampling_distance;
+		rngState ^= rngState >> 12; // xorshift64*
+		rngState ^= rngState << 25;
+		rngState ^= rngState >> 27;
+		double u = (double)( ( ( rngState * 0x2545F4914F6CDD1Dull ) >> 11 ) + 1 ) / (double)( ((uint64_t)1) << 53 ); // (0, 1]
+		return (size_t)( -std::log( u ) * interval ) + 1;
+	}
+
+	// Called by a heap when its sampling point is reached
+	NODECPP_NOINLINE static void recordAllocation( void* ptr, size_t size )
+	{
+		if ( ptr == nullptr || samplingInterval.load( std::memory_order_relaxed ) == 0 )
+			return;
+		constexpr size_t skipped_frames = 2; // captureStackTrace() and this function
+		void* frames[max_frames + skipped_frames];
+		size_t depth = captureStackTrace( frames, max_frames + skipped_frames ); // may allocate (see setSamplingInterval()), thus is done without the lock
+		if ( depth <= skipped_frames )
+			return;
+		acquireLock();
+		size_t stackIdx = findOrAddStack( frames + skipped_frames, depth - skipped_frames );
+		if ( stackIdx == SIZE_MAX || liveSampleCount.load( std::memory_order_relaxed ) >= live_table_size / 2 )
+		{
+			++droppedCount;
+			releaseLock();
+			return;
+		}
+		StackEntry& stack = stacks[stackIdx];
+		++(stack.allocCount);
+		stack.allocBytes += size;
+		++(stack.liveCount);
+		stack.liveBytes += size;
+		size_t mask = live_table_size - 1;
+		size_t idx = hashPtr( ptr, live_table_size_exp );
+		while ( live[idx].ptr != nullptr )
+		{
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, live[idx].ptr != ptr );
+			idx = ( idx + 1 ) & mask;
+		}
+		live[idx].ptr = ptr;
+		live[idx].size = size;
+		live[idx].stackIdx = stackIdx;
+		size_t fidx = hashPtr( ptr, filter_size_exp );
+		filter[fidx].store( filter[fidx].load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+		liveSampleCount.fetch_add( 1, std::memory_order_relaxed );
+		releaseLock();
+	}
+
+	// To be called for each pointer being deallocated; as long as there are no sampled objects, it is a single well-predicted branch
+	static NODECPP_FORCEINLINE void onDeallocation( void* ptr )
+	{
+		if ( NODECPP_UNLIKELY( liveSampleCount.load( std::memory_order_relaxed ) != 0 ) )
+			checkDeallocation( ptr );
+	}
+
+	// Writes a heap profile (live sampled objects aggregated by allocation stack) in the text format of gperftools' heap profiler,
+	// which can be read by pprof ("pprof --text <binary> <file>"). Counts are of samples; pprof scales them by the sampling interval.
+	// Does not allocate. Returns false if the file could not be written.
+	static bool dumpHeapProfile( const char* path )
+	{
+		intptr_t file = RawFile::open( path );
+		if ( file == -1 )
+			return false;
+		char line[ 128 + max_frames * 20 ];
+		acquireLock();
+		uint64_t liveCnt = 0, liveBytes = 0, allocCnt = 0, allocBytes = 0;
+		for ( size_t i=0; stacks != nullptr && i<stack_table_size; ++i )
+		{
+			liveCnt += stacks[i].liveCount;
+			liveBytes += stacks[i].liveBytes;
+			allocCnt += stacks[i].allocCount;
+			allocBytes += stacks[i].allocBytes;
+		}
+		size_t interval = samplingInterval.load( std::memory_order_relaxed );
+		char* out = line;
+		memcpy( out, "heap profile: ", 14 );
+		out = formatCounts( out + 14, liveCnt, liveBytes, allocCnt, allocBytes );
+		memcpy( out, " heap_v2/", 9 );
+		out = formatDec( out + 9, interval != 0 ? interval : 1 );
+		*out++ = '\n';
+		bool ok = RawFile::write( file, line, out - line );
+		for ( size_t i=0; ok && stacks != nullptr && i<stack_table_size; ++i )
+		{
+			const StackEntry& e = stacks[i];
+			if ( e.depth == 0 || e.allocCount == 0 )
+				continue;
+			out = formatCounts( line, e.liveCount, e.liveBytes, e.allocCount, e.allocBytes );
+			for ( size_t j=0; j<e.depth; ++j )
+			{
+				*out++ = ' ';
+				out = formatHex( out, (uintptr_t)(e.frames[j]) );
+			}
+			*out++ = '\n';
+			ok = RawFile::write( file, line, out - line );
+		}
+		releaseLock();
+		if ( ok )
+			ok = writeMemoryMap( file );
+		RawFile::close( file );
+		if ( droppedCount )
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::warning>( "heap profiler: {} samples were dropped (tables are full)", droppedCount );
+		return ok;
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_ENABLE_HEAP_PROFILER
+
+#endif // IIBMALLOC_HEAP_PROFILER_H
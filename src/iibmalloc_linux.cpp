@@ -74,14 +74,34 @@ void operator delete[](void* ptr) noexcept
 	g_AllocManager.deallocate(ptr);
 }
 #endif // 0
+#if 0
 #if __cplusplus >= 201703L
+void* operator new(std::size_t count, std::align_val_t alignment)
+{
+	void* ret = g_AllocManager.allocateAligned(count, static_cast<size_t>(alignment));
+	if ( ret == nullptr ) // too large to be aligned (see IibAllocatorBase::allocateAligned())
+		throw std::bad_alloc();
+	return ret;
+}
 
-//We don't support alignment new/delete yet
+void* operator new[](std::size_t count, std::align_val_t alignment)
+{
+	void* ret = g_AllocManager.allocateAligned(count, static_cast<size_t>(alignment));
+	if ( ret == nullptr ) // too large to be aligned (see IibAllocatorBase::allocateAligned())
+		throw std::bad_alloc();
+	return ret;
+}
 
-//void* operator new(std::size_t count, std::align_val_t alignment);
-//void* operator new[](std::size_t count, std::align_val_t alignment);
-//void operator delete(void* ptr, std::align_val_t al) noexcept;
-//void operator delete[](void* ptr, std::align_val_t al) noexcept;
+void operator delete(void* ptr, std::align_val_t al) noexcept
+{
+	g_AllocManager.deallocate(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t al) noexcept
+{
+	g_AllocManager.deallocate(ptr);
+}
 #endif
+#endif // 0
 
 
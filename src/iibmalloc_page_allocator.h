@@ -42,6 +42,9 @@
 
 #include "iibmalloc_common.h"
 
+#include <atomic>
+#include <cstring>
+
 namespace nodecpp::iibmalloc
 {
 
@@ -68,14 +71,113 @@ public:
 	static void decommit(uintptr_t addr, size_t size); // TODO: revise necessity (duplicates might be available)
 
 	static void* allocate(size_t size);
+	static void* allocateAligned(size_t size, size_t alignment); // alignment is a power of 2 and a multiple of the allocation granularity; freed by deallocate()
 	static void deallocate(void* ptr, size_t size);
+	static void* reallocate(void* ptr, size_t oldSize, size_t newSize, bool mayMove = true); // returns nullptr if not supported by OS, or if mayMove is false and the block cannot grow in place (the block remains intact then)
 
-	static void* AllocateAddressSpace(size_t size);
+	static void* AllocateAddressSpace(size_t size, size_t alignment = 0); // alignment (if any) is a power of 2
+	static void* AllocateAccessibleAddressSpace(size_t size, size_t alignment = 0); // readable and writable at once (no CommitMemory() is needed), physical pages are taken on first access; freed by FreeAddressSpace()
 	static void* CommitMemory(void* addr, size_t size);
 	static void DecommitMemory(void* addr, size_t size);
+	static void DiscardMemory(void* addr, size_t size); // physical pages are returned to OS; range remains accessible (and reads as zeros on Linux)
+	static void DiscardMemoryLazily(void* addr, size_t size); // same, but pages are taken by OS only when it needs memory (until then, writes cancel discarding); contents are undefined
 	static void FreeAddressSpace(void* addr, size_t size);
+	static void AdviseHugePages(void* addr, size_t size); // range is preferably backed by transparent huge pages; no-op where not supported
+};
+
+// Output files that are written without allocating (thus, usable from within malloc(), say, at exit of a preload library)
+class RawFile
+{
+public:
+	static intptr_t open( const char* path ); // creates or truncates a file for writing; returns -1 on failure
+	static bool write( intptr_t file, const char* data, size_t size );
+	static void close( intptr_t file );
+};
+
+//#define IIBMALLOC_ENABLE_CROSS_THREAD_FREE // a pointer may be freed by any thread, and is returned to its owning heap (see PageOwnerMap); required by the preload library
+//#define IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS // headers of large chunks are kept out of band, and large chunks are page-aligned (see BulkAllocator)
+//#define IIBMALLOC_ENABLE_HUGE_PAGES // reservations of bucket pages and BulkAllocator blocks are aligned to huge pages and advised to be backed by transparent huge pages (see SoundingAddressPageAllocator)
+
+#if defined IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS && !defined IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+#error IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS requires IIBMALLOC_ENABLE_CROSS_THREAD_FREE (large chunks are recognized by PageOwnerMap)
+#endif
+
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+
+// Process-wide map from a 4K page to the id of the heap that owns it (or no_owner if the page was not obtained by any heap).
+// Two-level radix tree over 47-bit user address space; leaves are created on demand and are never released.
+// Writes are done only by the owning heap (when ranges are obtained or returned); any thread may read.
+// The highest bit of an entry marks pages where page-aligned large chunks start (and is not a part of an id): with
+// IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS, all pages of large chunks; otherwise, those of allocateAligned() only.
+class PageOwnerMap
+{
+public:
+	typedef uint16_t OwnerIdT;
+	static constexpr OwnerIdT no_owner = 0;
+	static constexpr OwnerIdT large_object_flag = ((OwnerIdT)1) << ( sizeof(OwnerIdT) * 8 - 1 );
+	static constexpr OwnerIdT inner_page_flag = large_object_flag >> 1; // user data placed inside a large chunk rather than at its start
+	static constexpr size_t max_owner_cnt = inner_page_flag;
+
+private:
+	static constexpr size_t page_size_exp = 12;
+	static constexpr size_t address_bits = 47;
+	static constexpr size_t leaf_bits = 18;
+	static constexpr size_t root_bits = address_bits - page_size_exp - leaf_bits;
+	static constexpr uintptr_t leaf_mask = (((uintptr_t)1) << leaf_bits) - 1;
+	static constexpr size_t leaf_size = sizeof( std::atomic<OwnerIdT> ) << leaf_bits;
+
+	static inline std::atomic<std::atomic<OwnerIdT>*> root[ ((size_t)1) << root_bits ];
+
+	static std::atomic<OwnerIdT>* getOrCreateLeaf( uintptr_t rootIdx )
+	{
+		std::atomic<OwnerIdT>* leaf = root[rootIdx].load( std::memory_order_acquire );
+		if ( leaf != nullptr )
+			return leaf;
+		std::atomic<OwnerIdT>* newLeaf = reinterpret_cast<std::atomic<OwnerIdT>*>( VirtualMemory::allocate( leaf_size ) ); // zero-filled, that is, no_owner
+		if ( root[rootIdx].compare_exchange_strong( leaf, newLeaf, std::memory_order_acq_rel, std::memory_order_acquire ) )
+			return newLeaf;
+		VirtualMemory::deallocate( newLeaf, leaf_size ); // some other thread has been faster
+		return leaf;
+	}
+
+public:
+	static NODECPP_FORCEINLINE OwnerIdT getEntry( const void* ptr )
+	{
+		uintptr_t page = (uintptr_t)(ptr) >> page_size_exp;
+		if ( page >> ( root_bits + leaf_bits ) )
+			return no_owner;
+		std::atomic<OwnerIdT>* leaf = root[ page >> leaf_bits ].load( std::memory_order_acquire );
+		if ( leaf == nullptr )
+			return no_owner;
+		return leaf[ page & leaf_mask ].load( std::memory_order_relaxed );
+	}
+
+	static NODECPP_FORCEINLINE OwnerIdT entryToOwner( OwnerIdT entry ) { return entry & ~( large_object_flag | inner_page_flag ); }
+	static NODECPP_FORCEINLINE OwnerIdT getOwner( const void* ptr ) { return entryToOwner( getEntry( ptr ) ); }
+	static NODECPP_FORCEINLINE bool isLargeObjectPage( const void* ptr ) { return ( getEntry( ptr ) & large_object_flag ) != 0; }
+
+	static void setOwner( const void* start, size_t size, OwnerIdT owner )
+	{
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( (uintptr_t)(start) & ( ( ((uintptr_t)1) << page_size_exp ) - 1 ) ) == 0 );
+		uintptr_t page = (uintptr_t)(start) >> page_size_exp;
+		uintptr_t pageEnd = page + ( ( size + ( ((size_t)1) << page_size_exp ) - 1 ) >> page_size_exp );
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, ( ( pageEnd - 1 ) >> ( root_bits + leaf_bits ) ) == 0 );
+		while ( page < pageEnd )
+		{
+			std::atomic<OwnerIdT>* leaf = getOrCreateLeaf( page >> leaf_bits );
+			uintptr_t leafEnd = ( ( page >> leaf_bits ) + 1 ) << leaf_bits;
+			if ( leafEnd > pageEnd )
+				leafEnd = pageEnd;
+			for ( ; page < leafEnd; ++page )
+				leaf[ page & leaf_mask ].store( owner, std::memory_order_relaxed );
+		}
+	}
+
+	static void clearOwner( const void* start, size_t size ) { setOwner( start, size, no_owner ); }
 };
 
+#endif // IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+
 struct MemoryBlockListItem
 {
 	MemoryBlockListItem* next;
@@ -228,6 +330,9 @@ struct BlockStats
 	uint64_t sysAllocSize = 0;
 	uint64_t rdtscSysAllocSpent = 0;
 
+	uint64_t sysCommitCount = 0;
+	uint64_t sysCommitSize = 0;
+
 	uint64_t sysDeallocCount = 0;
 	uint64_t sysDeallocSize = 0;
 	uint64_t rdtscSysDeallocSpent = 0;
@@ -242,6 +347,7 @@ struct BlockStats
 	{
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Allocs {} ({}), ", sysAllocCount, sysAllocSize);
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Deallocs {} ({}), ", sysDeallocCount, sysDeallocSize);
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Commits {} ({}), ", sysCommitCount, sysCommitSize);
 
 		uint64_t ct = sysAllocCount - sysDeallocCount;
 		uint64_t sz = sysAllocSize - sysDeallocSize;
@@ -272,6 +378,71 @@ struct BlockStats
 		rdtscSysDeallocSpent += rdtscSpent;
 		++sysDeallocCount;
 	}
+	void registerSysCommit( size_t sz )
+	{
+		sysCommitSize += sz;
+		++sysCommitCount;
+	}
+};
+
+//#define IIBMALLOC_ENABLE_STATS // per-size-class counters; when not defined, no counting code is compiled in at all
+//#define IIBMALLOC_ENABLE_HEAP_PROFILER // sampling heap profiler (see iibmalloc_heap_profiler.h); sampling is off until HeapProfiler::setSamplingInterval() is called
+//#define IIBMALLOC_ENABLE_SIZE_HISTOGRAM // per-heap counts of allocation sizes (see iibmalloc_size_histogram.h), input for test/size_class_gen.cpp
+//#define IIBMALLOC_ENABLE_TRACE_RECORDER // preload library only: with IIBMALLOC_TRACE=<path> in the environment, records all allocations and deallocations (see iibmalloc_trace.h)
+
+#ifdef IIBMALLOC_ENABLE_STATS
+// Counters of a single size class: a bucket of IibAllocatorBase, or a page count of BulkAllocator
+struct SizeClassStats
+{
+	uint64_t allocCount = 0;
+	uint64_t deallocCount = 0;
+	uint64_t maxLiveCount = 0; // high-water mark of allocCount - deallocCount
+	uint64_t refillCount = 0; // number of times memory was obtained for the class (multipages for buckets, blocks or direct allocations for BulkAllocator)
+	uint64_t pagesObtained = 0;
+	uint64_t pagesReleased = 0; // returned to OS (either unmapped or discarded)
+
+	uint64_t liveCount() const { return allocCount - deallocCount; }
+
+	void registerAlloc( uint64_t cnt = 1 )
+	{
+		allocCount += cnt;
+		if ( allocCount - deallocCount > maxLiveCount )
+			maxLiveCount = allocCount - deallocCount;
+	}
+	void registerDealloc( uint64_t cnt = 1 )
+	{
+		deallocCount += cnt;
+	}
+	void registerRefill( uint64_t pageCnt )
+	{
+		++refillCount;
+		pagesObtained += pageCnt;
+	}
+	void registerRelease( uint64_t pageCnt )
+	{
+		pagesReleased += pageCnt;
+	}
+
+	void printStats( const char* className, size_t classSize ) const
+	{
+		if ( allocCount == 0 && refillCount == 0 )
+			return;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} {}: allocs {}, deallocs {}, live {} (max {}), refills {}, pages obtained {}, released {}", className, classSize, allocCount, deallocCount, liveCount(), maxLiveCount, refillCount, pagesObtained, pagesReleased );
+	}
+};
+#endif // IIBMALLOC_ENABLE_STATS
+
+// How pages of reservations of SoundingAddressPageAllocator become accessible
+enum class CommitMode : uint8_t
+{
+	remap, // a reservation is inaccessible, and runs of pages are committed as needed (on Linux, by mmap(MAP_FIXED), that is, a syscall per run that takes mmap_sem and splits a mapping)
+	demandPaging, // a reservation is readable and writable from the start, and remains a single mapping; physical pages are taken on first access
+};
+
+// Commit mode of heaps, unless set per heap (see IibAllocatorBase::setCommitMode()); process-wide, takes effect at next initialize() of heaps
+struct CommitModeDefault
+{
+	static inline std::atomic<CommitMode> mode = CommitMode::remap;
 };
 
 struct PageAllocator // rather a proof of concept
@@ -332,7 +503,11 @@ public:
 
 	void* AllocateAddressSpace(size_t size)
 	{
-		return VirtualMemory::AllocateAddressSpace( size );
+		uint64_t start = __rdtsc();
+		void* ret = VirtualMemory::AllocateAddressSpace( size );
+		uint64_t end = __rdtsc();
+		stats.registerSysAlloc( size, end - start );
+		return ret;
 	}
 	void* CommitMemory(void* addr, size_t size)
 	{
@@ -342,22 +517,202 @@ public:
 	{
 		VirtualMemory::DecommitMemory( addr, size );
 	}
+	void DiscardMemory(void* addr, size_t size)
+	{
+		VirtualMemory::DiscardMemory( addr, size );
+	}
+	void DiscardMemoryLazily(void* addr, size_t size)
+	{
+		VirtualMemory::DiscardMemoryLazily( addr, size );
+	}
 	void FreeAddressSpace(void* addr, size_t size)
 	{
+		uint64_t start = __rdtsc();
 		VirtualMemory::FreeAddressSpace( addr, size );
+		uint64_t end = __rdtsc();
+		stats.registerSysDealloc( size, end - start );
 	}
 };
 
 
-constexpr size_t max_cached_size = 20; // # of pages
-constexpr size_t single_page_cache_size = 32;
-constexpr size_t multi_page_cache_size = 4;
+constexpr size_t page_cache_class_cnt = 8; // # of classes (kinds and sizes of blocks) a PageCache keeps at a time
+constexpr size_t single_page_cache_size = 32; // max capacity of a PageCache class of PageCache::Kind::pages
+constexpr size_t multi_page_cache_size = 8; // max capacity of other PageCache classes
+constexpr size_t page_cache_adaptation_period = 16; // # of requests to a PageCache class between adjustments of its capacity
+
+// Limit of PageCache; process-wide, can be changed at any time (and takes effect at next operations of heaps)
+struct PageCacheLimits
+{
+	static inline std::atomic<size_t> maxBytes = ((size_t)256) << 20; // of address space kept by a cache; 0 disables caching
+};
 
-struct PageAllocatorWithCaching // to be further developed for practical purposes
+// Blocks freed by page allocators of a heap, kept mapped for reuse rather than returned to OS. A heap has a cache of its own,
+// used by all its page allocators (for blocks of BulkAllocator, reservations of SoundingAddressPageAllocator and pages of their
+// CollectionInPages), or shares one with other heaps of the same thread (see IibAllocatorBase::setPageCache()); then blocks of a
+// heap being deinitialized are reused by others. Not thread-safe.
+// Blocks are kept by class (a kind and a size). Capacity of each class adapts to how it is used: over each adaptation period, it
+// is doubled if there were both misses and overflows (that is, blocks were returned to OS just to be requested from it again),
+// and is reduced by a number of blocks that stayed in the class for the whole period otherwise; blocks over a reduced capacity
+// are returned to OS. A cache never touches blocks: their physical pages are released, if needed, by callers.
+class PageCache
 {
-//	Chunk* topChunk = nullptr;
-	std::array<MemoryBlockList, max_cached_size+1> freeBlocks;
+public:
+	enum class Kind : uint8_t
+	{
+		pages, // readable and writable, page-aligned
+		bulkBlock, // readable and writable, aligned as blocks of BulkAllocator are
+		reservation, // inaccessible (see CommitMode::remap)
+		accessibleReservation, // readable and writable, with no swap space reserved (see CommitMode::demandPaging)
+	};
+
+private:
+	struct SizeClass
+	{
+		size_t size = 0; // of each block; 0 if the class is not in use
+		Kind kind = Kind::pages;
+		uint32_t blockCnt = 0;
+		uint32_t capacity = 0;
+		uint32_t lowWater = 0; // min number of blocks in the class over the current period
+		uint32_t requestCnt = 0; // in the current period
+		uint32_t missCnt = 0; // in the current period
+		uint32_t overflowCnt = 0; // in the current period
+		void* blocks[ single_page_cache_size ]; // the most recently cached ones last
+	};
+	SizeClass classes[ page_cache_class_cnt ];
+	size_t cachedSize = 0;
+	uint64_t hitCount = 0;
+	uint64_t missCount = 0;
+	uint64_t storeCount = 0; // of blocks taken by put()
+	uint64_t releaseCount = 0; // of blocks returned to OS by the cache itself
+
+	static constexpr uint32_t maxCapacity( Kind kind ) { return kind == Kind::pages ? single_page_cache_size : multi_page_cache_size; }
+
+	// a class of blocks of size sz and kind; a class not in use, or one with no blocks, is taken for them if there is none yet
+	SizeClass* findClass( size_t sz, Kind kind )
+	{
+		SizeClass* vacant = nullptr;
+		for ( size_t i=0; i<page_cache_class_cnt; ++i )
+		{
+			SizeClass& c = classes[i];
+			if ( c.size == sz && c.kind == kind )
+				return &c;
+			if ( c.blockCnt == 0 && ( vacant == nullptr || c.size == 0 ) )
+				vacant = &c;
+		}
+		if ( vacant != nullptr )
+		{
+			*vacant = SizeClass();
+			vacant->size = sz;
+			vacant->kind = kind;
+			vacant->capacity = 1;
+		}
+		return vacant;
+	}
 
+	void releaseBlock( void* block, size_t sz )
+	{
+		VirtualMemory::deallocate( block, sz );
+		cachedSize -= sz;
+		++releaseCount;
+	}
+
+	void registerRequest( SizeClass& c )
+	{
+		if ( ++(c.requestCnt) < page_cache_adaptation_period )
+			return;
+		if ( c.missCnt != 0 && c.overflowCnt != 0 )
+			c.capacity = c.capacity * 2 < maxCapacity( c.kind ) ? c.capacity * 2 : maxCapacity( c.kind );
+		else if ( c.missCnt == 0 && c.lowWater != 0 )
+			c.capacity = c.capacity > c.lowWater ? c.capacity - c.lowWater : 1;
+		if ( c.blockCnt > c.capacity ) // the least recently cached ones go
+		{
+			size_t surplus = c.blockCnt - c.capacity;
+			for ( size_t i=0; i<surplus; ++i )
+				releaseBlock( c.blocks[i], c.size );
+			memmove( c.blocks, c.blocks + surplus, c.capacity * sizeof( void* ) );
+			c.blockCnt = c.capacity;
+		}
+		c.lowWater = c.blockCnt;
+		c.requestCnt = 0;
+		c.missCnt = 0;
+		c.overflowCnt = 0;
+	}
+
+public:
+	PageCache() {}
+	PageCache( const PageCache& ) = delete;
+	PageCache& operator = ( const PageCache& ) = delete;
+	~PageCache() { clear(); }
+
+	// returns a cached block of size sz and kind, or nullptr if there is none
+	void* get( size_t sz, Kind kind )
+	{
+		SizeClass* c = findClass( sz, kind );
+		if ( c == nullptr || c->blockCnt == 0 )
+		{
+			++missCount;
+			if ( c != nullptr )
+			{
+				++(c->missCnt);
+				registerRequest( *c );
+			}
+			return nullptr;
+		}
+		void* ret = c->blocks[ --(c->blockCnt) ];
+		cachedSize -= sz;
+		if ( c->blockCnt < c->lowWater )
+			c->lowWater = c->blockCnt;
+		++hitCount;
+		registerRequest( *c );
+		return ret;
+	}
+
+	// returns false if a block is not taken (and is to be returned to OS by a caller)
+	bool put( void* block, size_t sz, Kind kind )
+	{
+		SizeClass* c = findClass( sz, kind );
+		if ( c == nullptr )
+			return false;
+		bool taken = c->blockCnt < c->capacity && cachedSize + sz <= PageCacheLimits::maxBytes.load( std::memory_order_relaxed );
+		if ( taken )
+		{
+			c->blocks[ (c->blockCnt)++ ] = block;
+			cachedSize += sz;
+			++storeCount;
+		}
+		else
+			++(c->overflowCnt);
+		registerRequest( *c );
+		return taken;
+	}
+
+	// returns all cached blocks to OS
+	void clear()
+	{
+		for ( size_t i=0; i<page_cache_class_cnt; ++i )
+		{
+			for ( size_t j=0; j<classes[i].blockCnt; ++j )
+				releaseBlock( classes[i].blocks[j], classes[i].size );
+			classes[i] = SizeClass();
+		}
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, cachedSize == 0 );
+	}
+
+	size_t getCachedSize() const { return cachedSize; }
+	uint64_t getHitCount() const { return hitCount; }
+	uint64_t getMissCount() const { return missCount; }
+	uint64_t getStoreCount() const { return storeCount; }
+	uint64_t getReleaseCount() const { return releaseCount; }
+
+	void printStats() const
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Page cache: hits {}, misses {}, stores {}, cached {} bytes, released {} blocks", hitCount, missCount, storeCount, cachedSize, releaseCount );
+	}
+};
+
+struct PageAllocatorWithCaching
+{
+	PageCache* pageCache = nullptr; // if any, shared with other page allocators of a heap (see IibAllocatorBase::setPageCache())
 	BlockStats stats;
 	//uintptr_t blocksBegin = 0;
 	//uintptr_t uninitializedBlocksBegin = 0;
@@ -369,67 +724,71 @@ public:
 	void initialize(uint8_t blockSizeExp)
 	{
 		this->blockSizeExp = blockSizeExp;
-		for ( size_t ix=0; ix<=max_cached_size; ++ ix )
-			freeBlocks[ix].initialize();
 	}
 
 	void deinitialize()
 	{
-		for ( size_t ix=0; ix<=max_cached_size; ++ ix )
-		{
-			while ( !freeBlocks[ix].empty() )
-			{
-				MemoryBlockListItem* chk = static_cast<MemoryBlockListItem*>(freeBlocks[ix].popFront());
-				size_t sz = chk->getSize();
-				uint64_t start = __rdtsc();
-				VirtualMemory::deallocate(chk, sz );
-				uint64_t end = __rdtsc();
-				stats.registerSysDealloc( sz, end - start );
-			}
-		}
 	}
 
-	MemoryBlockListItem* getFreeBlock(size_t sz)
+	void setPageCache( PageCache* cache ) { pageCache = cache; }
+
+	// Returns a block of pageCache, if any (it is counted as requested, but not as obtained from OS)
+	void* getCachedBlock( size_t sz, PageCache::Kind kind )
+	{
+		if ( pageCache == nullptr )
+			return nullptr;
+		void* ret = pageCache->get( sz, kind );
+		if ( ret != nullptr )
+			stats.registerAllocRequest( sz );
+		return ret;
+	}
+
+	// Returns false if pageCache does not take a block (then a caller is to return it to OS)
+	bool cacheBlock( void* block, size_t sz, PageCache::Kind kind )
+	{
+		if ( pageCache == nullptr || !pageCache->put( block, sz, kind ) )
+			return false;
+		stats.registerDeallocRequest( sz );
+		return true;
+	}
+
+	// Same as getFreeBlockNoCache() and freeChunkNoCache(), but for blocks that go through pageCache
+	void* getFreeBlock( size_t sz )
+	{
+		void* ret = getCachedBlock( sz, PageCache::Kind::pages );
+		return ret != nullptr ? ret : getFreeBlockNoCache( sz );
+	}
+	void freeChunk( void* block, size_t sz )
+	{
+		if ( !cacheBlock( block, sz, PageCache::Kind::pages ) )
+			freeChunkNoCache( block, sz );
+	}
+
+	void* getFreeBlockNoCache(size_t sz)
 	{
 		stats.registerAllocRequest( sz );
 
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isAlignedExp(sz, blockSizeExp));
 
-		size_t ix = (sz >> blockSizeExp)-1;
-		if (ix < max_cached_size)
-		{
-			if (!freeBlocks[ix].empty())
-			{
-				MemoryBlockListItem* chk = static_cast<MemoryBlockListItem*>(freeBlocks[ix].popFront());
-				chk->initialize(sz, ix);
-				return chk;
-			}
-		}
-
 		uint64_t start = __rdtsc();
 		void* ptr = VirtualMemory::allocate(sz);
 		uint64_t end = __rdtsc();
 		stats.registerSysAlloc( sz, end - start );
 
 		if (ptr)
-		{
-			MemoryBlockListItem* chk = static_cast<MemoryBlockListItem*>(ptr);
-			chk->initialize(sz, ix);
-			return chk;
-		}
-		//todo enlarge top chunk
+			return ptr;
 
 		throw std::bad_alloc();
 	}
 
-	void* getFreeBlockNoCache(size_t sz)
+	void* getAlignedBlockNoCache(size_t sz, size_t alignment)
 	{
 		stats.registerAllocRequest( sz );
 
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isAlignedExp(sz, blockSizeExp));
 
 		uint64_t start = __rdtsc();
-		void* ptr = VirtualMemory::allocate(sz);
+		void* ptr = VirtualMemory::allocateAligned(sz, alignment);
 		uint64_t end = __rdtsc();
 		stats.registerSysAlloc( sz, end - start );
 
@@ -439,29 +798,26 @@ public:
 		throw std::bad_alloc();
 	}
 	
-	void freeChunk( MemoryBlockListItem* chk )
+	void* reallocateBlockNoCache( void* block, size_t oldSz, size_t newSz, bool mayMove = true )
 	{
-		size_t sz = chk->getSize();
-		stats.registerDeallocRequest( sz );
-		size_t ix = (sz >> blockSizeExp)-1;
-		if ( ix == 0 ) // quite likely case (all bucket chunks)
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, isAlignedExp(newSz, blockSizeExp));
+
+		uint64_t start = __rdtsc();
+		void* ptr = VirtualMemory::reallocate( block, oldSz, newSz, mayMove );
+		uint64_t end = __rdtsc();
+		if ( ptr == nullptr )
+			return nullptr;
+		if ( newSz > oldSz )
 		{
-			if ( freeBlocks[ix].getCount() < single_page_cache_size )
-			{
-				freeBlocks[ix].pushFront(chk);
-				return;
-			}
+			stats.registerAllocRequest( newSz - oldSz );
+			stats.registerSysAlloc( newSz - oldSz, end - start );
 		}
-		else if ( ix < max_cached_size && freeBlocks[ix].getCount() < multi_page_cache_size )
+		else
 		{
-			freeBlocks[ix].pushFront(chk);
-			return;
+			stats.registerDeallocRequest( oldSz - newSz );
+			stats.registerSysDealloc( oldSz - newSz, end - start );
 		}
-
-		uint64_t start = __rdtsc();
-		VirtualMemory::deallocate(chk, sz );
-		uint64_t end = __rdtsc();
-		stats.registerSysDealloc( sz, end - start );
+		return ptr;
 	}
 
 	void freeChunkNoCache( void* block, size_t sz )
@@ -481,13 +837,26 @@ public:
 		stats.printStats();
 	}
 
-	void* AllocateAddressSpace(size_t size)
+	void* AllocateAddressSpace(size_t size, size_t alignment = 0)
+	{
+		uint64_t start = __rdtsc();
+		void* ret = VirtualMemory::AllocateAddressSpace( size, alignment );
+		uint64_t end = __rdtsc();
+		stats.registerSysAlloc( size, end - start );
+		return ret;
+	}
+	void* AllocateAccessibleAddressSpace(size_t size, size_t alignment = 0)
 	{
-		return VirtualMemory::AllocateAddressSpace( size );
+		uint64_t start = __rdtsc();
+		void* ret = VirtualMemory::AllocateAccessibleAddressSpace( size, alignment );
+		uint64_t end = __rdtsc();
+		stats.registerSysAlloc( size, end - start );
+		return ret;
 	}
 	void* CommitMemory(void* addr, size_t size)
 	{
 		stats.registerAllocRequest( size );
+		stats.registerSysCommit( size );
 		void* ret = VirtualMemory::CommitMemory( addr, size);
 		if (ret == (void*)(-1))
 		{
@@ -499,9 +868,24 @@ public:
 	{
 		VirtualMemory::DecommitMemory( addr, size );
 	}
+	void DiscardMemory(void* addr, size_t size)
+	{
+		VirtualMemory::DiscardMemory( addr, size );
+	}
+	void DiscardMemoryLazily(void* addr, size_t size)
+	{
+		VirtualMemory::DiscardMemoryLazily( addr, size );
+	}
+	void AdviseHugePages(void* addr, size_t size)
+	{
+		VirtualMemory::AdviseHugePages( addr, size );
+	}
 	void FreeAddressSpace(void* addr, size_t size)
 	{
+		uint64_t start = __rdtsc();
 		VirtualMemory::FreeAddressSpace( addr, size );
+		uint64_t end = __rdtsc();
+		stats.registerSysDealloc( size, end - start );
 	}
 };
 
@@ -0,0 +1,753 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * iibmalloc allocator: malloc()/free() family and global new/delete
+ * for use as an LD_PRELOAD-able shared library, say:
+ *     LD_PRELOAD=/path/to/libiibmalloc.so ./app
+ * 
+ * Heaps are the same ThreadLocalAllocatorT as g_AllocManager; however, they are
+ * not thread_local objects themselves: constructing a thread_local object from
+ * within malloc() would register its destructor via __cxa_thread_atexit(), which,
+ * in turn, calls calloc(). Instead, each thread keeps a trivially initialized
+ * pointer to a heap taken from a process-wide pool; at thread exit the heap is
+ * returned to the pool (with all its memory) and is adopted by a next new thread.
+ * Memory that is still in use and is freed later on by other threads goes to
+ * the parked heap's remote-free inbox and is taken over by an adopting thread.
+ * 
+ * Pointers not owned by any heap (allocated before the library was loaded,
+ * or by some other allocator) are recognized via PageOwnerMap and are
+ * forwarded to glibc.
+ * 
+ * With IIBMALLOC_ENABLE_TRACE_RECORDER defined, and IIBMALLOC_TRACE=<path> set in
+ * the environment, all operations over our heaps are recorded to a trace file
+ * (see iibmalloc_trace.h) that can be replayed by test/trace_replay.cpp.
+ * 
+ * With IIBMALLOC_ENABLE_SIZE_HISTOGRAM defined, and IIBMALLOC_SIZE_HISTOGRAM=<path>
+ * set, a histogram of allocation sizes is written at exit (see SizeHistogram);
+ * test/size_class_gen.cpp turns it into a table of bucket sizes.
+ * 
+ * v.1.00    May-09-2018    Initial release
+ * 
+ * -------------------------------------------------------------------------------*/
+ 
+
+#include "iibmalloc.h"
+#ifdef IIBMALLOC_ENABLE_TRACE_RECORDER
+#include "iibmalloc_trace.h"
+#endif
+
+#include <cstdlib>
+#include <cstddef>
+#include <memory>
+#include <cstring>
+#include <new>
+
+#include <errno.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#ifdef IIBMALLOC_ENABLE_TRACE_RECORDER
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+#error "IIBMALLOC_ENABLE_CROSS_THREAD_FREE is required to recognize pointers from other allocators"
+#endif
+
+extern "C"
+{
+	// glibc's own implementation; used for pointers that are not ours
+	void* __libc_malloc(size_t size);
+	void __libc_free(void* ptr);
+	void* __libc_realloc(void* ptr, size_t size);
+}
+
+using namespace nodecpp::iibmalloc;
+
+namespace {
+
+#ifdef IIBMALLOC_ENABLE_TRACE_RECORDER
+struct TraceBuffer
+{
+	static constexpr size_t size = 1 << 20;
+	static constexpr size_t max_records = ( size - sizeof( void* ) - sizeof( TraceChunkHeader ) ) / sizeof( TraceRecord );
+
+	TraceBuffer* nextFree;
+	TraceChunkHeader chunk; // is written to a file together with records that immediately follow it
+	TraceRecord records[max_records];
+};
+static_assert( sizeof( TraceBuffer ) <= TraceBuffer::size );
+static_assert( offsetof( TraceBuffer, records ) == offsetof( TraceBuffer, chunk ) + sizeof( TraceChunkHeader ) );
+
+thread_local TraceBuffer* tlsTraceBuffer __attribute__((tls_model("initial-exec"))) = nullptr;
+
+// NOTE: recording must not call malloc(): buffers are taken from OS directly, and a file is written by write()
+class TraceRecorder
+{
+	std::atomic<bool> enabled = false;
+	std::atomic_flag lock = ATOMIC_FLAG_INIT;
+	int fd = -1;
+	uint32_t threadCount = 0;
+	TraceBuffer* freeBuffers = nullptr;
+
+	void acquireLock() { while ( lock.test_and_set( std::memory_order_acquire ) ) {} }
+	void releaseLock() { lock.clear( std::memory_order_release ); }
+
+	bool writeAll( const void* data, size_t sz ) // is called under lock
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>( data );
+		while ( sz != 0 )
+		{
+			ssize_t written = ::write( fd, bytes, sz );
+			if ( written < 0 )
+			{
+				if ( errno == EINTR )
+					continue;
+				return false;
+			}
+			bytes += written;
+			sz -= written;
+		}
+		return true;
+	}
+
+	TraceBuffer* acquireBuffer()
+	{
+		acquireLock();
+		TraceBuffer* buff = freeBuffers;
+		if ( buff != nullptr )
+			freeBuffers = buff->nextFree;
+		uint32_t threadIdx = threadCount++;
+		releaseLock();
+		if ( buff == nullptr )
+			buff = reinterpret_cast<TraceBuffer*>( VirtualMemory::allocate( TraceBuffer::size ) );
+		buff->nextFree = nullptr;
+		buff->chunk.threadIdx = threadIdx;
+		buff->chunk.recordCount = 0;
+		return buff;
+	}
+
+	void flush( TraceBuffer* buff )
+	{
+		acquireLock();
+		if ( fd != -1 && buff->chunk.recordCount != 0 )
+			if ( !writeAll( &(buff->chunk), sizeof( TraceChunkHeader ) + buff->chunk.recordCount * sizeof( TraceRecord ) ) )
+				enabled.store( false, std::memory_order_relaxed ); // a truncated trace is still usable; appending to it after a failure is not
+		buff->chunk.recordCount = 0;
+		releaseLock();
+	}
+
+public:
+	NODECPP_FORCEINLINE bool isEnabled() const { return enabled.load( std::memory_order_relaxed ); }
+
+	void start( const char* path )
+	{
+		int f = ::open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+		if ( f == -1 )
+			return;
+		TraceFileHeader header;
+		memcpy( header.magic, TraceFileHeader::magic_value, sizeof( header.magic ) );
+		header.version = TraceFileHeader::current_version;
+		header.recordSize = sizeof( TraceRecord );
+		acquireLock();
+		fd = f;
+		bool ok = writeAll( &header, sizeof( header ) );
+		releaseLock();
+		enabled.store( ok, std::memory_order_relaxed );
+	}
+
+	// records of threads that are still running are lost
+	void stop()
+	{
+		enabled.store( false, std::memory_order_relaxed );
+		onThreadExit();
+		acquireLock();
+		if ( fd != -1 )
+			::close( fd );
+		fd = -1;
+		releaseLock();
+	}
+
+	// timestamp is to be taken before an object (if any) is released, as its address may be reused by other threads immediately
+	NODECPP_NOINLINE void record( TraceOp op, const void* ptr, size_t sz, uint64_t timestamp )
+	{
+		TraceBuffer* buff = tlsTraceBuffer;
+		if ( buff == nullptr )
+		{
+			buff = acquireBuffer();
+			tlsTraceBuffer = buff;
+		}
+		TraceRecord& rec = buff->records[ buff->chunk.recordCount++ ];
+		rec.timestamp = timestamp;
+		rec.ptr = (uint64_t)ptr;
+		rec.sizeAndOp = TraceRecord::make( op, sz );
+		if ( buff->chunk.recordCount == TraceBuffer::max_records )
+			flush( buff );
+	}
+
+	void onThreadExit()
+	{
+		TraceBuffer* buff = tlsTraceBuffer;
+		if ( buff == nullptr )
+			return;
+		tlsTraceBuffer = nullptr;
+		flush( buff );
+		acquireLock();
+		buff->nextFree = freeBuffers;
+		freeBuffers = buff;
+		releaseLock();
+	}
+};
+
+TraceRecorder traceRecorder;
+
+NODECPP_FORCEINLINE uint64_t traceTimestamp() { return __builtin_expect( traceRecorder.isEnabled(), 0 ) ? __rdtsc() : 0; }
+
+NODECPP_FORCEINLINE void traceAlloc( const void* ptr, size_t size )
+{
+	if ( __builtin_expect( traceRecorder.isEnabled(), 0 ) )
+		traceRecorder.record( TraceOp::alloc, ptr, size, __rdtsc() );
+}
+
+NODECPP_FORCEINLINE void traceDealloc( const void* ptr )
+{
+	if ( __builtin_expect( traceRecorder.isEnabled(), 0 ) )
+		traceRecorder.record( TraceOp::dealloc, ptr, 0, __rdtsc() );
+}
+
+NODECPP_FORCEINLINE void traceRealloc( const void* oldPtr, uint64_t startTimestamp, const void* newPtr, size_t size )
+{
+	if ( __builtin_expect( traceRecorder.isEnabled() && startTimestamp != 0, 0 ) ) // started being enabled in between otherwise
+	{
+		traceRecorder.record( TraceOp::reallocFrom, oldPtr, 0, startTimestamp );
+		traceRecorder.record( TraceOp::reallocTo, newPtr, size, __rdtsc() );
+	}
+}
+
+// IIBMALLOC_TRACE=<path> starts recording at startup
+__attribute__((constructor)) void startTraceRecorder()
+{
+	const char* path = getenv( "IIBMALLOC_TRACE" );
+	if ( path != nullptr )
+		traceRecorder.start( path );
+}
+
+__attribute__((destructor)) void stopTraceRecorderAtExit()
+{
+	traceRecorder.stop();
+}
+#else
+NODECPP_FORCEINLINE uint64_t traceTimestamp() { return 0; }
+NODECPP_FORCEINLINE void traceAlloc( const void* ptr, size_t size ) {}
+NODECPP_FORCEINLINE void traceDealloc( const void* ptr ) {}
+NODECPP_FORCEINLINE void traceRealloc( const void* oldPtr, uint64_t startTimestamp, const void* newPtr, size_t size ) {}
+#endif // IIBMALLOC_ENABLE_TRACE_RECORDER
+
+struct PooledHeap
+{
+	ThreadLocalAllocatorT heap;
+	PooledHeap* nextParked = nullptr;
+};
+
+// NOTE: all globals below are constant-initialized as malloc() can be called before any of static constructors
+#if defined(__cpp_constinit)
+#define IIBMALLOC_CONSTINIT constinit
+#elif defined(__clang__)
+#define IIBMALLOC_CONSTINIT [[clang::require_constant_initialization]]
+#else
+#define IIBMALLOC_CONSTINIT __constinit
+#endif
+
+class HeapPool
+{
+	std::atomic_flag lock = ATOMIC_FLAG_INIT;
+	PooledHeap* parked = nullptr;
+	pthread_key_t threadExitKey{};
+	pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+
+	static void onThreadExit( void* heap );
+	static void createKey();
+
+	void acquireLock() { while ( lock.test_and_set( std::memory_order_acquire ) ) {} }
+	void releaseLock() { lock.clear( std::memory_order_release ); }
+
+public:
+	constexpr HeapPool() {}
+
+	PooledHeap* acquire()
+	{
+		pthread_once( &keyOnce, createKey );
+		acquireLock();
+		PooledHeap* ret = parked;
+		if ( ret != nullptr )
+			parked = ret->nextParked;
+		releaseLock();
+		if ( ret == nullptr )
+		{
+			void* mem = VirtualMemory::allocate( alignUpExp( sizeof( PooledHeap ), 12 ) );
+			ret = new(mem) PooledHeap;
+		}
+		ret->nextParked = nullptr;
+		pthread_setspecific( threadExitKey, ret );
+		return ret;
+	}
+
+	void park( PooledHeap* heap )
+	{
+		acquireLock();
+		heap->nextParked = parked;
+		parked = heap;
+		releaseLock();
+	}
+
+	size_t trimParked()
+	{
+		acquireLock();
+		PooledHeap* heaps = parked;
+		parked = nullptr;
+		releaseLock();
+		size_t released = 0;
+		while ( heaps != nullptr ) // while being out of the pool, heaps are not accessible to anyone else
+		{
+			PooledHeap* next = heaps->nextParked;
+			released += heaps->heap.trim();
+			park( heaps );
+			heaps = next;
+		}
+		return released;
+	}
+};
+
+static_assert( ( HeapPool(), true ), "HeapPool must be constant-initialized" );
+IIBMALLOC_CONSTINIT HeapPool heapPool;
+thread_local PooledHeap* tlsHeap __attribute__((tls_model("initial-exec"))) = nullptr;
+
+void HeapPool::createKey()
+{
+	pthread_key_create( &(heapPool.threadExitKey), onThreadExit );
+}
+
+void HeapPool::onThreadExit( void* heap )
+{
+	tlsHeap = nullptr; // if this thread calls malloc() at a later stage of its exit, a heap is acquired again (and this function is called again)
+	PooledHeap* ph = reinterpret_cast<PooledHeap*>( heap );
+#ifdef IIBMALLOC_ENABLE_TRACE_RECORDER
+	traceRecorder.onThreadExit();
+#endif
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+	ph->heap.flushSizeHistogram();
+#endif
+	ph->heap.trim(); // a parked heap is likely to stay idle for a while
+	heapPool.park( ph );
+}
+
+NODECPP_FORCEINLINE ThreadLocalAllocatorT& getHeap()
+{
+	PooledHeap* ph = tlsHeap;
+	if ( __builtin_expect( ph == nullptr, 0 ) )
+	{
+		ph = heapPool.acquire();
+		tlsHeap = ph;
+	}
+	return ph->heap;
+}
+
+NODECPP_FORCEINLINE bool isOurs( const void* ptr )
+{
+	return PageOwnerMap::getOwner( ptr ) != PageOwnerMap::no_owner;
+}
+
+size_t foreignUsableSize( void* ptr )
+{
+	typedef size_t (*UsableSizeFnT)(void*);
+	static UsableSizeFnT fn = nullptr;
+	if ( fn == nullptr )
+		fn = reinterpret_cast<UsableSizeFnT>( dlsym( RTLD_NEXT, "malloc_usable_size" ) );
+	return fn != nullptr ? fn( ptr ) : 0;
+}
+
+NODECPP_FORCEINLINE void* doMalloc( size_t size ) noexcept
+{
+	void* ret;
+	try
+	{
+		ret = getHeap().allocate( size );
+	}
+	catch (...)
+	{
+		errno = ENOMEM;
+		return nullptr;
+	}
+	traceAlloc( ret, size );
+	return ret;
+}
+
+NODECPP_FORCEINLINE void doFree( void* ptr ) noexcept
+{
+	if ( ptr == nullptr )
+		return;
+	if ( isOurs( ptr ) )
+	{
+		traceDealloc( ptr );
+		getHeap().deallocate( ptr );
+	}
+	else
+		__libc_free( ptr );
+}
+
+void* doMemalign( size_t alignment, size_t size ) noexcept
+{
+	if ( alignment <= ALIGNMENT )
+		return doMalloc( size );
+	void* ret;
+	try
+	{
+		ret = getHeap().allocateAligned( size, alignment ); // any alignment, as IIBMALLOC_ENABLE_CROSS_THREAD_FREE is required here
+	}
+	catch (...)
+	{
+		errno = ENOMEM;
+		return nullptr;
+	}
+	traceAlloc( ret, size ); // alignment is not recorded
+	return ret;
+}
+
+void* doRealloc( void* ptr, size_t size ) noexcept
+{
+	if ( ptr == nullptr )
+		return doMalloc( size );
+	if ( size == 0 )
+	{
+		doFree( ptr );
+		return nullptr;
+	}
+	if ( !isOurs( ptr ) )
+		return __libc_realloc( ptr, size );
+	uint64_t start = traceTimestamp();
+	void* ret;
+	try
+	{
+		ret = getHeap().reallocate( ptr, size );
+	}
+	catch (...)
+	{
+		errno = ENOMEM;
+		return nullptr;
+	}
+	traceRealloc( ptr, start, ret, size );
+	return ret;
+}
+
+NODECPP_FORCEINLINE void* doNew( size_t size )
+{
+	void* ret = getHeap().allocate( size ); // throws std::bad_alloc on failure
+	traceAlloc( ret, size );
+	return ret;
+}
+
+void* doNewAligned( size_t size, std::align_val_t alignment )
+{
+	void* ret = doMemalign( static_cast<size_t>( alignment ), size );
+	if ( ret == nullptr )
+		throw std::bad_alloc();
+	return ret;
+}
+
+// IIBMALLOC_DIRECT_CHUNK_CACHE_BYTES=<bytes> and IIBMALLOC_DIRECT_CHUNK_CACHE_AGE_MS=<ms> override limits of per-heap caches
+// of freed large mappings (see DirectChunkCacheLimits)
+__attribute__((constructor)) void setDirectChunkCacheLimits()
+{
+	const char* bytes = getenv( "IIBMALLOC_DIRECT_CHUNK_CACHE_BYTES" );
+	if ( bytes != nullptr )
+		DirectChunkCacheLimits::maxBytes.store( strtoull( bytes, nullptr, 10 ), std::memory_order_relaxed );
+	const char* ageMs = getenv( "IIBMALLOC_DIRECT_CHUNK_CACHE_AGE_MS" );
+	if ( ageMs != nullptr )
+		DirectChunkCacheLimits::maxAgeNs.store( strtoull( ageMs, nullptr, 10 ) * 1000000, std::memory_order_relaxed );
+}
+
+// IIBMALLOC_PAGE_CACHE_BYTES=<bytes> overrides a limit of address space each heap keeps mapped for reuse (see PageCacheLimits)
+__attribute__((constructor)) void setPageCacheLimits()
+{
+	const char* bytes = getenv( "IIBMALLOC_PAGE_CACHE_BYTES" );
+	if ( bytes != nullptr )
+		PageCacheLimits::maxBytes.store( strtoull( bytes, nullptr, 10 ), std::memory_order_relaxed );
+}
+
+// IIBMALLOC_COMMIT_MODE=demand makes heaps reserve bucket pages readable and writable at once, with no mmap() per commit (see CommitMode)
+__attribute__((constructor)) void setCommitMode()
+{
+	const char* mode = getenv( "IIBMALLOC_COMMIT_MODE" );
+	if ( mode == nullptr )
+		return;
+	CommitMode m = strcmp( mode, "demand" ) == 0 ? CommitMode::demandPaging : CommitMode::remap;
+	CommitModeDefault::mode.store( m, std::memory_order_relaxed );
+	if ( tlsHeap != nullptr ) // acquired before static constructors are run
+		tlsHeap->heap.setCommitMode( m );
+}
+
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+// IIBMALLOC_HEAP_PROFILE_INTERVAL=<bytes> turns sampling on at startup; with IIBMALLOC_HEAP_PROFILE=<path>, a profile is written at exit
+__attribute__((constructor)) void startHeapProfiler()
+{
+	const char* interval = getenv( "IIBMALLOC_HEAP_PROFILE_INTERVAL" );
+	if ( interval != nullptr )
+		HeapProfiler::setSamplingInterval( strtoull( interval, nullptr, 10 ) );
+}
+
+__attribute__((destructor)) void dumpHeapProfileAtExit()
+{
+	const char* path = getenv( "IIBMALLOC_HEAP_PROFILE" );
+	if ( path != nullptr )
+		HeapProfiler::dumpHeapProfile( path );
+}
+#endif // IIBMALLOC_ENABLE_HEAP_PROFILER
+
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+// heaps of exited threads are flushed at thread exit; of still running threads, only a heap of this (exiting) one is counted
+__attribute__((destructor)) void writeSizeHistogramAtExit()
+{
+	const char* path = getenv( "IIBMALLOC_SIZE_HISTOGRAM" );
+	if ( path == nullptr )
+		return;
+	if ( tlsHeap != nullptr )
+		tlsHeap->heap.flushSizeHistogram();
+	if ( !SizeHistogram::write( path ) )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "cannot write size histogram to {}", path );
+}
+#endif // IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+
+} // anonymous namespace
+
+extern "C"
+{
+
+__attribute__((visibility("default"))) void* malloc( size_t size ) noexcept
+{
+	return doMalloc( size );
+}
+
+__attribute__((visibility("default"))) void free( void* ptr ) noexcept
+{
+	doFree( ptr );
+}
+
+__attribute__((visibility("default"))) void* calloc( size_t nmemb, size_t size ) noexcept
+{
+	size_t total;
+	if ( __builtin_mul_overflow( nmemb, size, &total ) )
+	{
+		errno = ENOMEM;
+		return nullptr;
+	}
+	void* ret = doMalloc( total );
+	if ( ret != nullptr )
+		memset( ret, 0, total );
+	return ret;
+}
+
+__attribute__((visibility("default"))) void* realloc( void* ptr, size_t size ) noexcept
+{
+	return doRealloc( ptr, size );
+}
+
+__attribute__((visibility("default"))) void* reallocarray( void* ptr, size_t nmemb, size_t size ) noexcept
+{
+	size_t total;
+	if ( __builtin_mul_overflow( nmemb, size, &total ) )
+	{
+		errno = ENOMEM;
+		return nullptr;
+	}
+	return doRealloc( ptr, total );
+}
+
+__attribute__((visibility("default"))) int posix_memalign( void** memptr, size_t alignment, size_t size ) noexcept
+{
+	if ( alignment < sizeof( void* ) || ( alignment & ( alignment - 1 ) ) != 0 )
+		return EINVAL;
+	void* ret = doMemalign( alignment, size );
+	if ( ret == nullptr )
+		return ENOMEM;
+	*memptr = ret;
+	return 0;
+}
+
+__attribute__((visibility("default"))) void* aligned_alloc( size_t alignment, size_t size ) noexcept
+{
+	if ( alignment == 0 || ( alignment & ( alignment - 1 ) ) != 0 )
+	{
+		errno = EINVAL;
+		return nullptr;
+	}
+	return doMemalign( alignment, size );
+}
+
+__attribute__((visibility("default"))) void* memalign( size_t alignment, size_t size ) noexcept
+{
+	if ( ( alignment & ( alignment - 1 ) ) != 0 ) // glibc rounds it up
+		alignment = ((size_t)1) << ( 64 - __builtin_clzll( alignment ) );
+	return doMemalign( alignment, size );
+}
+
+__attribute__((visibility("default"))) void* valloc( size_t size ) noexcept
+{
+	return doMemalign( PAGE_SIZE, size );
+}
+
+__attribute__((visibility("default"))) void* pvalloc( size_t size ) noexcept
+{
+	return doMemalign( PAGE_SIZE, alignUpExp( size, PAGE_SIZE_EXP ) );
+}
+
+__attribute__((visibility("default"))) size_t malloc_usable_size( void* ptr ) noexcept
+{
+	if ( ptr == nullptr )
+		return 0;
+	if ( isOurs( ptr ) )
+		return getHeap().getAllocatedSize( ptr );
+	return foreignUsableSize( ptr );
+}
+
+// NOTE: pad is ignored; free memory of the calling thread's heap and of parked heaps (of exited threads) is returned to OS
+__attribute__((visibility("default"))) int malloc_trim( size_t pad ) noexcept
+{
+	size_t released = getHeap().trim() + heapPool.trimParked();
+	return released != 0 ? 1 : 0;
+}
+
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+// Writes a profile of sampled live objects to a file (see HeapProfiler::dumpHeapProfile()); returns 0 on success
+__attribute__((visibility("default"))) int iibmalloc_dump_heap_profile( const char* path ) noexcept
+{
+	return HeapProfiler::dumpHeapProfile( path ) ? 0 : -1;
+}
+#endif // IIBMALLOC_ENABLE_HEAP_PROFILER
+
+} // extern "C"
+
+void* operator new(std::size_t count)
+{
+	return doNew( count );
+}
+
+void* operator new[](std::size_t count)
+{
+	return doNew( count );
+}
+
+void* operator new(std::size_t count, const std::nothrow_t&) noexcept
+{
+	return doMalloc( count );
+}
+
+void* operator new[](std::size_t count, const std::nothrow_t&) noexcept
+{
+	return doMalloc( count );
+}
+
+void operator delete(void* ptr) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	doFree( ptr );
+}
+
+#if __cplusplus >= 201703L
+void* operator new(std::size_t count, std::align_val_t alignment)
+{
+	return doNewAligned( count, alignment );
+}
+
+void* operator new[](std::size_t count, std::align_val_t alignment)
+{
+	return doNewAligned( count, alignment );
+}
+
+void* operator new(std::size_t count, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return doMemalign( static_cast<size_t>( alignment ), count );
+}
+
+void* operator new[](std::size_t count, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return doMemalign( static_cast<size_t>( alignment ), count );
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	doFree( ptr );
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+	doFree( ptr );
+}
+#endif
@@ -0,0 +1,128 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator
+ * Size histogram (IIBMALLOC_ENABLE_SIZE_HISTOGRAM):
+ *     - each heap counts allocations and requested bytes by size, rounded up
+ *       to 8 bytes (sizes above a max bucket size are counted together)
+ *     - counts are added to process-wide totals when a heap is deinitialized
+ *       or on flush()
+ *     - totals are written to a text file, one "<size> <count> <bytes>" line per
+ *       size ("large <count> <bytes>" for sizes above a max bucket size), to be
+ *       turned into a size-class table by test/size_class_gen.cpp
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#ifndef IIBMALLOC_SIZE_HISTOGRAM_H
+#define IIBMALLOC_SIZE_HISTOGRAM_H
+
+#include "iibmalloc_page_allocator.h"
+
+#ifdef IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+
+#include <cstring>
+#include <cstdio>
+
+namespace nodecpp::iibmalloc
+{
+
+class SizeHistogram
+{
+public:
+	static constexpr size_t granule_exp = 3;
+	static constexpr size_t max_size = 8 * 1024; // IibAllocatorBase::MaxBucketSize
+	static constexpr size_t slot_count = ( max_size >> granule_exp ) + 2; // by ( sz + 7 ) / 8, plus one for sizes above max_size
+
+private:
+	uint64_t counts[slot_count];
+	uint64_t bytes[slot_count];
+
+	static inline std::atomic<uint64_t> totalCounts[slot_count];
+	static inline std::atomic<uint64_t> totalBytes[slot_count];
+
+public:
+	static constexpr size_t sizeToSlot( size_t sz )
+	{
+		return sz <= max_size ? ( sz + ( 1 << granule_exp ) - 1 ) >> granule_exp : slot_count - 1;
+	}
+
+	void clear()
+	{
+		memset( counts, 0, sizeof( counts ) );
+		memset( bytes, 0, sizeof( bytes ) );
+	}
+
+	NODECPP_FORCEINLINE void record( size_t sz, size_t n = 1 )
+	{
+		size_t slot = sizeToSlot( sz );
+		counts[slot] += n;
+		bytes[slot] += sz * n;
+	}
+
+	// adds counts of this heap to process-wide totals
+	void flush()
+	{
+		for ( size_t i=0; i<slot_count; ++i )
+			if ( counts[i] != 0 )
+			{
+				totalCounts[i].fetch_add( counts[i], std::memory_order_relaxed );
+				totalBytes[i].fetch_add( bytes[i], std::memory_order_relaxed );
+			}
+		clear();
+	}
+
+	// Writes process-wide totals (counts of heaps that are still in use are added on their flush()); does not allocate.
+	// Returns false if the file could not be written.
+	static bool write( const char* path )
+	{
+		intptr_t file = RawFile::open( path );
+		if ( file == -1 )
+			return false;
+		static constexpr char header[] = "# iibmalloc size histogram: size (rounded up to 8), allocation count, requested bytes\n";
+		bool ok = RawFile::write( file, header, sizeof(header) - 1 );
+		char line[80];
+		for ( size_t i=0; ok && i<slot_count; ++i )
+		{
+			uint64_t cnt = totalCounts[i].load( std::memory_order_relaxed );
+			if ( cnt == 0 )
+				continue;
+			uint64_t sz = totalBytes[i].load( std::memory_order_relaxed );
+			int len = i < slot_count - 1 ? snprintf( line, sizeof(line), "%zu %llu %llu\n", i << granule_exp, (unsigned long long)cnt, (unsigned long long)sz ) : snprintf( line, sizeof(line), "large %llu %llu\n", (unsigned long long)cnt, (unsigned long long)sz );
+			ok = RawFile::write( file, line, len );
+		}
+		RawFile::close( file );
+		return ok;
+	}
+};
+
+} // namespace nodecpp::iibmalloc
+
+#endif // IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+
+#endif // IIBMALLOC_SIZE_HISTOGRAM_H
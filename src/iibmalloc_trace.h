@@ -0,0 +1,93 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * Per-thread bucket allocator: allocation trace format
+ * 
+ * A trace is written by the preload library built with IIBMALLOC_ENABLE_TRACE_RECORDER
+ * (see iibmalloc_preload_linux.cpp) and is read by test/trace_replay.cpp.
+ * 
+ * Layout: TraceFileHeader followed by any number of chunks; each chunk is
+ * a TraceChunkHeader followed by recordCount TraceRecord's of a single thread.
+ * Chunks of a thread appear in the order they were recorded; chunks of different
+ * threads are interleaved arbitrarily (records are ordered by their timestamps).
+ * 
+ * An address of an object serves as its id; as addresses are reused, the replayer
+ * assigns objects unique ids by walking records in timestamp order.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+ 
+#ifndef IIBMALLOC_TRACE_H
+#define IIBMALLOC_TRACE_H
+
+#include <cstdint>
+
+namespace nodecpp::iibmalloc
+{
+
+enum class TraceOp : uint8_t
+{
+	alloc = 0, // ptr, size
+	dealloc = 1, // ptr
+	reallocFrom = 2, // ptr (old); always immediately followed by reallocTo of the same thread
+	reallocTo = 3, // ptr (new), size
+};
+
+struct TraceFileHeader
+{
+	static constexpr char magic_value[8] = { 'I', 'I', 'B', 'T', 'R', 'A', 'C', 'E' };
+	static constexpr uint32_t current_version = 1;
+
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+};
+
+struct TraceChunkHeader
+{
+	uint32_t threadIdx; // in order of first recorded operation of a thread
+	uint32_t recordCount;
+};
+
+struct TraceRecord
+{
+	uint64_t timestamp; // rdtsc
+	uint64_t ptr;
+	uint64_t sizeAndOp; // size << 2 | TraceOp
+
+	static constexpr uint64_t make( TraceOp op, size_t size ) { return ( ((uint64_t)size) << 2 ) | (uint64_t)op; }
+	TraceOp op() const { return (TraceOp)( sizeAndOp & 3 ); }
+	size_t size() const { return (size_t)( sizeAndOp >> 2 ); }
+};
+
+static_assert( sizeof( TraceFileHeader ) == 16 );
+static_assert( sizeof( TraceChunkHeader ) == 8 );
+static_assert( sizeof( TraceRecord ) == 24 );
+
+} // nodecpp::iibmalloc
+
+#endif // IIBMALLOC_TRACE_H
@@ -33,6 +33,7 @@
  
  
 #include "iibmalloc_page_allocator.h"
+#include "iibmalloc_heap_profiler.h"
 
 #include <cstdlib>
 #include <cstddef>
@@ -43,12 +44,13 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <fcntl.h>
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+#include <execinfo.h>
+#endif
 
 
 using namespace nodecpp::iibmalloc;
 
-thread_local PageAllocatorWithCaching thg_PageAllocatorWithCaching;
-
 // limit below is single read or write op in linux
 static constexpr size_t MAX_LINUX = 0x7ffff000;
 // [DI: what depends on what/] static_assert(MAX_LINUX <= MAX_CHUNK_SIZE, "Use of big chunks needs review.");
@@ -100,6 +102,19 @@ void* VirtualMemory::allocate(size_t size)
 	return ptr;
 }
 
+void* VirtualMemory::allocateAligned(size_t size, size_t alignment)
+{
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, alignment != 0 && ( alignment & ( alignment - 1 ) ) == 0 && alignment % 4096 == 0 );
+	size_t reservedSize = size + alignment - 4096;
+	uint8_t* ptr = reinterpret_cast<uint8_t*>( allocate( reservedSize ) );
+	uint8_t* ret = reinterpret_cast<uint8_t*>( ( (uintptr_t)(ptr) + alignment - 1 ) & ~( (uintptr_t)(alignment) - 1 ) );
+	if ( ret != ptr )
+		deallocate( ptr, ret - ptr );
+	if ( ptr + reservedSize != ret + size )
+		deallocate( ret + size, ptr + reservedSize - ( ret + size ) );
+	return ret;
+}
+
 void VirtualMemory::deallocate(void* ptr, size_t size)
 {
 	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, size % 4096 == 0 );
@@ -114,10 +129,39 @@ void VirtualMemory::deallocate(void* ptr, size_t size)
 }
 
 
+void* VirtualMemory::reallocate(void* ptr, size_t oldSize, size_t newSize, bool mayMove)
+{
+	void* ret = mremap(ptr, oldSize, newSize, mayMove ? MREMAP_MAYMOVE : 0);
+	if (ret == MAP_FAILED)
+	{
+		int e = errno;
+		if ( !mayMove && e == ENOMEM ) // pages next to the block are in use
+			return nullptr;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "mremap error at reallocate(0x{:x}, 0x{:x}, 0x{:x}), error = {} ({})", (size_t)(ptr), oldSize, newSize, e, strerror(e) );
+		return nullptr;
+	}
+	return ret;
+}
 
-void* VirtualMemory::AllocateAddressSpace(size_t size)
+
+// maps a range at an address aligned to alignment (if it exceeds a page) by mapping a larger range and unmapping its ends; MAP_FAILED on failure
+static void* mapAligned(size_t size, size_t alignment, int prot, int flags)
+{
+	size_t mappedSize = alignment > 4096 ? size + alignment - 4096 : size;
+	uint8_t* ptr = reinterpret_cast<uint8_t*>( mmap(nullptr, mappedSize, prot, flags, -1, 0) );
+	if ( ptr == MAP_FAILED || mappedSize == size )
+		return ptr;
+	uint8_t* ret = reinterpret_cast<uint8_t*>( ( (uintptr_t)(ptr) + alignment - 1 ) & ~( (uintptr_t)(alignment) - 1 ) );
+	if ( ret != ptr )
+		munmap( ptr, ret - ptr );
+	if ( ptr + mappedSize != ret + size )
+		munmap( ret + size, ptr + mappedSize - ( ret + size ) );
+	return ret;
+}
+
+void* VirtualMemory::AllocateAddressSpace(size_t size, size_t alignment)
 {
-    void * ptr = mmap((void*)0, size, PROT_NONE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    void * ptr = mapAligned(size, alignment, PROT_NONE, MAP_PRIVATE|MAP_ANON);
 	if (ptr == (void*)(-1))
 	{
 		int e = errno;
@@ -127,6 +171,19 @@ void* VirtualMemory::AllocateAddressSpace(size_t size)
  //   msync(ptr, size, MS_SYNC|MS_INVALIDATE);
     return ptr;
 }
+
+void* VirtualMemory::AllocateAccessibleAddressSpace(size_t size, size_t alignment)
+{
+	// MAP_NORESERVE: swap space is not accounted for pages that are never touched
+	void* ptr = mapAligned(size, alignment, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE);
+	if (ptr == (void*)(-1))
+	{
+		int e = errno;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "mmap error at AllocateAccessibleAddressSpace({}), error = {} ({})", size, e, strerror(e) );
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
  
 void* VirtualMemory::CommitMemory(void* addr, size_t size)
 {
@@ -157,9 +214,51 @@ void VirtualMemory::DecommitMemory(void* addr, size_t size)
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "mmap error at DecommitMemory({}), error = {} ({})", size, e, strerror(e) );
 		throw std::bad_alloc();
 	}
-   msync(addr, size, MS_SYNC|MS_INVALIDATE);
+	// nothing to sync: a private anonymous mapping has just been replaced (as with CommitMemory() above)
+//   msync(addr, size, MS_SYNC|MS_INVALIDATE);
 }
  
+void VirtualMemory::DiscardMemory(void* addr, size_t size)
+{
+	// unlike DecommitMemory(), does not split mappings (a number of which is limited by vm.max_map_count)
+	int ret = madvise(addr, size, MADV_DONTNEED);
+	if ( ret == -1 )
+	{
+		int e = errno;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "madvise error at DiscardMemory(0x{:x}, 0x{:x}), error = {} ({})", (size_t)(addr), size, e, strerror(e) );
+		// not critical: memory just remains resident
+	}
+}
+
+void VirtualMemory::DiscardMemoryLazily(void* addr, size_t size)
+{
+#ifdef MADV_FREE
+	int ret = madvise(addr, size, MADV_FREE);
+	if ( ret == 0 )
+		return;
+	if ( errno != EINVAL ) // otherwise, not supported by the kernel (before 4.5)
+	{
+		int e = errno;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "madvise error at DiscardMemoryLazily(0x{:x}, 0x{:x}), error = {} ({})", (size_t)(addr), size, e, strerror(e) );
+		return; // not critical: memory just remains resident
+	}
+#endif
+	DiscardMemory(addr, size);
+}
+
+void VirtualMemory::AdviseHugePages(void* addr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	int ret = madvise(addr, size, MADV_HUGEPAGE);
+	if ( ret == -1 && errno != EINVAL ) // EINVAL: the kernel is built without transparent huge pages
+	{
+		int e = errno;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "madvise error at AdviseHugePages(0x{:x}, 0x{:x}), error = {} ({})", (size_t)(addr), size, e, strerror(e) );
+		// not critical: range is just backed by regular pages
+	}
+#endif
+}
+
 void VirtualMemory::FreeAddressSpace(void* addr, size_t size)
 {
     int ret = msync(addr, size, MS_SYNC);
@@ -178,4 +277,77 @@ void VirtualMemory::FreeAddressSpace(void* addr, size_t size)
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "munmap error at FreeAddressSpace({}), error = {} ({})", size, e, strerror(e) );
 		throw std::bad_alloc();
 	}
-}
\ No newline at end of file
+}
+
+/*static*/
+intptr_t RawFile::open( const char* path )
+{
+	int fd = ::open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+	if ( fd == -1 )
+	{
+		int e = errno;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "cannot open file {}, error = {} ({})", path, e, strerror(e) );
+	}
+	return fd;
+}
+
+/*static*/
+bool RawFile::write( intptr_t file, const char* data, size_t size )
+{
+	while ( size )
+	{
+		ssize_t written = ::write( (int)file, data, size );
+		if ( written == -1 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return false;
+		}
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+/*static*/
+void RawFile::close( intptr_t file )
+{
+	::close( (int)file );
+}
+
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+/*static*/
+size_t HeapProfiler::captureStackTrace( void** frames, size_t maxFrames )
+{
+	int ret = backtrace( frames, (int)maxFrames );
+	return ret > 0 ? ret : 0;
+}
+
+/*static*/
+bool HeapProfiler::writeMemoryMap( intptr_t file )
+{
+	static constexpr char header[] = "\nMAPPED_LIBRARIES:\n";
+	if ( !RawFile::write( file, header, sizeof(header) - 1 ) )
+		return false;
+	int fd = open( "/proc/self/maps", O_RDONLY | O_CLOEXEC );
+	if ( fd == -1 )
+		return true; // a profile is still usable, if binaries are given to pprof explicitly
+	char buff[4096];
+	bool ok = true;
+	for (;;)
+	{
+		ssize_t rd = read( fd, buff, sizeof(buff) );
+		if ( rd == -1 && errno == EINTR )
+			continue;
+		if ( rd <= 0 )
+			break;
+		if ( !RawFile::write( file, buff, rd ) )
+		{
+			ok = false;
+			break;
+		}
+	}
+	close( fd );
+	return ok;
+}
+#endif // IIBMALLOC_ENABLE_HEAP_PROFILER
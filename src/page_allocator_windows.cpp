@@ -33,6 +33,7 @@
 
 
 #include "iibmalloc_page_allocator.h"
+#include "iibmalloc_heap_profiler.h"
 
 #include <cstdlib>
 #include <cstddef>
@@ -139,6 +140,27 @@ void* VirtualMemory::allocate(size_t size)
 	}
 }
 
+void* VirtualMemory::allocateAligned(size_t size, size_t alignment)
+{
+	NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, alignment != 0 && ( alignment & ( alignment - 1 ) ) == 0 );
+	// parts of a reservation cannot be released; an aligned address is found by reserving a larger range, and the range is
+	// released and taken again at that address (which might be taken by some other thread in between; then we retry)
+	for (;;)
+	{
+		void* probe = VirtualAlloc(0, size + alignment, MEM_RESERVE, PAGE_NOACCESS);
+		if ( probe == nullptr )
+		{
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "Reserving memory failed for size {} ({:x}), error = {}", size + alignment, size + alignment, GetLastError() );
+			throw std::bad_alloc();
+		}
+		void* aligned = (void*)( ( (uintptr_t)(probe) + alignment - 1 ) & ~( (uintptr_t)(alignment) - 1 ) );
+		VirtualFree(probe, 0, MEM_RELEASE);
+		void* ret = VirtualAlloc(aligned, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if ( ret != nullptr )
+			return ret;
+	}
+}
+
 void VirtualMemory::deallocate(void* ptr, size_t size)
 {
 	bool ret = VirtualFree(ptr, 0, MEM_RELEASE);
@@ -152,10 +174,33 @@ void VirtualMemory::deallocate(void* ptr, size_t size)
 	}
 }
 
+void* VirtualMemory::reallocate(void* ptr, size_t oldSize, size_t newSize, bool mayMove)
+{
+	return nullptr; // no mremap() counterpart; a caller moves data itself
+}
+
+
+// reserves (and commits, if allocationType says so) a range at an address aligned to alignment, by analogy with allocateAligned()
+static void* reserveAligned(size_t size, size_t alignment, DWORD allocationType, DWORD protection)
+{
+	if ( alignment <= VirtualMemory::getAllocGranularity() )
+		return VirtualAlloc(NULL, size, allocationType, protection);
+	for (;;)
+	{
+		void* probe = VirtualAlloc(0, size + alignment, MEM_RESERVE, PAGE_NOACCESS);
+		if ( probe == nullptr )
+			return nullptr;
+		void* aligned = (void*)( ( (uintptr_t)(probe) + alignment - 1 ) & ~( (uintptr_t)(alignment) - 1 ) );
+		VirtualFree(probe, 0, MEM_RELEASE);
+		void* ret = VirtualAlloc(aligned, size, allocationType, protection);
+		if ( ret != nullptr )
+			return ret;
+	}
+}
 
-void* VirtualMemory::AllocateAddressSpace(size_t size)
+void* VirtualMemory::AllocateAddressSpace(size_t size, size_t alignment)
 {
-    void* ret = VirtualAlloc(NULL, size, MEM_RESERVE , PAGE_NOACCESS);
+    void* ret = reserveAligned(size, alignment, MEM_RESERVE , PAGE_NOACCESS);
 	if ( ret != nullptr ) // hopefully, likely branch
 		return ret;
 	else
@@ -165,6 +210,18 @@ void* VirtualMemory::AllocateAddressSpace(size_t size)
 		return ret;
 	}
 }
+
+void* VirtualMemory::AllocateAccessibleAddressSpace(size_t size, size_t alignment)
+{
+	// committed pages are charged against the commit limit, but get physical memory only on first access
+	void* ret = reserveAligned(size, alignment, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if ( ret == nullptr )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "Reserving accessible memory failed for size {} ({:x}), error = {}", size, size, GetLastError() );
+		throw std::bad_alloc();
+	}
+	return ret;
+}
  
 void* VirtualMemory::CommitMemory(void* addr, size_t size)
 {
@@ -192,6 +249,23 @@ void VirtualMemory::DecommitMemory(void* addr, size_t size)
 	}
 }
  
+void VirtualMemory::DiscardMemory(void* addr, size_t size)
+{
+	void* ret = VirtualAlloc(addr, size, MEM_RESET, PAGE_READWRITE);
+	if ( ret == nullptr ) // not critical: memory just remains resident
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "Discarding memory failed for size {} ({:x}) at address 0x{:x}, error = {}", size, size, (size_t)addr, GetLastError() );
+}
+
+void VirtualMemory::DiscardMemoryLazily(void* addr, size_t size)
+{
+	DiscardMemory(addr, size); // MEM_RESET is lazy already
+}
+
+void VirtualMemory::AdviseHugePages(void* addr, size_t size)
+{
+	// no transparent huge pages (large pages require SeLockMemoryPrivilege and are never paged out)
+}
+
 void VirtualMemory::FreeAddressSpace(void* addr, size_t size)
 {
     BOOL ret = VirtualFree((void*)addr, 0, MEM_RELEASE);
@@ -204,3 +278,49 @@ void VirtualMemory::FreeAddressSpace(void* addr, size_t size)
 		return;
 	}
 }
+
+/*static*/
+intptr_t RawFile::open( const char* path )
+{
+	HANDLE h = CreateFileA( path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if ( h == INVALID_HANDLE_VALUE )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "cannot open file {}, error = {}", path, GetLastError() );
+		return -1;
+	}
+	return (intptr_t)h;
+}
+
+/*static*/
+bool RawFile::write( intptr_t file, const char* data, size_t size )
+{
+	while ( size )
+	{
+		DWORD written = 0;
+		if ( !WriteFile( (HANDLE)file, data, (DWORD)size, &written, nullptr ) )
+			return false;
+		data += written;
+		size -= written;
+	}
+	return true;
+}
+
+/*static*/
+void RawFile::close( intptr_t file )
+{
+	CloseHandle( (HANDLE)file );
+}
+
+#ifdef IIBMALLOC_ENABLE_HEAP_PROFILER
+/*static*/
+size_t HeapProfiler::captureStackTrace( void** frames, size_t maxFrames )
+{
+	return CaptureStackBackTrace( 0, (DWORD)maxFrames, frames, nullptr );
+}
+
+/*static*/
+bool HeapProfiler::writeMemoryMap( intptr_t file )
+{
+	return true; // not available; binaries are to be given to pprof explicitly
+}
+#endif // IIBMALLOC_ENABLE_HEAP_PROFILER
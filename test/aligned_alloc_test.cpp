@@ -0,0 +1,204 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: allocations aligned above ALIGNMENT
+ * 
+ * Usage: aligned_alloc.bin
+ * 
+ * Allocates, with allocateAligned(), objects of sizes from a few bytes to
+ * directly mapped chunks at alignments up to 2MB (that is, both ones served by
+ * buckets and ones above PAGE_SIZE, which are placed inside larger chunks of
+ * BulkAllocator), interleaved with ordinary allocations, and checks that:
+ *     returned pointers are aligned, and their usable size covers a request;
+ *     objects do not overlap (each is filled with a pattern that is verified
+ *     before it is freed);
+ *     reallocate() keeps the contents, and deallocating from another thread
+ *     returns an object to its owner;
+ *     chunks are freed as a whole (the same requests again take no new
+ *     mappings).
+ * Each failed check is reported; returns 1 if any.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "test_common.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <random>
+
+size_t failedCnt = 0;
+
+void check( bool ok, const char* what, size_t sz, size_t alignment )
+{
+	if ( ok )
+		return;
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "FAILED: {} (size = {}, alignment = {})", what, sz, alignment );
+	++failedCnt;
+}
+
+struct Object
+{
+	uint8_t* ptr;
+	size_t sz;
+	size_t alignment;
+	uint8_t pattern;
+};
+
+void fill( const Object& obj )
+{
+	memset( obj.ptr, obj.pattern, obj.sz );
+}
+
+bool verify( const Object& obj, size_t sz )
+{
+	for ( size_t i=0; i<sz; ++i )
+		if ( obj.ptr[i] != obj.pattern )
+			return false;
+	return true;
+}
+
+const size_t sizes[] = { 1, 100, PAGE_SIZE, 3 * PAGE_SIZE + 5, 100000, 200000, 3000000 };
+const size_t alignments[] = { 64, PAGE_SIZE, 2 * PAGE_SIZE, 4 * PAGE_SIZE, 64 * 1024, 1024 * 1024, 2 * 1024 * 1024 };
+
+// allocates each size at each alignment, round times, interleaved with ordinary allocations of random sizes
+void allocateAll( IibAllocatorBase<>& heap, std::vector<Object>& objs, std::mt19937& rng, size_t rounds )
+{
+	for ( size_t r=0; r<rounds; ++r )
+		for ( size_t sz : sizes )
+			for ( size_t alignment : alignments )
+			{
+				Object obj;
+				obj.sz = sz;
+				obj.alignment = alignment;
+				obj.pattern = (uint8_t)( objs.size() * 7 + 1 );
+				obj.ptr = reinterpret_cast<uint8_t*>( heap.allocateAligned( sz, alignment ) );
+				check( obj.ptr != nullptr, "allocateAligned() returns nullptr", sz, alignment );
+				if ( obj.ptr == nullptr )
+					continue;
+				check( ( (uintptr_t)(obj.ptr) & ( alignment - 1 ) ) == 0, "a pointer is not aligned", sz, alignment );
+				check( heap.getAllocatedSize( obj.ptr ) >= sz, "usable size is below a requested one", sz, alignment );
+				fill( obj );
+				objs.push_back( obj );
+
+				Object plain;
+				plain.sz = 1 + rng() % ( 3 * PAGE_SIZE );
+				plain.alignment = 0;
+				plain.pattern = (uint8_t)( objs.size() * 7 + 1 );
+				plain.ptr = reinterpret_cast<uint8_t*>( heap.allocate( plain.sz ) );
+				fill( plain );
+				objs.push_back( plain );
+			}
+}
+
+void deallocateAll( IibAllocatorBase<>& heap, std::vector<Object>& objs )
+{
+	for ( const Object& obj : objs )
+	{
+		check( verify( obj, obj.sz ), "an object is overwritten", obj.sz, obj.alignment );
+		heap.deallocate( obj.ptr );
+	}
+	objs.clear();
+}
+
+void testAllocation()
+{
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+	std::mt19937 rng( 17 );
+	std::vector<Object> objs;
+
+	allocateAll( *heap, objs, rng, 1 );
+	std::shuffle( objs.begin(), objs.end(), rng );
+	deallocateAll( *heap, objs );
+
+	// chunks are freed as a whole (at their real starts), so that the same requests again are served from freed memory
+	rng.seed( 17 );
+	uint64_t allocCount = heap->getBulkStats().sysAllocCount;
+	allocateAll( *heap, objs, rng, 1 );
+	check( heap->getBulkStats().sysAllocCount == allocCount, "freed memory is not reused", 0, 0 );
+	deallocateAll( *heap, objs );
+}
+
+void testReallocation()
+{
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+	for ( size_t alignment : alignments )
+		for ( size_t sz : sizes )
+		{
+			Object obj = { reinterpret_cast<uint8_t*>( heap->allocateAligned( sz, alignment ) ), sz, alignment, 0x5A };
+			fill( obj );
+			for ( size_t newSz : { sz / 2 + 1, sz * 3 } )
+			{
+				obj.ptr = reinterpret_cast<uint8_t*>( heap->reallocate( obj.ptr, newSz ) );
+				check( verify( obj, newSz < obj.sz ? newSz : obj.sz ), "reallocate() loses contents", sz, alignment );
+				obj.sz = newSz;
+				fill( obj );
+			}
+			heap->deallocate( obj.ptr );
+		}
+}
+
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+void testForeignDeallocation()
+{
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+	std::mt19937 rng( 23 );
+	std::vector<Object> objs;
+	allocateAll( *heap, objs, rng, 1 );
+	std::thread other( [&objs]() {
+		IibAllocatorBase<> otherHeap;
+		for ( const Object& obj : objs )
+		{
+			check( verify( obj, obj.sz ), "an object is overwritten", obj.sz, obj.alignment );
+			otherHeap.deallocate( obj.ptr );
+		}
+	} );
+	other.join();
+	objs.clear();
+	heap->drainRemoteFrees();
+	allocateAll( *heap, objs, rng, 1 );
+	deallocateAll( *heap, objs );
+}
+#endif
+
+int main()
+{
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	testAllocation();
+	testReallocation();
+	testForeignDeallocation();
+#else
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "large aligned allocations need IIBMALLOC_ENABLE_CROSS_THREAD_FREE; nothing to check" );
+#endif
+
+	if ( failedCnt != 0 )
+		return 1;
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "all checks passed" );
+	return 0;
+}
@@ -0,0 +1,111 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * Per-thread bucket allocator: batch allocation/deallocation vs. one-by-one
+ * 
+ * For each (size, batch size) pair, the same number of objects is allocated
+ * and then deallocated in batches, first with allocate()/deallocate() called
+ * per object, then with allocateBatch()/deallocateBatch(); per-object cost
+ * (in rdtsc ticks) is reported for both.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "test_common.h"
+
+#include <memory>
+#include <stdio.h>
+
+#ifdef NODECPP_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+constexpr size_t objectsPerRound = 1 << 22;
+constexpr size_t roundCnt = 8;
+
+NODECPP_NOINLINE uint64_t runOneByOne( size_t sz, size_t batchSz, void** ptrs )
+{
+	uint64_t start = __rdtsc();
+	for ( size_t r=0; r<roundCnt; ++r )
+		for ( size_t j=0; j<objectsPerRound; j+=batchSz )
+		{
+			for ( size_t i=0; i<batchSz; ++i )
+			{
+				ptrs[i] = g_AllocManager.allocate( sz );
+				*reinterpret_cast<uint8_t*>(ptrs[i]) = (uint8_t)i;
+			}
+			for ( size_t i=0; i<batchSz; ++i )
+				g_AllocManager.deallocate( ptrs[i] );
+		}
+	return __rdtsc() - start;
+}
+
+NODECPP_NOINLINE uint64_t runBatch( size_t sz, size_t batchSz, void** ptrs )
+{
+	uint64_t start = __rdtsc();
+	for ( size_t r=0; r<roundCnt; ++r )
+		for ( size_t j=0; j<objectsPerRound; j+=batchSz )
+		{
+			g_AllocManager.allocateBatch( sz, batchSz, ptrs );
+			for ( size_t i=0; i<batchSz; ++i )
+				*reinterpret_cast<uint8_t*>(ptrs[i]) = (uint8_t)i;
+			g_AllocManager.deallocateBatch( ptrs, batchSz );
+		}
+	return __rdtsc() - start;
+}
+
+int main()
+{
+	const size_t sizes[] = { 16, 64, 256, 1024 };
+	const size_t batchSizes[] = { 4, 16, 64, 256, 1024 };
+	constexpr size_t maxBatchSz = 1024;
+	void** ptrs = new void* [maxBatchSz];
+
+	g_AllocManager.initialize();
+	g_AllocManager.enable();
+
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "size,batch,one-by-one (ticks/object),batch (ticks/object),speedup" );
+	for ( size_t sz : sizes )
+		for ( size_t batchSz : batchSizes )
+		{
+			runOneByOne( sz, batchSz, ptrs ); // warming up (buckets get enough pages)
+			uint64_t oneByOne = runOneByOne( sz, batchSz, ptrs );
+			runBatch( sz, batchSz, ptrs );
+			uint64_t batch = runBatch( sz, batchSz, ptrs );
+			double perObjOneByOne = oneByOne * 1. / ( objectsPerRound * roundCnt );
+			double perObjBatch = batch * 1. / ( objectsPerRound * roundCnt );
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{},{},{:.2f},{:.2f},{:.2f}", sz, batchSz, perObjOneByOne, perObjBatch, perObjOneByOne / perObjBatch );
+		}
+
+	g_AllocManager.deinitialize();
+	g_AllocManager.disable();
+	delete [] ptrs;
+
+	return 0;
+}
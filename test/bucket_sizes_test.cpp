@@ -0,0 +1,197 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: bucket size schemas compared
+ * 
+ * Usage: bucket_sizes.bin [operation count (default: 4M)]
+ * 
+ * Heaps with each of bucket size schemas (ExpBucketSizes, HalfExpBucketSizes,
+ * QuarterExpBucketSizes) are created side by side in the same thread, and run
+ * the same sequence of allocations and deallocations (random replacement of
+ * objects with the size distribution of randomPos_RandomSize(), all sizes being
+ * served by buckets; with USE_PROFILED_BUCKET_SIZES, ProfiledBucketSizes generated
+ * by size_class_gen.cpp as well). For each schema, the following is reported:
+ *     number of buckets in use;
+ *     ops/sec;
+ *     internal fragmentation: share of bytes of bucket items that exceeds
+ *                             requested sizes, over live objects (average of
+ *                             samples taken every 10000 operations, and at
+ *                             the end of a run);
+ *     peak RSS growth.
+ * Before that, each schema is checked to map every size to a bucket of the
+ * smallest fitting size, with the same result at runtime and at compile time;
+ * with IIBMALLOC_ENABLE_CROSS_THREAD_FREE, heaps of different schemas are
+ * checked to tell usable sizes of, and to reallocate, items of each other.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+
+#include <memory>
+#include <stdio.h>
+
+thread_local unsigned long long rnd_seed = 0;
+
+constexpr size_t max_items = 1 << 16;
+constexpr size_t max_item_size_exp = 13; // sizes up to 8K
+constexpr size_t sampling_period = 10000;
+
+struct SchemaRes
+{
+	const char* name;
+	size_t bucketCount;
+	size_t dur; // ms
+	double opsPerSec;
+	double avgFragmentation;
+	double finalFragmentation;
+	size_t peakRssGrowth;
+};
+
+template<class HeapT>
+bool checkSchema( const char* name )
+{
+	bool ok = true;
+	for ( size_t sz=1; sz<=HeapT::maxBucketSize(); ++sz )
+	{
+		uint8_t szidx = HeapT::sizeToIndex( sz );
+		if ( szidx != HeapT::sizeToIndexAtCompileTime( sz ) || HeapT::indexToBucketSize( szidx ) < sz || ( szidx != 0 && HeapT::indexToBucketSize( szidx - 1 ) >= sz && HeapT::indexToBucketSize( szidx - 1 ) < HeapT::indexToBucketSize( szidx ) ) )
+		{
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "{}: size {} is mapped to bucket {} of size {}", name, sz, (size_t)szidx, HeapT::indexToBucketSize( szidx ) );
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+template<class OwnerT, class OtherT>
+bool checkForeignSizes( const char* name )
+{
+	bool ok = true;
+	std::unique_ptr<OwnerT> owner( new OwnerT );
+	std::unique_ptr<OtherT> other( new OtherT );
+	for ( size_t sz=1; sz<=OwnerT::maxBucketSize(); sz+=7 )
+	{
+		uint8_t* ptr = reinterpret_cast<uint8_t*>( owner->allocate( sz ) );
+		size_t usable = other->getAllocatedSize( ptr );
+		if ( usable != owner->getAllocatedSize( ptr ) )
+		{
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "{}: usable size of {} is {} for another heap, {} for its owner", name, sz, usable, owner->getAllocatedSize( ptr ) );
+			ok = false;
+		}
+		memset( ptr, 0x5A, usable );
+		ptr = reinterpret_cast<uint8_t*>( other->reallocate( ptr, usable + 1 ) ); // all of usable bytes are copied
+		for ( size_t i=0; i<usable; ++i )
+			if ( ptr[i] != 0x5A )
+			{
+				nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "{}: reallocation of {} by another heap loses byte {} of {}", name, sz, i, usable );
+				ok = false;
+				break;
+			}
+		other->deallocate( ptr );
+	}
+	owner->drainRemoteFrees();
+	return ok;
+}
+#endif
+
+template<class HeapT>
+void runSchema( const char* name, size_t opCount, SchemaRes& res )
+{
+	ResetPeakResidentSetSize();
+	size_t rssBefore = GetResidentSetSize();
+	std::unique_ptr<HeapT> heap( new HeapT );
+
+	RandomChurn<HeapT> churn( max_items, max_item_size_exp );
+	size_t requested = 0;
+	size_t used = 0; // by bucket items
+	double fragmentationSum = 0;
+	size_t sampleCnt = 0;
+	size_t start = GetMillisecondCount();
+	churn.run( *heap, opCount, 0, [&]( size_t i, size_t allocatedSz, size_t freedSz ) { // seed 0: the same sequence for all schemas
+		if ( allocatedSz )
+		{
+			requested += allocatedSz;
+			used += HeapT::indexToBucketSize( HeapT::sizeToIndex( allocatedSz ) );
+		}
+		else
+		{
+			requested -= freedSz;
+			used -= HeapT::indexToBucketSize( HeapT::sizeToIndex( freedSz ) );
+		}
+		if ( i % sampling_period == sampling_period - 1 && used != 0 )
+		{
+			fragmentationSum += 1. - requested * 1. / used;
+			++sampleCnt;
+		}
+	} );
+	res.dur = GetMillisecondCount() - start;
+	size_t peakRss = GetPeakResidentSetSize();
+
+	res.name = name;
+	res.bucketCount = HeapT::sizeToIndexAtCompileTime( HeapT::maxBucketSize() ) + 1;
+	res.opsPerSec = res.dur ? opCount * 1000. / res.dur : 0;
+	res.avgFragmentation = sampleCnt ? fragmentationSum / sampleCnt : 0;
+	res.finalFragmentation = used ? 1. - requested * 1. / used : 0;
+	res.peakRssGrowth = peakRss > rssBefore ? peakRss - rssBefore : 0;
+
+	churn.clear( *heap );
+}
+
+int main( int argc, char** argv )
+{
+	size_t opCount = argc > 1 ? strtoull( argv[1], nullptr, 10 ) : 1 << 22;
+
+	bool ok = checkSchema<IibAllocatorBase<ExpBucketSizes>>( "exp" );
+	ok = checkSchema<IibAllocatorBase<HalfExpBucketSizes>>( "half-exp" ) && ok;
+	ok = checkSchema<IibAllocatorBase<QuarterExpBucketSizes>>( "quarter-exp" ) && ok;
+#ifdef USE_PROFILED_BUCKET_SIZES
+	ok = checkSchema<IibAllocatorBase<ProfiledBucketSizes>>( "profiled" ) && ok;
+#endif
+#ifdef IIBMALLOC_ENABLE_CROSS_THREAD_FREE
+	ok = checkForeignSizes<IibAllocatorBase<QuarterExpBucketSizes>, IibAllocatorBase<ExpBucketSizes>>( "quarter-exp by exp" ) && ok;
+	ok = checkForeignSizes<IibAllocatorBase<ExpBucketSizes>, IibAllocatorBase<QuarterExpBucketSizes>>( "exp by quarter-exp" ) && ok;
+#endif
+	if ( !ok )
+		return 1;
+
+	SchemaRes res[4];
+	size_t schemaCnt = 0;
+	runSchema<IibAllocatorBase<ExpBucketSizes>>( "exp", opCount, res[schemaCnt++] );
+	runSchema<IibAllocatorBase<HalfExpBucketSizes>>( "half-exp", opCount, res[schemaCnt++] );
+	runSchema<IibAllocatorBase<QuarterExpBucketSizes>>( "quarter-exp", opCount, res[schemaCnt++] );
+#ifdef USE_PROFILED_BUCKET_SIZES
+	runSchema<IibAllocatorBase<ProfiledBucketSizes>>( "profiled", opCount, res[schemaCnt++] );
+#endif
+
+	for ( size_t i=0; i<schemaCnt; ++i )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {} buckets, {} ops in {} ms ({:.0f} ops/sec), internal fragmentation {:.2f}% (at exit: {:.2f}%), peak RSS growth {} KB", res[i].name, res[i].bucketCount, opCount, res[i].dur, res[i].opsPerSec, res[i].avgFragmentation * 100, res[i].finalFragmentation * 100, res[i].peakRssGrowth >> 10 );
+
+	return 0;
+}
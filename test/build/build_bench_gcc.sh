@@ -0,0 +1,14 @@
+g++ ../test_common.cpp ../batch_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -O2 -flto -lpthread -o batch.bin
+g++ ../test_common.cpp ../static_size_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -O2 -flto -lpthread -o static_size.bin
+g++ ../test_common.cpp ../trace_replay.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_CROSS_THREAD_FREE -O2 -flto -lpthread -o trace_replay.bin
+g++ ../test_common.cpp ../scaling_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_CROSS_THREAD_FREE -O2 -flto -lpthread -o scaling.bin
+g++ ../test_common.cpp ../bucket_sizes_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_CROSS_THREAD_FREE -O2 -flto -lpthread -o bucket_sizes.bin
+g++ ../test_common.cpp ../size_class_gen.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -O2 -flto -lpthread -o size_class_gen.bin
+g++ ../test_common.cpp ../commit_mode_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -O2 -flto -lpthread -o commit_mode.bin
+g++ ../test_common.cpp ../direct_chunk_cache_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_CROSS_THREAD_FREE -O2 -flto -lpthread -o direct_chunk_cache.bin
+g++ ../test_common.cpp ../huge_pages_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -O2 -flto -lpthread -o huge_pages.bin
+g++ ../test_common.cpp ../huge_pages_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_HUGE_PAGES -O2 -flto -lpthread -o huge_pages_thp.bin
+g++ ../test_common.cpp ../random_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_CROSS_THREAD_FREE -DIIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS -O2 -flto -lpthread -o alloc_page_aligned.bin
+
+g++ ../test_common.cpp ../aligned_alloc_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_CROSS_THREAD_FREE -O2 -flto -lpthread -o aligned_alloc.bin
+g++ ../test_common.cpp ../page_cache_test.cpp ../../src/page_allocator_linux.cpp ../../src/iibmalloc_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -O2 -flto -lpthread -o page_cache.bin
\ No newline at end of file
@@ -0,0 +1,2 @@
+g++ ../../src/iibmalloc_preload_linux.cpp ../../src/page_allocator_linux.cpp ../../src/foundation/src/log.cpp ../../src/foundation/3rdparty/fmt/src/format.cc -I../../src/foundation/3rdparty/fmt/include -I../../src/foundation/include -I../../src -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -DIIBMALLOC_ENABLE_CROSS_THREAD_FREE -O2 -fPIC -shared -lpthread -ldl -o libiibmalloc.so
+g++ ../preload_limits_test.cpp -std=c++17 -g -Wall -Wextra -Wno-unused-variable -Wno-unused-parameter -Wno-empty-body -DNDEBUG -O2 -o preload_limits.bin
@@ -0,0 +1,133 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: commit modes compared
+ * 
+ * Usage: commit_mode.bin [operation count per thread (default: 4M)] [thread count (default: 4)]
+ * 
+ * Each thread runs random replacement of objects with the size distribution of
+ * randomPos_RandomSize() (all sizes being served by buckets, so that pages of
+ * all buckets are committed over time) with its own heap; the same sequence is
+ * run with heaps in CommitMode::remap and in CommitMode::demandPaging. For each
+ * mode, the following is reported:
+ *     ops/sec (over all threads);
+ *     number of commits (syscalls with CommitMode::remap, none otherwise) and
+ *     of reservations;
+ *     peak growth of the number of mappings (VMAs) of the process, that is
+ *     what is limited by vm.max_map_count (sampled every 10000 operations
+ *     by the first thread);
+ *     peak RSS growth.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdio.h>
+
+thread_local unsigned long long rnd_seed = 0;
+
+constexpr size_t max_items = 1 << 16;
+constexpr size_t max_item_size_exp = 13; // sizes up to 8K
+constexpr size_t sampling_period = 10000;
+
+struct ModeRes
+{
+	const char* name;
+	size_t dur; // ms
+	double opsPerSec;
+	std::atomic<uint64_t> commitCount;
+	std::atomic<uint64_t> reservationCount;
+	size_t peakMappingGrowth;
+	size_t peakRssGrowth;
+};
+
+void runThread( CommitMode mode, size_t opCount, size_t threadIdx, size_t mappingsBefore, ModeRes* res )
+{
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+	heap->setCommitMode( mode );
+
+	RandomChurn<IibAllocatorBase<>> churn( max_items, max_item_size_exp );
+	// seeded by a thread index: the same sequences for both modes
+	churn.run( *heap, opCount, threadIdx, [&]( size_t i, size_t, size_t ) {
+		if ( threadIdx == 0 && i % sampling_period == sampling_period - 1 )
+		{
+			size_t mappings = GetMappingCount();
+			if ( mappings > mappingsBefore && mappings - mappingsBefore > res->peakMappingGrowth )
+				res->peakMappingGrowth = mappings - mappingsBefore;
+		}
+	} );
+	res->commitCount += heap->getStats().sysCommitCount;
+	res->reservationCount += heap->getStats().sysAllocCount;
+
+	churn.clear( *heap );
+}
+
+void runMode( const char* name, CommitMode mode, size_t opCount, size_t threadCount, ModeRes& res )
+{
+	res.name = name;
+	res.commitCount = 0;
+	res.reservationCount = 0;
+	res.peakMappingGrowth = 0;
+	ResetPeakResidentSetSize();
+	size_t rssBefore = GetResidentSetSize();
+	size_t mappingsBefore = GetMappingCount();
+
+	std::vector<std::thread> threads( threadCount );
+	size_t start = GetMillisecondCount();
+	for ( size_t i=0; i<threadCount; ++i )
+		threads[i] = std::thread( runThread, mode, opCount, i, mappingsBefore, &res );
+	for ( size_t i=0; i<threadCount; ++i )
+		threads[i].join();
+	res.dur = GetMillisecondCount() - start;
+
+	size_t peakRss = GetPeakResidentSetSize();
+	res.opsPerSec = res.dur ? opCount * threadCount * 1000. / res.dur : 0;
+	res.peakRssGrowth = peakRss > rssBefore ? peakRss - rssBefore : 0;
+}
+
+int main( int argc, char** argv )
+{
+	size_t opCount = argc > 1 ? strtoull( argv[1], nullptr, 10 ) : 1 << 22;
+	size_t threadCount = argc > 2 ? strtoull( argv[2], nullptr, 10 ) : 4;
+	if ( threadCount == 0 )
+		threadCount = 1;
+
+	ModeRes res[2];
+	runMode( "remap", CommitMode::remap, opCount, threadCount, res[0] );
+	runMode( "demand paging", CommitMode::demandPaging, opCount, threadCount, res[1] );
+
+	for ( size_t i=0; i<2; ++i )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {} threads, {} ms ({:.0f} ops/sec), {} commits, {} reservations, peak mapping count growth {}, peak RSS growth {} KB", res[i].name, threadCount, res[i].dur, res[i].opsPerSec, res[i].commitCount.load(), res[i].reservationCount.load(), res[i].peakMappingGrowth, res[i].peakRssGrowth >> 10 );
+
+	return 0;
+}
@@ -0,0 +1,198 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: cache of chunks allocated directly from OS
+ * 
+ * Usage: direct_chunk_cache.bin
+ * 
+ * Frees and allocates chunks above BulkAllocator's max_pages and checks, by
+ * syscalls counted in getBulkStats(), that:
+ *     a freed mapping is reused by an allocation of the same size;
+ *     a freed mapping of the same size class is reused with mremap() when it
+ *     is larger (and, unless IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS is
+ *     defined, when it is smaller);
+ *     the least recently cached mappings are unmapped as soon as the cache
+ *     exceeds DirectChunkCacheLimits::maxBytes;
+ *     mappings older than DirectChunkCacheLimits::maxAgeNs are unmapped by a
+ *     next allocation.
+ * Each failed check is reported; returns 1 if any.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "test_common.h"
+
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+
+struct SysCounts
+{
+	uint64_t allocCount;
+	uint64_t allocSize;
+	uint64_t deallocCount;
+	uint64_t deallocSize;
+
+	explicit SysCounts( const IibAllocatorBase<>& heap )
+	{
+		const BlockStats& st = heap.getBulkStats();
+		allocCount = st.sysAllocCount;
+		allocSize = st.sysAllocSize;
+		deallocCount = st.sysDeallocCount;
+		deallocSize = st.sysDeallocSize;
+	}
+	SysCounts operator - ( const SysCounts& other ) const
+	{
+		SysCounts ret = *this;
+		ret.allocCount -= other.allocCount;
+		ret.allocSize -= other.allocSize;
+		ret.deallocCount -= other.deallocCount;
+		ret.deallocSize -= other.deallocSize;
+		return ret;
+	}
+};
+
+size_t failedCnt = 0;
+
+void check( bool ok, const char* what )
+{
+	if ( ok )
+		return;
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "FAILED: {}", what );
+	++failedCnt;
+}
+
+// requests a chunk of pageCnt pages (with its header, but for a header page, if any)
+void* allocatePages( IibAllocatorBase<>& heap, size_t pageCnt )
+{
+	void* ret = heap.allocate( ( pageCnt << PAGE_SIZE_EXP ) - PAGE_SIZE / 2 );
+	memset( ret, 0xAA, PAGE_SIZE ); // as well as in pages after the first one of a cached mapping, writes cancel lazy discarding
+	return ret;
+}
+
+void testReuse()
+{
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+
+	SysCounts start( *heap );
+	void* ptr = allocatePages( *heap, 256 ); // sizes of 225 to 256 pages are of the same size class
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+	size_t mappedSize = ( SysCounts( *heap ) - start ).allocSize; // includes extra pages for alignment
+#endif
+	heap->deallocate( ptr );
+
+	start = SysCounts( *heap );
+	void* same = allocatePages( *heap, 256 );
+	SysCounts d = SysCounts( *heap ) - start;
+	check( same == ptr && d.allocCount == 0 && d.deallocCount == 0, "a mapping of the same size is reused without syscalls" );
+	heap->deallocate( same );
+
+	start = SysCounts( *heap );
+	void* smaller = allocatePages( *heap, 232 );
+	d = SysCounts( *heap ) - start;
+	check( smaller == ptr && d.allocCount == 0 && d.deallocCount == 1 && d.deallocSize == ( 24 << PAGE_SIZE_EXP ), "a larger mapping is shrunk in place" );
+	heap->deallocate( smaller );
+
+	start = SysCounts( *heap );
+	void* larger = allocatePages( *heap, 250 );
+	d = SysCounts( *heap ) - start;
+#ifdef IIBMALLOC_ENABLE_PAGE_ALIGNED_LARGE_OBJECTS
+	check( d.allocCount == 1 && d.allocSize == mappedSize - ( 6 << PAGE_SIZE_EXP ) && d.deallocCount == 0, "a smaller mapping is not grown (it might move and lose its alignment)" );
+#else
+	check( d.allocCount == 1 && d.allocSize == ( 18 << PAGE_SIZE_EXP ) && d.deallocCount == 0, "a smaller mapping is grown with mremap()" );
+#endif
+	heap->deallocate( larger );
+}
+
+void testEvictionByBytes()
+{
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+	constexpr size_t cnt = 4;
+	void* ptrs[cnt];
+
+	SysCounts start( *heap );
+	for ( size_t i=0; i<cnt; ++i )
+		ptrs[i] = allocatePages( *heap, 256 );
+	size_t mappedSize = ( SysCounts( *heap ) - start ).allocSize / cnt;
+
+	DirectChunkCacheLimits::maxBytes = mappedSize * ( cnt - 1 );
+	start = SysCounts( *heap );
+	for ( size_t i=0; i<cnt; ++i )
+		heap->deallocate( ptrs[i] );
+	SysCounts d = SysCounts( *heap ) - start;
+	check( d.deallocCount == 1 && d.deallocSize == mappedSize, "a mapping over maxBytes is unmapped on caching" );
+
+	start = SysCounts( *heap );
+	void* reused[cnt - 1];
+	for ( size_t i=0; i<cnt - 1; ++i )
+		reused[i] = allocatePages( *heap, 256 );
+	d = SysCounts( *heap ) - start;
+	bool allRecent = true;
+	for ( size_t i=1; i<cnt; ++i )
+		allRecent = allRecent && std::find( reused, reused + cnt - 1, ptrs[i] ) != reused + cnt - 1;
+	check( d.allocCount == 0 && allRecent, "the least recently cached mapping is the one unmapped" );
+	for ( size_t i=0; i<cnt - 1; ++i )
+		heap->deallocate( reused[i] );
+}
+
+void testEvictionByAge()
+{
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+
+	SysCounts start( *heap );
+	void* ptr = allocatePages( *heap, 256 );
+	size_t mappedSize = ( SysCounts( *heap ) - start ).allocSize;
+	DirectChunkCacheLimits::maxAgeNs = 50000000;
+	heap->deallocate( ptr );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+
+	start = SysCounts( *heap );
+	void* other = allocatePages( *heap, 512 ); // of another size class
+	SysCounts d = SysCounts( *heap ) - start;
+	check( d.deallocCount == 1 && d.deallocSize == mappedSize, "an expired mapping is unmapped by a next allocation" );
+	heap->deallocate( other );
+}
+
+int main()
+{
+	size_t defaultMaxBytes = DirectChunkCacheLimits::maxBytes;
+	uint64_t defaultMaxAgeNs = DirectChunkCacheLimits::maxAgeNs;
+
+	testReuse();
+	testEvictionByBytes();
+	DirectChunkCacheLimits::maxBytes = defaultMaxBytes;
+	testEvictionByAge();
+	DirectChunkCacheLimits::maxAgeNs = defaultMaxAgeNs;
+
+	if ( failedCnt != 0 )
+		return 1;
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "all checks passed" );
+	return 0;
+}
@@ -0,0 +1,180 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: memory footprint over time for benchmarks
+ * 
+ * While a benchmark runs, FootprintSampler wakes up every few milliseconds and
+ * records resident memory (/proc/self/statm), resident anonymous memory
+ * (/proc/self/smaps_rollup), the number of VMAs (/proc/self/maps), and the
+ * number of bytes that benchmark threads have requested and not freed yet
+ * (LiveBytesCounter's). Anonymous memory over live bytes is reported as
+ * a committed-to-used ratio.
+ * 
+ * Sampling affects timings of a benchmark, so it is opt-in: random_test.cpp
+ * and scaling_test.cpp take a sampling interval on their command lines.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#ifndef ALLOCATOR_TEST_FOOTPRINT_SAMPLER_H
+#define ALLOCATOR_TEST_FOOTPRINT_SAMPLER_H
+
+#include "test_common.h"
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+// bytes requested and not freed yet by a thread; it may go negative if a thread frees objects of others.
+// Is updated by its thread only, and is read by a sampler
+struct alignas(64) LiveBytesCounter
+{
+	std::atomic<int64_t> bytes = 0;
+
+	NODECPP_FORCEINLINE void add( size_t sz ) { bytes.store( bytes.load( std::memory_order_relaxed ) + (int64_t)sz, std::memory_order_relaxed ); }
+	NODECPP_FORCEINLINE void sub( size_t sz ) { bytes.store( bytes.load( std::memory_order_relaxed ) - (int64_t)sz, std::memory_order_relaxed ); }
+	void reset() { bytes.store( 0, std::memory_order_relaxed ); }
+};
+
+struct FootprintSample
+{
+	size_t time; // ms since start
+	size_t rss;
+	size_t anonymous;
+	size_t mappingCount;
+	int64_t liveBytes;
+};
+
+struct FootprintSummary
+{
+	size_t sampleCount = 0;
+	size_t baselineRss = 0; // at start(); previous runs within the same process may leave something behind
+	size_t peakRss = 0; // over samples (VmHWM catches peaks between samples)
+	size_t steadyRss = 0; // average over the second half of a run
+	size_t peakMappingCount = 0;
+	double committedToUsed = 0; // anonymous memory growth / live bytes, average over the second half of a run
+};
+
+class FootprintSampler
+{
+	std::vector<FootprintSample> samples;
+	const LiveBytesCounter* counters = nullptr;
+	size_t counterCount = 0;
+	size_t intervalMs = 0;
+	size_t anonymousBaseline = 0;
+	size_t rssBaseline = 0;
+	size_t startTime = 0;
+	std::atomic<bool> stopRequested = false;
+	std::thread thread;
+
+	void takeSample()
+	{
+		FootprintSample sample;
+		sample.time = GetMillisecondCount() - startTime;
+		sample.rss = GetResidentSetSize();
+		sample.anonymous = GetAnonymousMemorySize();
+		sample.mappingCount = GetMappingCount();
+		sample.liveBytes = 0;
+		for ( size_t i=0; i<counterCount; ++i )
+			sample.liveBytes += counters[i].bytes.load( std::memory_order_relaxed );
+		samples.push_back( sample );
+	}
+
+	void run()
+	{
+		while ( !stopRequested.load() )
+		{
+			takeSample();
+			std::this_thread::sleep_for( std::chrono::milliseconds( intervalMs ) );
+		}
+	}
+
+public:
+	// counters: of all threads of a benchmark, valid until stop()
+	void start( const LiveBytesCounter* counters_, size_t counterCount_, size_t intervalMs_ )
+	{
+		counters = counters_;
+		counterCount = counterCount_;
+		intervalMs = intervalMs_;
+		samples.clear();
+		samples.reserve( 1024 );
+		anonymousBaseline = GetAnonymousMemorySize();
+		rssBaseline = GetResidentSetSize();
+		startTime = GetMillisecondCount();
+		stopRequested = false;
+		thread = std::thread( &FootprintSampler::run, this );
+	}
+
+	void stop()
+	{
+		stopRequested = true;
+		thread.join();
+		takeSample();
+	}
+
+	const std::vector<FootprintSample>& getSamples() const { return samples; }
+
+	FootprintSummary getSummary() const
+	{
+		FootprintSummary summary;
+		summary.sampleCount = samples.size();
+		summary.baselineRss = rssBaseline;
+		if ( samples.empty() )
+			return summary;
+		size_t steadyCnt = 0;
+		size_t ratioCnt = 0;
+		double ratioSum = 0;
+		for ( size_t i=0; i<samples.size(); ++i )
+		{
+			const FootprintSample& sample = samples[i];
+			if ( sample.rss > summary.peakRss )
+				summary.peakRss = sample.rss;
+			if ( sample.mappingCount > summary.peakMappingCount )
+				summary.peakMappingCount = sample.mappingCount;
+			if ( i < samples.size() / 2 || i + 1 == samples.size() ) // warming up; the last sample is taken after threads exit
+				continue;
+			summary.steadyRss += sample.rss;
+			++steadyCnt;
+			if ( sample.liveBytes > 0 && sample.anonymous > anonymousBaseline )
+			{
+				ratioSum += ( sample.anonymous - anonymousBaseline ) * 1. / sample.liveBytes;
+				++ratioCnt;
+			}
+		}
+		if ( steadyCnt )
+			summary.steadyRss /= steadyCnt;
+		else
+			summary.steadyRss = samples.back().rss;
+		if ( ratioCnt )
+			summary.committedToUsed = ratioSum / ratioCnt;
+		return summary;
+	}
+};
+
+#endif // ALLOCATOR_TEST_FOOTPRINT_SAMPLER_H
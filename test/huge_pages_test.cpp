@@ -0,0 +1,142 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: transparent huge pages
+ * 
+ * Usage: huge_pages.bin [live object count (default: 8M)] [operation count (default: 32M)]
+ * 
+ * To be built twice, with and without -DIIBMALLOC_ENABLE_HUGE_PAGES (see
+ * build_bench_gcc.sh), and the two runs compared. A heap is filled with small
+ * objects (sizes of randomPos_RandomSize() up to 256 bytes, that is, a few hot
+ * buckets), then each operation reads and writes a random object, and each 8th
+ * one replaces it with a new object of a random size. Reported:
+ *     ops/sec of the second phase;
+ *     dTLB misses and page faults of each phase (where perf_event_open() is
+ *     available, see perf_counters.h);
+ *     AnonHugePages of the process at the end of the second phase (Linux).
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+
+#include <memory>
+#include <stdio.h>
+
+thread_local unsigned long long rnd_seed = 0;
+
+constexpr size_t max_item_size_exp = 8;
+constexpr size_t replacement_period = 8;
+
+size_t GetAnonHugePagesSize()
+{
+#ifdef NODECPP_MSVC
+	return 0;
+#else
+	FILE* f = fopen( "/proc/self/smaps", "r" );
+	if ( f == nullptr )
+		return 0;
+	char buff[512];
+	size_t total = 0;
+	while ( fgets( buff, sizeof( buff ), f ) )
+	{
+		size_t kb;
+		if ( sscanf( buff, "AnonHugePages: %zu kB", &kb ) == 1 )
+			total += kb;
+	}
+	fclose( f );
+	return total << 10;
+#endif
+}
+
+void printPhase( const char* name, const PerfCounterValues& begin, const PerfCounterValues& end, const PerfCounterValues& readEvents )
+{
+	uint32_t mask = begin.availableMask & end.availableMask;
+	if ( mask & ( 1 << PERF_DTLB_MISSES ) )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {}: {}", name, perfCounterNames[PERF_DTLB_MISSES], perfCounterDelta( begin, end, readEvents, PERF_DTLB_MISSES ) );
+	if ( mask & ( 1 << PERF_PAGE_FAULTS ) )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {}: {}", name, perfCounterNames[PERF_PAGE_FAULTS], perfCounterDelta( begin, end, readEvents, PERF_PAGE_FAULTS ) );
+}
+
+int main( int argc, char** argv )
+{
+	size_t objCount = argc > 1 ? strtoull( argv[1], nullptr, 10 ) : 1 << 23;
+	size_t opCount = argc > 2 ? strtoull( argv[2], nullptr, 10 ) : 1 << 25;
+	if ( objCount == 0 )
+		objCount = 1;
+
+#ifdef IIBMALLOC_ENABLE_HUGE_PAGES
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "IIBMALLOC_ENABLE_HUGE_PAGES is defined" );
+#else
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "IIBMALLOC_ENABLE_HUGE_PAGES is not defined" );
+#endif
+
+	std::unique_ptr<uint8_t*[]> objs( new uint8_t* [ objCount ] );
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+	PerfCounters perf;
+	perf.open();
+	PerfCounterValues perfBegin, perfFilled, perfEnd;
+	perf.read( perfBegin );
+
+	size_t start = GetMillisecondCount();
+	for ( size_t i=0; i<objCount; ++i )
+	{
+		size_t sz = calcSizeWithStatsAdjustment( rng64(), max_item_size_exp );
+		objs[i] = reinterpret_cast<uint8_t*>( heap->allocate( sz ) );
+		objs[i][0] = (uint8_t)sz;
+	}
+	perf.read( perfFilled ); // before a timestamp, so that a read is counted in the phase it ends
+	size_t filled = GetMillisecondCount();
+
+	size_t checksum = 0;
+	for ( size_t i=0; i<opCount; ++i )
+	{
+		size_t idx = rng64() % objCount;
+		checksum += objs[idx][0];
+		if ( i % replacement_period == replacement_period - 1 )
+		{
+			heap->deallocate( objs[idx] );
+			size_t sz = calcSizeWithStatsAdjustment( rng64(), max_item_size_exp );
+			objs[idx] = reinterpret_cast<uint8_t*>( heap->allocate( sz ) );
+			objs[idx][0] = (uint8_t)sz;
+		}
+		else
+			++( objs[idx][0] );
+	}
+	perf.read( perfEnd );
+	size_t end = GetMillisecondCount();
+	size_t hugePagesSize = GetAnonHugePagesSize();
+
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} objects allocated in {} ms; {} ops in {} ms ({:.0f} ops/sec); AnonHugePages {} KB (checksum {})", objCount, filled - start, opCount, end - filled, end > filled ? opCount * 1000. / ( end - filled ) : 0., hugePagesSize >> 10, checksum );
+	printPhase( "filling", perfBegin, perfFilled, perf.getReadEvents() );
+	printPhase( "random access", perfFilled, perfEnd, perf.getReadEvents() );
+
+	for ( size_t i=0; i<objCount; ++i )
+		heap->deallocate( objs[i] );
+	return 0;
+}
@@ -0,0 +1,145 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: latency histogram for benchmarks
+ * 
+ * Log-bucketed (HDR-style) histogram: values below 64 are counted exactly,
+ * larger values fall into buckets of 1/32 of their power of two, so that any
+ * reported percentile is within ~3% of a true value while a histogram stays
+ * fixed-size (15KB); histograms of different threads can be merged.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#ifndef ALLOCATOR_TEST_LATENCY_HISTOGRAM_H
+#define ALLOCATOR_TEST_LATENCY_HISTOGRAM_H
+
+#include "test_common.h"
+
+#include <string.h>
+
+class LatencyHistogram
+{
+public:
+	static constexpr size_t sub_bucket_bits = 5;
+	static constexpr size_t sub_bucket_count = 1 << sub_bucket_bits;
+	static constexpr size_t bucket_count = ( 64 - sub_bucket_bits + 1 ) * sub_bucket_count;
+
+private:
+	uint64_t counts[bucket_count];
+	uint64_t totalCount;
+	uint64_t maxValue;
+	uint64_t sum;
+
+	static NODECPP_FORCEINLINE size_t valueToIndex( uint64_t val )
+	{
+		if ( val < 2 * sub_bucket_count )
+			return (size_t)val;
+#ifdef NODECPP_MSVC
+		unsigned long msb;
+		_BitScanReverse64( &msb, val );
+#elif (defined NODECPP_GCC) || (defined NODECPP_CLANG)
+		size_t msb = 63 - __builtin_clzll( val );
+#else
+		static_assert(false, "Unknown compiler");
+#endif
+		size_t shift = msb - sub_bucket_bits;
+		return shift * sub_bucket_count + (size_t)( val >> shift ); // val >> shift is in [sub_bucket_count, 2 * sub_bucket_count)
+	}
+
+	static uint64_t indexToHighestValue( size_t idx )
+	{
+		if ( idx < 2 * sub_bucket_count )
+			return idx;
+		size_t shift = idx / sub_bucket_count - 1;
+		uint64_t subBucket = idx - shift * sub_bucket_count;
+		return ( ( subBucket + 1 ) << shift ) - 1;
+	}
+
+public:
+	LatencyHistogram() { clear(); }
+
+	void clear()
+	{
+		memset( counts, 0, sizeof( counts ) );
+		totalCount = 0;
+		maxValue = 0;
+		sum = 0;
+	}
+
+	NODECPP_FORCEINLINE void record( uint64_t val )
+	{
+		++counts[ valueToIndex( val ) ];
+		++totalCount;
+		sum += val;
+		if ( val > maxValue )
+			maxValue = val;
+	}
+
+	void merge( const LatencyHistogram& other )
+	{
+		for ( size_t i=0; i<bucket_count; ++i )
+			counts[i] += other.counts[i];
+		totalCount += other.totalCount;
+		sum += other.sum;
+		if ( other.maxValue > maxValue )
+			maxValue = other.maxValue;
+	}
+
+	uint64_t count() const { return totalCount; }
+	uint64_t max() const { return maxValue; }
+	double mean() const { return totalCount ? sum * 1. / totalCount : 0; }
+
+	// percentile is in [0, 100]; returns the highest value equivalent to a value at a percentile
+	uint64_t valueAtPercentile( double percentile ) const
+	{
+		if ( totalCount == 0 )
+			return 0;
+		uint64_t target = (uint64_t)( percentile / 100 * totalCount + 0.5 );
+		if ( target == 0 )
+			target = 1;
+		uint64_t cumulative = 0;
+		for ( size_t i=0; i<bucket_count; ++i )
+		{
+			cumulative += counts[i];
+			if ( cumulative >= target )
+			{
+				uint64_t val = indexToHighestValue( i );
+				return val < maxValue ? val : maxValue;
+			}
+		}
+		return maxValue;
+	}
+
+	void print( const char* prefix, const char* name ) const
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: count = {}, mean = {:.1f}, p50 = {}, p99 = {}, p99.9 = {}, p99.99 = {}, max = {}", prefix, name, totalCount, mean(), valueAtPercentile( 50 ), valueAtPercentile( 99 ), valueAtPercentile( 99.9 ), valueAtPercentile( 99.99 ), maxValue );
+	}
+};
+
+#endif // ALLOCATOR_TEST_LATENCY_HISTOGRAM_H
@@ -0,0 +1,171 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: page cache under churn
+ * 
+ * Usage: page_cache.bin [operation count (default: 4M)] [ops between idle periods (default: 2000)]
+ * 
+ * Random replacement of objects with the size distribution of
+ * randomPos_RandomSize() (sizes up to 128K, that is, both buckets and
+ * BulkAllocator are involved) by a long-lived heap. At each idle period (as a
+ * thread that is often idle would have), the heap is trimmed completely (its
+ * free blocks of BulkAllocator are released), and a short-lived heap that
+ * shares the page cache of the long-lived one (see
+ * IibAllocatorBase::setPageCache()) makes a burst of allocations and is
+ * destroyed (its reservations of bucket pages, blocks of BulkAllocator and
+ * pages of their bookkeeping data are released). The same sequence is run with
+ * PageCache disabled (PageCacheLimits::maxBytes = 0), and with default
+ * limits. For each run, the following is reported:
+ *     number of blocks mapped and unmapped by all heaps (including pages that
+ *     hold their bookkeeping data, and temporary pages of
+ *     releaseEmptyBucketPages()), and by the cache when it shrinks;
+ *     number of blocks the cache has taken (each one, except for pages of
+ *     bookkeeping data, costs a single madvise() or mmap() to reset it);
+ *     page cache hits and misses;
+ *     duration.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+
+#include <memory>
+#include <stdio.h>
+
+thread_local unsigned long long rnd_seed = 0;
+
+constexpr size_t max_items = 1 << 14;
+constexpr size_t max_item_size_exp = 17; // sizes up to 128K
+constexpr size_t burst_items = 1 << 10; // allocated by each short-lived heap
+
+struct ChurnRes
+{
+	size_t dur; // ms
+	uint64_t sysAllocCount;
+	uint64_t sysDeallocCount;
+	uint64_t storeCount;
+	uint64_t hitCount;
+	uint64_t missCount;
+};
+
+template<class Heap>
+void addSysCounts( const Heap& heap, ChurnRes& res )
+{
+	res.sysAllocCount += heap.getStats().sysAllocCount + heap.getBulkStats().sysAllocCount;
+	res.sysDeallocCount += heap.getStats().sysDeallocCount + heap.getBulkStats().sysDeallocCount;
+}
+
+void runChurn( size_t maxCachedBytes, size_t opCount, size_t idlePeriod, ChurnRes& res )
+{
+	struct Slot
+	{
+		void* ptr;
+	};
+	std::unique_ptr<Slot[]> slots( new Slot[ max_items ] );
+	memset( slots.get(), 0, sizeof( Slot ) * max_items );
+	std::unique_ptr<void*[]> burst( new void*[ burst_items ] );
+	memset( &res, 0, sizeof( res ) );
+
+	PageCacheLimits::maxBytes = maxCachedBytes;
+	PageCache cache; // outlives all heaps that share it
+	std::unique_ptr<IibAllocatorBase<>> heap( new IibAllocatorBase<> );
+	heap->setPageCache( &cache );
+
+	rnd_seed = 0; // the same sequence for all runs
+	size_t start = GetMillisecondCount();
+	for ( size_t i=0; i<opCount; ++i )
+	{
+		size_t randNum = rng64();
+		Slot& slot = slots[ randNum % max_items ];
+		if ( slot.ptr )
+		{
+			heap->deallocate( slot.ptr );
+			slot.ptr = nullptr;
+		}
+		else
+		{
+			size_t sz = calcSizeWithStatsAdjustment( rng64(), max_item_size_exp );
+			slot.ptr = heap->allocate( sz );
+			*reinterpret_cast<uint8_t*>( slot.ptr ) = (uint8_t)sz;
+		}
+		if ( i % idlePeriod == idlePeriod - 1 )
+		{
+			bool isComplete = false;
+			while ( !isComplete )
+				heap->trim( SIZE_MAX, UINT64_MAX, &isComplete );
+
+			std::unique_ptr<IibAllocatorBase<>> tempHeap( new IibAllocatorBase<> );
+			tempHeap->setPageCache( &cache );
+			for ( size_t j=0; j<burst_items; ++j )
+			{
+				size_t sz = calcSizeWithStatsAdjustment( rng64(), max_item_size_exp );
+				burst[j] = tempHeap->allocate( sz );
+				*reinterpret_cast<uint8_t*>( burst[j] ) = (uint8_t)sz;
+			}
+			for ( size_t j=0; j<burst_items; ++j )
+				tempHeap->deallocate( burst[j] );
+			tempHeap->deinitialize();
+			addSysCounts( *tempHeap, res );
+			tempHeap.reset();
+		}
+	}
+	for ( size_t i=0; i<max_items; ++i )
+		heap->deallocate( slots[i].ptr );
+	bool isComplete = false;
+	while ( !isComplete )
+		heap->trim( SIZE_MAX, UINT64_MAX, &isComplete );
+	heap->deinitialize();
+	cache.clear();
+	res.dur = GetMillisecondCount() - start;
+
+	addSysCounts( *heap, res );
+	res.sysDeallocCount += cache.getReleaseCount();
+	res.storeCount = cache.getStoreCount();
+	res.hitCount = cache.getHitCount();
+	res.missCount = cache.getMissCount();
+}
+
+int main( int argc, char** argv )
+{
+	size_t opCount = argc > 1 ? strtoull( argv[1], nullptr, 10 ) : 1 << 22;
+	size_t idlePeriod = argc > 2 ? strtoull( argv[2], nullptr, 10 ) : 2000;
+	if ( idlePeriod == 0 )
+		idlePeriod = 1;
+
+	size_t defaultMaxBytes = PageCacheLimits::maxBytes;
+	ChurnRes res[2];
+	runChurn( 0, opCount, idlePeriod, res[0] );
+	runChurn( defaultMaxBytes, opCount, idlePeriod, res[1] );
+	PageCacheLimits::maxBytes = defaultMaxBytes;
+
+	const char* names[2] = { "page cache disabled", "page cache enabled" };
+	for ( size_t i=0; i<2; ++i )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {} ops in {} ms, {} blocks mapped, {} unmapped, {} cached; page cache hits {}, misses {}", names[i], opCount, res[i].dur, res[i].sysAllocCount, res[i].sysDeallocCount, res[i].storeCount, res[i].hitCount, res[i].missCount );
+
+	return 0;
+}
@@ -0,0 +1,201 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: hardware performance counters for benchmarks
+ * 
+ * PerfCounters opens a set of perf_event_open() counters for the calling
+ * thread (user mode only): L1D read misses, LLC misses, dTLB read misses,
+ * branch mispredicts and page faults. Counters are opened one by one, so that
+ * any of them may be missing (no PMU in a VM, perf_event_paranoid, seccomp,
+ * non-Linux); missing counters read as 0 and are not printed, and a benchmark
+ * falls back to rdtsc-only numbers. Values are scaled if the kernel had to
+ * multiplex counters.
+ * 
+ * A benchmark reads counters right before taking a timestamp of a phase end,
+ * so each phase includes exactly one read; its cost (measured by open()) is
+ * subtracted from each phase when printed.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#ifndef ALLOCATOR_TEST_PERF_COUNTERS_H
+#define ALLOCATOR_TEST_PERF_COUNTERS_H
+
+#include "test_common.h"
+
+#include <atomic>
+
+#ifndef NODECPP_MSVC
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+enum PerfCounterId { PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_DTLB_MISSES, PERF_BRANCH_MISSES, PERF_PAGE_FAULTS, PERF_COUNTER_COUNT };
+inline const char* perfCounterNames[PERF_COUNTER_COUNT] = { "L1D misses", "LLC misses", "dTLB misses", "branch misses", "page faults" };
+
+struct PerfCounterValues
+{
+	uint64_t values[PERF_COUNTER_COUNT];
+	uint32_t availableMask; // bit per PerfCounterId
+};
+
+class PerfCounters
+{
+	int fds[PERF_COUNTER_COUNT];
+	uint64_t readTicks = 0;
+	PerfCounterValues readEvents = {};
+
+#ifndef NODECPP_MSVC
+	static int openCounter( uint32_t type, uint64_t config )
+	{
+		struct perf_event_attr attr;
+		memset( &attr, 0, sizeof( attr ) );
+		attr.size = sizeof( attr );
+		attr.type = type;
+		attr.config = config;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		return (int)syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 ); // this thread, any cpu
+	}
+
+	static constexpr uint64_t cacheReadMiss( uint64_t cache ) { return cache | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ); }
+#endif
+
+public:
+	PerfCounters()
+	{
+		for ( size_t i=0; i<PERF_COUNTER_COUNT; ++i )
+			fds[i] = -1;
+	}
+	PerfCounters( const PerfCounters& ) = delete;
+	PerfCounters& operator = ( const PerfCounters& ) = delete;
+	~PerfCounters() { close(); }
+
+	// counts events of the calling thread from now on
+	void open()
+	{
+		close();
+#ifndef NODECPP_MSVC
+		fds[PERF_L1D_MISSES] = openCounter( PERF_TYPE_HW_CACHE, cacheReadMiss( PERF_COUNT_HW_CACHE_L1D ) );
+		fds[PERF_LLC_MISSES] = openCounter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES );
+		fds[PERF_DTLB_MISSES] = openCounter( PERF_TYPE_HW_CACHE, cacheReadMiss( PERF_COUNT_HW_CACHE_DTLB ) );
+		fds[PERF_BRANCH_MISSES] = openCounter( PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES );
+		fds[PERF_PAGE_FAULTS] = openCounter( PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS );
+#endif
+		calibrate();
+		static std::atomic<bool> reported = false;
+		if ( !reported.exchange( true ) )
+		{
+			size_t openCnt = 0;
+			for ( size_t i=0; i<PERF_COUNTER_COUNT; ++i )
+				openCnt += fds[i] != -1;
+			if ( openCnt < PERF_COUNTER_COUNT )
+				nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} of {} hardware performance counters are available (perf_event_open() not supported or not permitted?)", openCnt, (size_t)PERF_COUNTER_COUNT );
+		}
+	}
+
+	void close()
+	{
+#ifndef NODECPP_MSVC
+		for ( size_t i=0; i<PERF_COUNTER_COUNT; ++i )
+			if ( fds[i] != -1 )
+			{
+				::close( fds[i] );
+				fds[i] = -1;
+			}
+#endif
+	}
+
+	// rdtsc ticks and counter values of a single read() (the least of a few ones)
+	void calibrate()
+	{
+		constexpr size_t readCnt = 16;
+		PerfCounterValues first, last;
+		read( first );
+		readTicks = UINT64_MAX;
+		for ( size_t i=0; i<readCnt; ++i )
+		{
+			uint64_t start = __rdtsc();
+			read( last );
+			uint64_t ticks = __rdtsc() - start;
+			if ( ticks < readTicks )
+				readTicks = ticks;
+		}
+		readEvents.availableMask = first.availableMask & last.availableMask;
+		for ( size_t i=0; i<PERF_COUNTER_COUNT; ++i )
+			readEvents.values[i] = ( last.values[i] - first.values[i] ) / readCnt;
+	}
+
+	uint64_t getReadTicks() const { return readTicks; }
+	const PerfCounterValues& getReadEvents() const { return readEvents; }
+
+	void read( PerfCounterValues& res ) const
+	{
+		res.availableMask = 0;
+		for ( size_t i=0; i<PERF_COUNTER_COUNT; ++i )
+		{
+			res.values[i] = 0;
+#ifndef NODECPP_MSVC
+			if ( fds[i] == -1 )
+				continue;
+			uint64_t data[3]; // value, time enabled, time running
+			if ( ::read( fds[i], data, sizeof( data ) ) != sizeof( data ) )
+				continue;
+			res.values[i] = data[2] == 0 || data[2] == data[1] ? data[0] : (uint64_t)( data[0] * ( (double)data[1] / data[2] ) );
+			res.availableMask |= 1 << i;
+#endif
+		}
+	}
+};
+
+// value of counter i over a phase that ends with a read (see PerfCounters::calibrate())
+inline uint64_t perfCounterDelta( const PerfCounterValues& from, const PerfCounterValues& to, const PerfCounterValues& readEvents, size_t i )
+{
+	uint64_t delta = to.values[i] - from.values[i];
+	uint64_t overhead = ( readEvents.availableMask & ( 1 << i ) ) ? readEvents.values[i] : 0;
+	return delta > overhead ? delta - overhead : 0;
+}
+
+// counters of phases (as in CommonTestResults: setup, main loop, exit)
+inline void printPerfCounters( const char* prefix, const PerfCounterValues& begin, const PerfCounterValues& setup, const PerfCounterValues& mainLoop, const PerfCounterValues& exit, const PerfCounterValues& readEvents )
+{
+	uint32_t mask = begin.availableMask & setup.availableMask & mainLoop.availableMask & exit.availableMask;
+	for ( size_t i=0; i<PERF_COUNTER_COUNT; ++i )
+		if ( mask & ( 1 << i ) )
+		{
+			uint64_t s = perfCounterDelta( begin, setup, readEvents, i );
+			uint64_t m = perfCounterDelta( setup, mainLoop, readEvents, i );
+			uint64_t e = perfCounterDelta( mainLoop, exit, readEvents, i );
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}\t{}: {} ({} | {} | {})", prefix, perfCounterNames[i], s + m + e, s, m, e );
+		}
+}
+
+#endif // ALLOCATOR_TEST_PERF_COUNTERS_H
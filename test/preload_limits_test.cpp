@@ -0,0 +1,159 @@
+/* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ *
+ *
+ * Preload library: requests of sizes that cannot be satisfied
+ *
+ * Usage: LD_PRELOAD=./libiibmalloc.so ./preload_limits.bin
+ *
+ * Requests sizes near SIZE_MAX (which wrap around if headers, alignment or
+ * rounding up to pages are added to them) and checks that:
+ *     malloc(), calloc(), realloc(), memalign(), aligned_alloc() and
+ *     posix_memalign() fail with ENOMEM, and realloc() keeps the original block;
+ *     operator new throws std::bad_alloc (its nothrow forms return nullptr);
+ *     the heap keeps working afterwards.
+ * Each failed check is reported; returns 1 if any.
+ *
+ * -------------------------------------------------------------------------------*/
+
+
+#include <new>
+#include <initializer_list>
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failed = 0;
+
+static void check( bool ok, const char* what, size_t sz )
+{
+	if ( !ok )
+	{
+		printf( "FAILED: %s, size = 0x%zx\n", what, sz );
+		failed = 1;
+	}
+}
+
+// the ones a compiler cannot fold (a call of malloc() with a constant huge size might be replaced by nullptr)
+static volatile size_t pageSize = 4096;
+static volatile size_t alignments[] = { 64, 4096, 8192, 1 << 20 };
+// a block that realloc() fails to resize is still valid, which a compiler cannot know
+static void* (* volatile reallocFn)( void*, size_t ) = realloc;
+
+static void testSize( size_t sz )
+{
+	errno = 0;
+	void* p = malloc( sz );
+	check( p == nullptr && errno == ENOMEM, "malloc()", sz );
+
+	errno = 0;
+	p = calloc( 1, sz );
+	check( p == nullptr && errno == ENOMEM, "calloc()", sz );
+
+	// both a bucket item and a large chunk, as they are resized differently
+	for ( size_t origSz : { (size_t)100, (size_t)200000 } )
+	{
+		char* orig = reinterpret_cast<char*>( malloc( origSz ) );
+		memset( orig, 0x5a, origSz );
+		errno = 0;
+		p = reallocFn( orig, sz );
+		check( p == nullptr && errno == ENOMEM, "realloc()", sz );
+		bool intact = true;
+		for ( size_t i=0; i<origSz; ++i )
+			intact = intact && orig[i] == 0x5a;
+		check( intact, "realloc() keeps an original block", sz );
+		free( orig );
+	}
+
+	for ( size_t alignment : alignments )
+	{
+		errno = 0;
+		p = memalign( alignment, sz );
+		check( p == nullptr && errno == ENOMEM, "memalign()", sz );
+
+		errno = 0;
+		p = aligned_alloc( alignment, sz );
+		check( p == nullptr && errno == ENOMEM, "aligned_alloc()", sz );
+
+		p = nullptr;
+		int ret = posix_memalign( &p, alignment, sz );
+		check( ret == ENOMEM && p == nullptr, "posix_memalign()", sz );
+
+		bool thrown = false;
+		try { p = operator new( sz, std::align_val_t( alignment ) ); }
+		catch ( const std::bad_alloc& ) { thrown = true; }
+		check( thrown, "aligned operator new", sz );
+
+		p = operator new( sz, std::align_val_t( alignment ), std::nothrow );
+		check( p == nullptr, "aligned nothrow operator new", sz );
+	}
+
+	bool thrown = false;
+	try { p = operator new( sz ); }
+	catch ( const std::bad_alloc& ) { thrown = true; }
+	check( thrown, "operator new", sz );
+
+	thrown = false;
+	try { p = operator new[]( sz ); }
+	catch ( const std::bad_alloc& ) { thrown = true; }
+	check( thrown, "operator new[]", sz );
+
+	p = operator new( sz, std::nothrow );
+	check( p == nullptr, "nothrow operator new", sz );
+}
+
+int main()
+{
+	const char* preload = getenv( "LD_PRELOAD" );
+	if ( preload == nullptr || strstr( preload, "iibmalloc" ) == nullptr )
+		printf( "NOTE: LD_PRELOAD does not name iibmalloc; system malloc() is being tested\n" );
+
+	for ( size_t i=0; i<=4; ++i )
+	{
+		testSize( SIZE_MAX - i );
+		testSize( SIZE_MAX - i * pageSize );
+	}
+	testSize( ( SIZE_MAX >> 1 ) + 1 );
+
+	// a heap keeps working
+	for ( size_t sz : { (size_t)16, (size_t)5000, (size_t)300000 } )
+	{
+		char* p = reinterpret_cast<char*>( malloc( sz ) );
+		check( p != nullptr, "malloc() afterwards", sz );
+		if ( p != nullptr )
+		{
+			memset( p, 1, sz );
+			free( p );
+		}
+	}
+
+	printf( failed ? "FAILED\n" : "OK\n" );
+	return failed;
+}
@@ -36,6 +36,10 @@
 
 thread_local unsigned long long rnd_seed = 0;
 
+// Footprint sampling (see footprint_sampler.h) wakes up a thread of its own and thus affects timings; it is off unless
+// an interval (ms) is given as the first command-line argument (say, 10), and is never on for the empty test
+size_t footprintSamplingIntervalMs = 0;
+
 
 
 void* runRandomTest( void* params )
@@ -55,13 +59,13 @@ void* runRandomTest( void* params )
 					switch ( testParams->startupParams.mat )
 					{
 						case MEM_ACCESS_TYPE::none:
-							randomPos_RandomSize<PerThreadAllocatorUnderTest,MEM_ACCESS_TYPE::none>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<PerThreadAllocatorUnderTest,MEM_ACCESS_TYPE::none>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 						case MEM_ACCESS_TYPE::full:
-							randomPos_RandomSize<PerThreadAllocatorUnderTest,MEM_ACCESS_TYPE::full>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<PerThreadAllocatorUnderTest,MEM_ACCESS_TYPE::full>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 						case MEM_ACCESS_TYPE::single:
-							randomPos_RandomSize<PerThreadAllocatorUnderTest,MEM_ACCESS_TYPE::single>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<PerThreadAllocatorUnderTest,MEM_ACCESS_TYPE::single>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 					}
 					break;
@@ -73,13 +77,13 @@ void* runRandomTest( void* params )
 					switch ( testParams->startupParams.mat )
 					{
 						case MEM_ACCESS_TYPE::none:
-							randomPos_RandomSize<NewDeleteUnderTest,MEM_ACCESS_TYPE::none>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<NewDeleteUnderTest,MEM_ACCESS_TYPE::none>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 						case MEM_ACCESS_TYPE::full:
-							randomPos_RandomSize<NewDeleteUnderTest,MEM_ACCESS_TYPE::full>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<NewDeleteUnderTest,MEM_ACCESS_TYPE::full>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 						case MEM_ACCESS_TYPE::single:
-							randomPos_RandomSize<NewDeleteUnderTest,MEM_ACCESS_TYPE::single>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<NewDeleteUnderTest,MEM_ACCESS_TYPE::single>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 					}
 					break;
@@ -91,13 +95,13 @@ void* runRandomTest( void* params )
 					switch ( testParams->startupParams.mat )
 					{
 						case MEM_ACCESS_TYPE::none:
-							randomPos_RandomSize<FakeAllocatorUnderTest,MEM_ACCESS_TYPE::none>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<FakeAllocatorUnderTest,MEM_ACCESS_TYPE::none>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 						case MEM_ACCESS_TYPE::full:
-							randomPos_RandomSize<FakeAllocatorUnderTest,MEM_ACCESS_TYPE::full>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<FakeAllocatorUnderTest,MEM_ACCESS_TYPE::full>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 						case MEM_ACCESS_TYPE::single:
-							randomPos_RandomSize<FakeAllocatorUnderTest,MEM_ACCESS_TYPE::single>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID );
+							randomPos_RandomSize<FakeAllocatorUnderTest,MEM_ACCESS_TYPE::single>( allocator, testParams->startupParams.iterCount, testParams->startupParams.maxItems, testParams->startupParams.maxItemSize, testParams->threadID, *(testParams->latencies), *(testParams->liveBytes) );
 							break;
 					}
 					break;
@@ -114,12 +118,15 @@ void* runRandomTest( void* params )
 	return nullptr;
 }
 
-void doTest( TestStartupParamsAndResults* startupParams )
+void doTest( TestStartupParamsAndResults* startupParams, OpLatencies& latencies, FootprintSummary& footprint )
 {
 	size_t testThreadCount = startupParams->startupParams.threadCount;
 
 	ThreadStartupParamsAndResults testParams[max_threads];
 	std::thread threads[ max_threads ];
+	std::unique_ptr<OpLatencies[]> threadLatencies( new OpLatencies[ testThreadCount ] );
+	std::unique_ptr<LiveBytesCounter[]> liveBytes( new LiveBytesCounter[ testThreadCount ] );
+	FootprintSampler sampler;
 
 	for ( size_t i=0; i<testThreadCount; ++i )
 	{
@@ -128,8 +135,14 @@ void doTest( TestStartupParamsAndResults* startupParams )
 		testParams[i].threadResEmpty = startupParams->testRes->threadResEmpty + i;
 		testParams[i].threadResNewDel = startupParams->testRes->threadResNewDel + i;
 		testParams[i].threadResPerThreadAlloc = startupParams->testRes->threadResPerThreadAlloc + i;
+		testParams[i].latencies = threadLatencies.get() + i;
+		testParams[i].liveBytes = liveBytes.get() + i;
 	}
 
+	bool sample = footprintSamplingIntervalMs != 0 && startupParams->startupParams.allocatorType != USE_EMPTY_TEST;
+	if ( sample )
+		sampler.start( liveBytes.get(), testThreadCount, footprintSamplingIntervalMs );
+
 	// run thread
 	for ( size_t i=0; i<testThreadCount; ++i )
 	{
@@ -146,6 +159,21 @@ void doTest( TestStartupParamsAndResults* startupParams )
 		threads[i].join();
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "    ...done" );
 	}
+
+	if ( sample )
+		sampler.stop();
+
+	latencies.clear();
+	for ( size_t i=0; i<testThreadCount; ++i )
+		latencies.merge( threadLatencies[i] );
+	footprint = sample ? sampler.getSummary() : FootprintSummary();
+}
+
+void printFootprint( const char* allocatorName, const FootprintSummary& footprint )
+{
+	if ( footprint.sampleCount == 0 ) // sampling is off
+		return;
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Memory footprint ({}): RSS at start {} KB, peak RSS {} KB, steady-state RSS {} KB, max VMA count {}, committed/used {} ({} samples)", allocatorName, footprint.baselineRss >> 10, footprint.peakRss >> 10, footprint.steadyRss >> 10, footprint.peakMappingCount, footprint.committedToUsed, footprint.sampleCount );
 }
 
 void runComparisonTest( TestStartupParamsAndResults& params )
@@ -154,13 +182,15 @@ void runComparisonTest( TestStartupParamsAndResults& params )
 	size_t threadCount = params.startupParams.threadCount;
 
 	size_t allocatorType = params.startupParams.allocatorType;
+	std::unique_ptr<OpLatencies> latencies( new OpLatencies );
+	FootprintSummary footprintEmpty, footprintNewDel, footprintPerThreadAlloc;
 
 	if ( allocatorType & USE_EMPTY_TEST )
 	{
 		params.startupParams.allocatorType = USE_EMPTY_TEST;
 
 		start = GetMillisecondCount();
-		doTest( &params );
+		doTest( &params, *latencies, footprintEmpty );
 		end = GetMillisecondCount();
 		params.testRes->durEmpty = end - start;
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} threads made {} alloc/dealloc operations in {} ms ({} ms per 1 million)", threadCount, params.startupParams.iterCount * threadCount, end - start, (end - start) * 1000000 / (params.startupParams.iterCount * threadCount) );
@@ -168,6 +198,8 @@ void runComparisonTest( TestStartupParamsAndResults& params )
 		for ( size_t i=0; i<threadCount; ++i )
 			params.testRes->cumulativeDurEmpty += params.testRes->threadResEmpty->innerDur;
 		params.testRes->cumulativeDurEmpty /= threadCount;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Main loop latencies (Empty), all threads:" );
+		latencies->print( "    " );
 	}
 
 	if ( allocatorType & USE_NEW_DELETE )
@@ -175,7 +207,7 @@ void runComparisonTest( TestStartupParamsAndResults& params )
 		params.startupParams.allocatorType = USE_NEW_DELETE;
 
 		start = GetMillisecondCount();
-		doTest( &params );
+		doTest( &params, *latencies, footprintNewDel );
 		end = GetMillisecondCount();
 		params.testRes->durNewDel = end - start;
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} threads made {} alloc/dealloc operations in {} ms ({} ms per 1 million)", threadCount, params.startupParams.iterCount * threadCount, end - start, (end - start) * 1000000 / (params.startupParams.iterCount * threadCount) );
@@ -183,6 +215,9 @@ void runComparisonTest( TestStartupParamsAndResults& params )
 		for ( size_t i=0; i<threadCount; ++i )
 			params.testRes->cumulativeDurNewDel += params.testRes->threadResNewDel->innerDur;
 		params.testRes->cumulativeDurNewDel /= threadCount;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Main loop latencies (new/delete), all threads:" );
+		latencies->print( "    " );
+		printFootprint( "new/delete", footprintNewDel );
 	}
 
 	if ( allocatorType & USE_PER_THREAD_ALLOCATOR )
@@ -190,7 +225,7 @@ void runComparisonTest( TestStartupParamsAndResults& params )
 		params.startupParams.allocatorType = USE_PER_THREAD_ALLOCATOR;
 
 		start = GetMillisecondCount();
-		doTest( &params );
+		doTest( &params, *latencies, footprintPerThreadAlloc );
 		end = GetMillisecondCount();
 		params.testRes->durPerThreadAlloc = end - start;
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} threads made {} alloc/dealloc operations in {} ms ({} ms per 1 million)", threadCount, params.startupParams.iterCount * threadCount, end - start, (end - start) * 1000000 / (params.startupParams.iterCount * threadCount) );
@@ -198,18 +233,26 @@ void runComparisonTest( TestStartupParamsAndResults& params )
 		for ( size_t i=0; i<threadCount; ++i )
 			params.testRes->cumulativeDurPerThreadAlloc += params.testRes->threadResPerThreadAlloc->innerDur;
 		params.testRes->cumulativeDurPerThreadAlloc /= threadCount;
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Main loop latencies (iibmalloc), all threads:" );
+		latencies->print( "    " );
+		printFootprint( "iibmalloc", footprintPerThreadAlloc );
 	}
 
 	if ( allocatorType == TRY_ALL )
 	{
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Performance summary: {} threads, ({} - {}) / ({} - {}) = {}\n", threadCount, params.testRes->durNewDel, params.testRes->durEmpty, params.testRes->durPerThreadAlloc, params.testRes->durEmpty, (params.testRes->durNewDel - params.testRes->durEmpty) * 1. / (params.testRes->durPerThreadAlloc - params.testRes->durEmpty) );
 		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Performance summary: {} threads, ({} - {}) / ({} - {}) = {}\n", threadCount, params.testRes->cumulativeDurNewDel, params.testRes->cumulativeDurEmpty, params.testRes->cumulativeDurPerThreadAlloc, params.testRes->cumulativeDurEmpty, (params.testRes->cumulativeDurNewDel - params.testRes->cumulativeDurEmpty) * 1. / (params.testRes->cumulativeDurPerThreadAlloc - params.testRes->cumulativeDurEmpty) );
+		if ( footprintSamplingIntervalMs != 0 )
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Footprint summary: {} threads, steady-state RSS growth {} KB (iibmalloc) vs {} KB (new/delete), committed/used {} vs {}\n", threadCount, ( (int64_t)footprintPerThreadAlloc.steadyRss - (int64_t)footprintPerThreadAlloc.baselineRss ) / 1024, ( (int64_t)footprintNewDel.steadyRss - (int64_t)footprintNewDel.baselineRss ) / 1024, footprintPerThreadAlloc.committedToUsed, footprintNewDel.committedToUsed );
 	}
 	params.startupParams.allocatorType = allocatorType; // restore
 }
 
-int main()
+int main( int argc, char** argv )
 {
+	if ( argc > 1 )
+		footprintSamplingIntervalMs = strtoull( argv[1], nullptr, 10 );
+
 	TestRes testRes[max_threads];
 
 	if( 1 )
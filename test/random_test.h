@@ -34,6 +34,9 @@
 #define ALLOCATOR_RANDOM_TEST_H
 
 #include "test_common.h"
+#include "latency_histogram.h"
+#include "footprint_sampler.h"
+#include "perf_counters.h"
 
 #include <stdint.h>
 #define NOMINMAX
@@ -150,6 +153,71 @@ struct CommonTestResults
 	uint64_t rdtscSetup;
 	uint64_t rdtscMainLoop;
 	uint64_t rdtscExit;
+
+	PerfCounterValues perfBegin; // read right before respective rdtsc* (so that each phase includes one read)
+	PerfCounterValues perfSetup;
+	PerfCounterValues perfMainLoop;
+	PerfCounterValues perfExit;
+	uint64_t perfReadTicks; // cost of a read, subtracted from each phase
+	PerfCounterValues perfReadEvents;
+};
+
+// latencies (rdtsc ticks) of single allocate()/deallocate() calls of a main loop;
+// small and large objects are those served by buckets and by bulkAllocator of iibmalloc, respectively
+struct OpLatencies
+{
+	LatencyHistogram allocSmall;
+	LatencyHistogram allocLarge;
+	LatencyHistogram deallocSmall;
+	LatencyHistogram deallocLarge;
+
+	void clear()
+	{
+		allocSmall.clear();
+		allocLarge.clear();
+		deallocSmall.clear();
+		deallocLarge.clear();
+	}
+
+	NODECPP_FORCEINLINE void registerAlloc( size_t sz, uint64_t ticks )
+	{
+		if ( sz <= ThreadLocalAllocatorT::maxBucketSize() )
+			allocSmall.record( ticks );
+		else
+			allocLarge.record( ticks );
+	}
+
+	NODECPP_FORCEINLINE void registerDealloc( size_t sz, uint64_t ticks )
+	{
+		if ( sz <= ThreadLocalAllocatorT::maxBucketSize() )
+			deallocSmall.record( ticks );
+		else
+			deallocLarge.record( ticks );
+	}
+
+	void merge( const OpLatencies& other )
+	{
+		allocSmall.merge( other.allocSmall );
+		allocLarge.merge( other.allocLarge );
+		deallocSmall.merge( other.deallocSmall );
+		deallocLarge.merge( other.deallocLarge );
+	}
+
+	void print( const char* prefix ) const
+	{
+		std::unique_ptr<LatencyHistogram> total( new LatencyHistogram ); // too large to be on stack of a thread
+		total->merge( allocSmall );
+		total->merge( allocLarge );
+		total->print( prefix, "allocate (ticks)" );
+		allocSmall.print( prefix, "    small" );
+		allocLarge.print( prefix, "    large" );
+		total->clear();
+		total->merge( deallocSmall );
+		total->merge( deallocLarge );
+		total->print( prefix, "deallocate (ticks)" );
+		deallocSmall.print( prefix, "    small" );
+		deallocLarge.print( prefix, "    large" );
+	}
 };
 
 struct ThreadTestRes : public CommonTestResults
@@ -160,6 +228,8 @@ struct ThreadTestRes : public CommonTestResults
 	size_t sysDeallocCallCntAfterMainLoop;
 	size_t sysAllocCallCntAfterExit;
 	size_t sysDeallocCallCntAfterExit;
+	size_t bulkSysAllocCallCntAfterExit;
+	size_t bulkSysDeallocCallCntAfterExit;
 
 	uint64_t rdtscSysAllocCallSumAfterSetup;
 	uint64_t rdtscSysDeallocCallSumAfterSetup;
@@ -178,16 +248,24 @@ struct ThreadTestRes : public CommonTestResults
 
 void printThreadStats( const char* prefix, ThreadTestRes& res )
 {
-	uint64_t rdtscTotal = res.rdtscExit - res.rdtscBegin;
-//	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({} | {} | {});", prefix, res.threadID, res.innerDur, rdtscTotal, res.rdtscSetup - res.rdtscBegin, res.rdtscMainLoop - res.rdtscSetup, res.rdtscExit - res.rdtscMainLoop );
-	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({:.2f} | {:.2f} | {:.2f});", prefix, res.threadID, res.innerDur, rdtscTotal, (res.rdtscSetup - res.rdtscBegin) * 100. / rdtscTotal, (res.rdtscMainLoop - res.rdtscSetup) * 100. / rdtscTotal, (res.rdtscExit - res.rdtscMainLoop) * 100. / rdtscTotal );
+	uint64_t rdtscSetup = res.rdtscSetup - res.rdtscBegin - res.perfReadTicks;
+	uint64_t rdtscMainLoop = res.rdtscMainLoop - res.rdtscSetup - res.perfReadTicks;
+	uint64_t rdtscExit = res.rdtscExit - res.rdtscMainLoop - res.perfReadTicks;
+	uint64_t rdtscTotal = rdtscSetup + rdtscMainLoop + rdtscExit;
+//	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({} | {} | {});", prefix, res.threadID, res.innerDur, rdtscTotal, rdtscSetup, rdtscMainLoop, rdtscExit );
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({:.2f} | {:.2f} | {:.2f});", prefix, res.threadID, res.innerDur, rdtscTotal, rdtscSetup * 100. / rdtscTotal, rdtscMainLoop * 100. / rdtscTotal, rdtscExit * 100. / rdtscTotal );
+	printPerfCounters( prefix, res.perfBegin, res.perfSetup, res.perfMainLoop, res.perfExit, res.perfReadEvents );
 }
 
 void printThreadStatsEx( const char* prefix, ThreadTestRes& res )
 {
-	uint64_t rdtscTotal = res.rdtscExit - res.rdtscBegin;
-//	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({} | {} | {});", prefix, res.threadID, res.innerDur, rdtscTotal, res.rdtscSetup - res.rdtscBegin, res.rdtscMainLoop - res.rdtscSetup, res.rdtscExit - res.rdtscMainLoop );
-	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({:.2f} | {:.2f} | {:.2f});", prefix, res.threadID, res.innerDur, rdtscTotal, (res.rdtscSetup - res.rdtscBegin) * 100. / rdtscTotal, (res.rdtscMainLoop - res.rdtscSetup) * 100. / rdtscTotal, (res.rdtscExit - res.rdtscMainLoop) * 100. / rdtscTotal );
+	uint64_t rdtscSetup = res.rdtscSetup - res.rdtscBegin - res.perfReadTicks;
+	uint64_t rdtscMainLoop = res.rdtscMainLoop - res.rdtscSetup - res.perfReadTicks;
+	uint64_t rdtscExit = res.rdtscExit - res.rdtscMainLoop - res.perfReadTicks;
+	uint64_t rdtscTotal = rdtscSetup + rdtscMainLoop + rdtscExit;
+//	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({} | {} | {});", prefix, res.threadID, res.innerDur, rdtscTotal, rdtscSetup, rdtscMainLoop, rdtscExit );
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}{}: {}ms; {} ({:.2f} | {:.2f} | {:.2f});", prefix, res.threadID, res.innerDur, rdtscTotal, rdtscSetup * 100. / rdtscTotal, rdtscMainLoop * 100. / rdtscTotal, rdtscExit * 100. / rdtscTotal );
+	printPerfCounters( prefix, res.perfBegin, res.perfSetup, res.perfMainLoop, res.perfExit, res.perfReadEvents );
 
 	size_t mainLoopAllocCnt = res.sysAllocCallCntAfterMainLoop - res.sysAllocCallCntAfterSetup;
 	uint64_t mainLoopAllocCntRdtsc = res.rdtscSysAllocCallSumAfterMainLoop - res.rdtscSysAllocCallSumAfterSetup;
@@ -250,12 +328,15 @@ struct ThreadStartupParamsAndResults
 	ThreadTestRes* threadResEmpty;
 	ThreadTestRes* threadResNewDel;
 	ThreadTestRes* threadResPerThreadAlloc;
+	OpLatencies* latencies;
+	LiveBytesCounter* liveBytes;
 };
 
 class NewDeleteUnderTest
 {
 	CommonTestResults* testRes;
 	size_t start;
+	PerfCounters perf;
 
 public:
 	NewDeleteUnderTest( CommonTestResults* testRes_ ) { testRes = testRes_; }
@@ -264,19 +345,39 @@ public:
 	{
 		start = GetMillisecondCount();
 		testRes->threadID = threadID; // just as received
+		perf.open();
+		testRes->perfReadTicks = perf.getReadTicks();
+		testRes->perfReadEvents = perf.getReadEvents();
+		perf.read( testRes->perfBegin );
 		testRes->rdtscBegin = __rdtsc();
 	}
 
 	void* allocate( size_t sz ) { return new uint8_t[ sz ]; }
 	void deallocate( void* ptr ) { delete [] reinterpret_cast<uint8_t*>(ptr); }
+	void* reallocate( void* ptr, size_t oldSz, size_t sz )
+	{
+		uint8_t* ret = new uint8_t[ sz ];
+		memcpy( ret, ptr, oldSz < sz ? oldSz : sz );
+		delete [] reinterpret_cast<uint8_t*>(ptr);
+		return ret;
+	}
 
 	void deinit() {}
 
-	void doWhateverAfterSetupPhase() { testRes->rdtscSetup = __rdtsc(); }
+	void doWhateverAfterSetupPhase()
+	{
+		perf.read( testRes->perfSetup );
+		testRes->rdtscSetup = __rdtsc();
+	}
 	void doWhateverWithinMainLoopPhase() {}
-	void doWhateverAfterMainLoopPhase() { testRes->rdtscMainLoop = __rdtsc(); }
+	void doWhateverAfterMainLoopPhase()
+	{
+		perf.read( testRes->perfMainLoop );
+		testRes->rdtscMainLoop = __rdtsc();
+	}
 	void doWhateverAfterCleanupPhase()
 	{
+		perf.read( testRes->perfExit );
 		testRes->rdtscExit = __rdtsc();
 		testRes->innerDur = GetMillisecondCount() - start;
 	}
@@ -286,6 +387,7 @@ class PerThreadAllocatorUnderTest
 {
 	ThreadTestRes* testRes;
 	size_t start;
+	PerfCounters perf;
 
 public:
 	PerThreadAllocatorUnderTest( ThreadTestRes* testRes_ ) { testRes = testRes_; }
@@ -294,6 +396,10 @@ public:
 	void init( size_t threadID )
 	{
 		start = GetMillisecondCount();
+		perf.open();
+		testRes->perfReadTicks = perf.getReadTicks();
+		testRes->perfReadEvents = perf.getReadEvents();
+		perf.read( testRes->perfBegin );
 		testRes->rdtscBegin = __rdtsc();
 		g_AllocManager.initialize();
 		g_AllocManager.enable();
@@ -305,10 +411,17 @@ public:
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, g_AllocManager.isZombieablePointerInBlock(ret, ret)); 
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !g_AllocManager.isZombieablePointerInBlock(ret, nullptr)); 
 		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sz == 0 || g_AllocManager.isZombieablePointerInBlock(ret, reinterpret_cast<uint8_t*>(ret) + sz - 1)); 
-		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sz < 16 || !g_AllocManager.isZombieablePointerInBlock(ret, reinterpret_cast<uint8_t*>(ret) + sz*2)); 
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, !g_AllocManager.isZombieablePointerInBlock(ret, reinterpret_cast<uint8_t*>(ret) + g_AllocManager.getAllocatedSize(reinterpret_cast<uint8_t*>(ret) - guaranteed_prefix_size))); // past a block, whatever its bucket size is
 		return ret; 
 	}
 	void deallocate( void* ptr ) { g_AllocManager.zombieableDeallocate( ptr ); }
+	void* reallocate( void* ptr, size_t oldSz, size_t sz )
+	{
+		void* ret = allocate( sz );
+		memcpy( ret, ptr, oldSz < sz ? oldSz : sz );
+		deallocate( ptr );
+		return ret;
+	}
 #else
 	void* allocate( size_t sz ) { 
 		void* ret = g_AllocManager.allocate( sz ); 
@@ -317,6 +430,7 @@ public:
 		return ret; 
 	}
 	void deallocate( void* ptr ) { g_AllocManager.deallocate( ptr ); }
+	void* reallocate( void* ptr, size_t oldSz, size_t sz ) { return g_AllocManager.reallocate( ptr, sz ); }
 #endif
 	void deinit()
 	{
@@ -332,6 +446,7 @@ public:
 #ifdef ENABLE_SAFE_ALLOCATION_MEANS
 		g_AllocManager.killAllZombies();
 #endif
+		perf.read( testRes->perfSetup );
 		testRes->rdtscSetup = __rdtsc();
 		testRes->rdtscSysAllocCallSumAfterSetup = g_AllocManager.getStats().rdtscSysAllocSpent;
 		testRes->sysAllocCallCntAfterSetup = g_AllocManager.getStats().sysAllocCount;
@@ -353,6 +468,7 @@ public:
 #ifdef ENABLE_SAFE_ALLOCATION_MEANS
 		g_AllocManager.killAllZombies();
 #endif
+		perf.read( testRes->perfMainLoop );
 		testRes->rdtscMainLoop = __rdtsc();
 		testRes->rdtscSysAllocCallSumAfterMainLoop = g_AllocManager.getStats().rdtscSysAllocSpent;
 		testRes->sysAllocCallCntAfterMainLoop = g_AllocManager.getStats().sysAllocCount;
@@ -367,6 +483,7 @@ public:
 #ifdef ENABLE_SAFE_ALLOCATION_MEANS
 		g_AllocManager.killAllZombies();
 #endif
+		perf.read( testRes->perfExit );
 		testRes->rdtscExit = __rdtsc();
 		testRes->rdtscSysAllocCallSumAfterExit = g_AllocManager.getStats().rdtscSysAllocSpent;
 		testRes->sysAllocCallCntAfterExit = g_AllocManager.getStats().sysAllocCount;
@@ -374,6 +491,8 @@ public:
 		testRes->sysDeallocCallCntAfterExit = g_AllocManager.getStats().sysDeallocCount;
 		testRes->allocRequestCountAfterExit = g_AllocManager.getStats().allocRequestCount;
 		testRes->deallocRequestCountAfterExit = g_AllocManager.getStats().deallocRequestCount;
+		testRes->bulkSysAllocCallCntAfterExit = g_AllocManager.getBulkStats().sysAllocCount;
+		testRes->bulkSysDeallocCallCntAfterExit = g_AllocManager.getBulkStats().sysDeallocCount;
 		testRes->innerDur = GetMillisecondCount() - start;
 	}
 };
@@ -382,6 +501,7 @@ class FakeAllocatorUnderTest
 {
 	CommonTestResults* testRes;
 	size_t start;
+	PerfCounters perf;
 	uint8_t* fakeBuffer = nullptr;
 	static constexpr size_t fakeBufferSize = 0x1000000;
 
@@ -393,20 +513,34 @@ public:
 	{
 		start = GetMillisecondCount();
 		testRes->threadID = threadID; // just as received
+		perf.open();
+		testRes->perfReadTicks = perf.getReadTicks();
+		testRes->perfReadEvents = perf.getReadEvents();
+		perf.read( testRes->perfBegin );
 		testRes->rdtscBegin = __rdtsc();
 		fakeBuffer = new uint8_t [fakeBufferSize];
 	}
 
 	void* allocate( size_t sz ) { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sz <= fakeBufferSize ); return fakeBuffer; }
 	void deallocate( void* ptr ) {}
+	void* reallocate( void* ptr, size_t oldSz, size_t sz ) { NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, sz <= fakeBufferSize ); return fakeBuffer; }
 
 	void deinit() { if ( fakeBuffer ) delete [] fakeBuffer; fakeBuffer = nullptr; }
 
-	void doWhateverAfterSetupPhase() { testRes->rdtscSetup = __rdtsc(); }
+	void doWhateverAfterSetupPhase()
+	{
+		perf.read( testRes->perfSetup );
+		testRes->rdtscSetup = __rdtsc();
+	}
 	void doWhateverWithinMainLoopPhase() {}
-	void doWhateverAfterMainLoopPhase() { testRes->rdtscMainLoop = __rdtsc(); }
+	void doWhateverAfterMainLoopPhase()
+	{
+		perf.read( testRes->perfMainLoop );
+		testRes->rdtscMainLoop = __rdtsc();
+	}
 	void doWhateverAfterCleanupPhase()
 	{
+		perf.read( testRes->perfExit );
 		testRes->rdtscExit = __rdtsc();
 		testRes->innerDur = GetMillisecondCount() - start;
 	}
@@ -463,7 +597,7 @@ size_t Pareto_80_20_6_Rand( const Pareto_80_20_6_Data& data, uint32_t rnum1, uin
 
 #if 1
 template< class AllocatorUnderTest, MEM_ACCESS_TYPE mat>
-void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCount, size_t maxItems, size_t maxItemSizeExp, size_t threadID )
+void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCount, size_t maxItems, size_t maxItemSizeExp, size_t threadID, OpLatencies& latencies, LiveBytesCounter& liveBytes )
 {
 	constexpr bool doMemAccess = mat != MEM_ACCESS_TYPE::none;
 	constexpr bool doFullAccess = mat == MEM_ACCESS_TYPE::full;
@@ -503,6 +637,7 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 				size_t sz = calcSizeWithStatsAdjustment( randNumSz, maxItemSizeExp );
 				baseBuff[i*32+j].sz = sz;
 				baseBuff[i*32+j].ptr = reinterpret_cast<uint8_t*>( allocatorUnderTest.allocate( sz ) );
+				liveBytes.add( sz );
 				if constexpr ( doMemAccess )
 				{
 					if constexpr ( doFullAccess )
@@ -546,14 +681,20 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 						dummyCtr += baseBuff[idx].ptr[baseBuff[idx].sz/2];
 					}
 				}
+				uint64_t opStart = __rdtsc();
 				allocatorUnderTest.deallocate( baseBuff[idx].ptr );
+				latencies.registerDealloc( baseBuff[idx].sz, __rdtsc() - opStart );
+				liveBytes.sub( baseBuff[idx].sz );
 				baseBuff[idx].ptr = 0;
 			}
 			else
 			{
 				size_t sz = calcSizeWithStatsAdjustment( rng64(), maxItemSizeExp );
 				baseBuff[idx].sz = sz;
+				uint64_t opStart = __rdtsc();
 				baseBuff[idx].ptr = reinterpret_cast<uint8_t*>( allocatorUnderTest.allocate( sz ) );
+				latencies.registerAlloc( sz, __rdtsc() - opStart );
+				liveBytes.add( sz );
 				if constexpr ( doMemAccess )
 				{
 					if constexpr ( doFullAccess )
@@ -592,6 +733,7 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 				}
 			}
 			allocatorUnderTest.deallocate( baseBuff[idx].ptr );
+			liveBytes.sub( baseBuff[idx].sz );
 		}
 
 	if ( !allocatorUnderTest.isFake() )
@@ -605,7 +747,7 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 }
 #else
 template< class AllocatorUnderTest, MEM_ACCESS_TYPE mat>
-void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCount, size_t maxItems, size_t maxItemSizeExp, size_t threadID )
+void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCount, size_t maxItems, size_t maxItemSizeExp, size_t threadID, OpLatencies& latencies, LiveBytesCounter& liveBytes )
 {
 	constexpr bool doMemAccess = mat != MEM_ACCESS_TYPE::none;
 	constexpr bool doFullAccess = mat == MEM_ACCESS_TYPE::full;
@@ -745,6 +887,63 @@ void randomPos_RandomSize( AllocatorUnderTest& allocatorUnderTest, size_t iterCo
 }
 #endif
 
+// Random replacement of objects held by a heap in maxItems slots (a slot at a random position is freed if it holds an
+// object, and gets a new one otherwise), with the size distribution of randomPos_RandomSize(); a common load of benchmarks
+// of heap features, which take their own measurements in onOp( opIdx, allocatedSz, freedSz ), called after each operation
+// (one of sizes is 0). A sequence of operations depends on a seed only.
+template<class HeapT>
+class RandomChurn
+{
+	struct Slot
+	{
+		void* ptr;
+		size_t sz;
+	};
+	std::unique_ptr<Slot[]> slots;
+	size_t maxItems;
+	size_t maxItemSizeExp;
+
+public:
+	RandomChurn( size_t maxItems_, size_t maxItemSizeExp_ ) : slots( new Slot[ maxItems_ ] ), maxItems( maxItems_ ), maxItemSizeExp( maxItemSizeExp_ )
+	{
+		memset( slots.get(), 0, sizeof( Slot ) * maxItems );
+	}
 
+	template<class OnOp>
+	void run( HeapT& heap, size_t opCount, unsigned long long seed, OnOp onOp )
+	{
+		rnd_seed = seed;
+		for ( size_t i=0; i<opCount; ++i )
+		{
+			size_t randNum = rng64();
+			Slot& slot = slots[ randNum % maxItems ];
+			if ( slot.ptr )
+			{
+				heap.deallocate( slot.ptr );
+				slot.ptr = nullptr;
+				onOp( i, (size_t)0, slot.sz );
+			}
+			else
+			{
+				size_t sz = calcSizeWithStatsAdjustment( rng64(), maxItemSizeExp );
+				slot.ptr = heap.allocate( sz );
+				slot.sz = sz;
+				*reinterpret_cast<uint8_t*>( slot.ptr ) = (uint8_t)sz;
+				onOp( i, sz, (size_t)0 );
+			}
+		}
+	}
+
+	// frees objects that are left
+	void clear( HeapT& heap )
+	{
+		for ( size_t i=0; i<maxItems; ++i )
+			if ( slots[i].ptr )
+			{
+				heap.deallocate( slots[i].ptr );
+				slots[i].ptr = nullptr;
+			}
+	}
+};
 
 #endif
@@ -0,0 +1,484 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: multi-thread scaling benchmark
+ * 
+ * Usage: scaling.bin [max thread count (default: number of cores)] [output file prefix (default: scaling_results)]
+ *                    [footprint sampling interval, ms (default: 0, no sampling)]
+ * 
+ * For each workload and each thread count (powers of 2 up to the maximum, and
+ * the maximum itself), runs the empty allocator, new/delete and iibmalloc,
+ * each thread doing the same amount of work. Workloads:
+ *     pareto             randomPos_RandomSize() (see random_test.h)
+ *     larson             server-style churn: random replacement of objects in
+ *                        per-thread arrays; arrays are passed between threads
+ *                        every round, so that most objects are freed by
+ *                        a thread other than the one that allocated them
+ *     producer-consumer  threads are paired; one allocates messages, the other
+ *                        one reads and frees them
+ *     temporaries        a few short-lived objects per message, freed in
+ *                        reverse order
+ * Results (ops/sec, peak RSS growth, numbers of calls to OS from BlockStats,
+ * ratios to new/delete) are written to <prefix>.json and <prefix>.csv.
+ * With sampling on, a FootprintSampler (see footprint_sampler.h) also reports
+ * steady-state RSS growth, the maximum number of VMAs and the committed-to-used
+ * ratio of each run.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+
+#include <vector>
+#include <atomic>
+#include <stdio.h>
+
+thread_local unsigned long long rnd_seed = 0;
+
+enum { WORKLOAD_PARETO, WORKLOAD_LARSON, WORKLOAD_PRODUCER_CONSUMER, WORKLOAD_TEMPORARIES, WORKLOAD_COUNT };
+const char* workloadNames[WORKLOAD_COUNT] = { "pareto", "larson", "producer-consumer", "temporaries" };
+
+constexpr size_t pareto_iter_count = 1 << 20; // per thread (and below)
+constexpr size_t pareto_max_items = 1 << 16;
+constexpr size_t pareto_max_item_size_exp = 16;
+constexpr size_t larson_iter_count = 1 << 21;
+constexpr size_t larson_slot_count = 1000;
+constexpr size_t larson_round_size = 10000;
+constexpr size_t larson_min_size = 16;
+constexpr size_t larson_max_size = 512;
+constexpr size_t message_count = 1 << 20;
+constexpr size_t max_message_size = 1024;
+constexpr size_t max_temporaries_per_message = 8;
+constexpr size_t max_temporary_size = 256;
+
+class ThreadBarrier
+{
+	std::atomic<size_t> arrived = 0;
+	std::atomic<size_t> generation = 0;
+	size_t threadCount;
+
+public:
+	ThreadBarrier( size_t threadCount_ ) : threadCount( threadCount_ ) {}
+	void wait()
+	{
+		size_t gen = generation.load();
+		if ( arrived.fetch_add( 1 ) + 1 == threadCount )
+		{
+			arrived.store( 0 );
+			generation.fetch_add( 1 );
+		}
+		else
+			while ( generation.load() == gen )
+				std::this_thread::yield();
+	}
+};
+
+// single producer, single consumer
+class MessageQueue
+{
+	static constexpr size_t capacity = 1024;
+	alignas(64) std::atomic<size_t> head = 0;
+	alignas(64) std::atomic<size_t> tail = 0;
+	void* items[capacity];
+
+public:
+	bool push( void* msg )
+	{
+		size_t t = tail.load( std::memory_order_relaxed );
+		if ( t - head.load( std::memory_order_acquire ) == capacity )
+			return false;
+		items[t % capacity] = msg;
+		tail.store( t + 1, std::memory_order_release );
+		return true;
+	}
+	void* pop()
+	{
+		size_t h = head.load( std::memory_order_relaxed );
+		if ( h == tail.load( std::memory_order_acquire ) )
+			return nullptr;
+		void* msg = items[h % capacity];
+		head.store( h + 1, std::memory_order_release );
+		return msg;
+	}
+};
+
+struct LarsonSlots
+{
+	void* ptrs[larson_slot_count];
+	size_t sizes[larson_slot_count];
+};
+
+struct ScalingParams
+{
+	size_t workload;
+	size_t threadCount;
+	ThreadBarrier* barrier;
+	std::atomic<LarsonSlots*>* larsonExchange; // by thread
+	MessageQueue* queues; // by pair of threads
+	LiveBytesCounter* liveBytes; // by thread
+};
+
+struct ScalingThreadRes
+{
+	ThreadTestRes testRes;
+	size_t opCount;
+	OpLatencies* latencies; // required by randomPos_RandomSize()
+};
+
+NODECPP_FORCEINLINE size_t randomSize( size_t minSz, size_t maxSz )
+{
+	return minSz + rng64() % ( maxSz - minSz + 1 );
+}
+
+template< class AllocatorUnderTest>
+void larson( AllocatorUnderTest& allocatorUnderTest, ScalingParams& params, size_t threadID, size_t& opCount )
+{
+	allocatorUnderTest.init( threadID );
+
+	LarsonSlots* mine = new LarsonSlots;
+	LarsonSlots* exchanged = new LarsonSlots; // goes to other threads
+	LiveBytesCounter& liveBytes = params.liveBytes[threadID];
+	for ( size_t i=0; i<larson_slot_count; ++i )
+	{
+		mine->sizes[i] = randomSize( larson_min_size, larson_max_size );
+		mine->ptrs[i] = allocatorUnderTest.allocate( mine->sizes[i] );
+		exchanged->sizes[i] = randomSize( larson_min_size, larson_max_size );
+		exchanged->ptrs[i] = allocatorUnderTest.allocate( exchanged->sizes[i] );
+		liveBytes.add( mine->sizes[i] + exchanged->sizes[i] );
+	}
+	params.larsonExchange[threadID].store( exchanged );
+	allocatorUnderTest.doWhateverAfterSetupPhase();
+	params.barrier->wait();
+
+	for ( size_t round=0; round<larson_iter_count/larson_round_size; ++round )
+	{
+		for ( size_t i=0; i<larson_round_size; ++i )
+		{
+			size_t idx = rng64() % larson_slot_count;
+			allocatorUnderTest.deallocate( mine->ptrs[idx] );
+			liveBytes.sub( mine->sizes[idx] );
+			size_t sz = randomSize( larson_min_size, larson_max_size );
+			mine->ptrs[idx] = allocatorUnderTest.allocate( sz );
+			mine->sizes[idx] = sz;
+			liveBytes.add( sz );
+			*reinterpret_cast<uint8_t*>( mine->ptrs[idx] ) = (uint8_t)sz;
+		}
+		opCount += 2 * larson_round_size;
+		allocatorUnderTest.doWhateverWithinMainLoopPhase();
+		mine = params.larsonExchange[ ( threadID + round ) % params.threadCount ].exchange( mine );
+	}
+	allocatorUnderTest.doWhateverAfterMainLoopPhase();
+
+	params.barrier->wait(); // no more exchanges
+	exchanged = params.larsonExchange[threadID].load();
+	for ( size_t i=0; i<larson_slot_count; ++i )
+	{
+		allocatorUnderTest.deallocate( mine->ptrs[i] );
+		allocatorUnderTest.deallocate( exchanged->ptrs[i] );
+		liveBytes.sub( mine->sizes[i] + exchanged->sizes[i] );
+	}
+	delete mine;
+	delete exchanged;
+	allocatorUnderTest.doWhateverAfterCleanupPhase();
+	params.barrier->wait(); // objects of this thread are not freed by others from now on
+	allocatorUnderTest.deinit();
+}
+
+template< class AllocatorUnderTest>
+void producerConsumer( AllocatorUnderTest& allocatorUnderTest, ScalingParams& params, size_t threadID, size_t& opCount )
+{
+	allocatorUnderTest.init( threadID );
+	MessageQueue& queue = params.queues[ threadID / 2 ];
+	bool selfPaired = ( threadID ^ 1 ) >= params.threadCount; // last of an odd number of threads
+	bool producer = selfPaired || ( threadID & 1 ) == 0;
+	bool consumer = selfPaired || ( threadID & 1 ) == 1;
+	LiveBytesCounter& liveBytes = params.liveBytes[threadID];
+	allocatorUnderTest.doWhateverAfterSetupPhase();
+	params.barrier->wait();
+
+	size_t dummyCtr = 0;
+	for ( size_t i=0; i<message_count; ++i )
+	{
+		if ( producer )
+		{
+			size_t sz = randomSize( 16, max_message_size );
+			void* msg = allocatorUnderTest.allocate( sz );
+			memset( msg, (uint8_t)sz, sz );
+			*reinterpret_cast<size_t*>( msg ) = sz;
+			liveBytes.add( sz );
+			while ( !queue.push( msg ) )
+				std::this_thread::yield();
+			++opCount;
+		}
+		if ( consumer )
+		{
+			void* msg;
+			while ( ( msg = queue.pop() ) == nullptr )
+				std::this_thread::yield();
+			size_t sz = *reinterpret_cast<size_t*>( msg );
+			dummyCtr += sz;
+			allocatorUnderTest.deallocate( msg );
+			liveBytes.sub( sz );
+			++opCount;
+		}
+		if ( i % 10000 == 0 )
+			allocatorUnderTest.doWhateverWithinMainLoopPhase();
+	}
+	allocatorUnderTest.doWhateverAfterMainLoopPhase();
+	allocatorUnderTest.doWhateverAfterCleanupPhase();
+	params.barrier->wait(); // objects of this thread are not freed by others from now on
+	allocatorUnderTest.deinit();
+	if ( dummyCtr == 0 )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "(no messages received by thread {})", threadID );
+}
+
+template< class AllocatorUnderTest>
+void temporaries( AllocatorUnderTest& allocatorUnderTest, ScalingParams& params, size_t threadID, size_t& opCount )
+{
+	allocatorUnderTest.init( threadID );
+	allocatorUnderTest.doWhateverAfterSetupPhase();
+	params.barrier->wait();
+
+	LiveBytesCounter& liveBytes = params.liveBytes[threadID];
+	void* temps[max_temporaries_per_message];
+	size_t sizes[max_temporaries_per_message];
+	for ( size_t i=0; i<message_count; ++i )
+	{
+		size_t cnt = 1 + rng64() % max_temporaries_per_message;
+		for ( size_t j=0; j<cnt; ++j )
+		{
+			size_t sz = randomSize( 16, max_temporary_size );
+			temps[j] = allocatorUnderTest.allocate( sz );
+			sizes[j] = sz;
+			liveBytes.add( sz );
+			*reinterpret_cast<uint8_t*>( temps[j] ) = (uint8_t)sz;
+		}
+		for ( size_t j=cnt; j; --j )
+		{
+			allocatorUnderTest.deallocate( temps[j-1] );
+			liveBytes.sub( sizes[j-1] );
+		}
+		opCount += 2 * cnt;
+		if ( i % 10000 == 0 )
+			allocatorUnderTest.doWhateverWithinMainLoopPhase();
+	}
+	allocatorUnderTest.doWhateverAfterMainLoopPhase();
+	allocatorUnderTest.doWhateverAfterCleanupPhase();
+	allocatorUnderTest.deinit();
+}
+
+template< class AllocatorUnderTest, class ThreadResT>
+void runScalingThread( ScalingParams* params, size_t threadID, ScalingThreadRes* res, ThreadResT* testRes )
+{
+	AllocatorUnderTest allocator( testRes );
+	res->opCount = 0;
+	switch ( params->workload )
+	{
+		case WORKLOAD_PARETO:
+			params->barrier->wait();
+			randomPos_RandomSize<AllocatorUnderTest,MEM_ACCESS_TYPE::single>( allocator, pareto_iter_count, pareto_max_items, pareto_max_item_size_exp, threadID, *(res->latencies), params->liveBytes[threadID] );
+			res->opCount = pareto_iter_count;
+			break;
+		case WORKLOAD_LARSON:
+			larson( allocator, *params, threadID, res->opCount );
+			break;
+		case WORKLOAD_PRODUCER_CONSUMER:
+			producerConsumer( allocator, *params, threadID, res->opCount );
+			break;
+		case WORKLOAD_TEMPORARIES:
+			temporaries( allocator, *params, threadID, res->opCount );
+			break;
+		default:
+			NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, false );
+	}
+}
+
+struct ScalingRes
+{
+	size_t workload;
+	const char* allocatorName;
+	size_t threadCount;
+	size_t opCount;
+	size_t dur; // ms
+	double opsPerSec;
+	size_t peakRssGrowth;
+	int64_t steadyRssGrowth; // below: 0 unless sampling is on
+	size_t vmaCount;
+	double committedToUsed;
+	uint64_t sysAllocCount; // of page and bulk allocators (BlockStats)
+	uint64_t sysDeallocCount;
+	double ratioToNewDel; // ops/sec vs ops/sec of new/delete
+	double netRatioToNewDel; // with duration of the empty allocator subtracted from both (as in runComparisonTest())
+};
+
+void doScalingTest( size_t workload, size_t threadCount, size_t allocatorType, size_t samplingInterval, ScalingRes& res )
+{
+	ThreadBarrier barrier( threadCount );
+	std::unique_ptr<std::atomic<LarsonSlots*>[]> larsonExchange( new std::atomic<LarsonSlots*>[ threadCount ] );
+	std::unique_ptr<MessageQueue[]> queues( new MessageQueue[ ( threadCount + 1 ) / 2 ] );
+	std::unique_ptr<OpLatencies[]> latencies( new OpLatencies[ threadCount ] );
+	std::unique_ptr<LiveBytesCounter[]> liveBytes( new LiveBytesCounter[ threadCount ] );
+	FootprintSampler sampler;
+	std::vector<ScalingThreadRes> threadRes( threadCount );
+	std::vector<std::thread> threads( threadCount );
+	ScalingParams params;
+	params.workload = workload;
+	params.threadCount = threadCount;
+	params.barrier = &barrier;
+	params.larsonExchange = larsonExchange.get();
+	params.queues = queues.get();
+	params.liveBytes = liveBytes.get();
+	memset( (void*)(threadRes.data()), 0, sizeof( ScalingThreadRes ) * threadCount );
+
+	ResetPeakResidentSetSize();
+	size_t rssBefore = GetResidentSetSize();
+	if ( samplingInterval )
+		sampler.start( liveBytes.get(), threadCount, samplingInterval );
+	size_t start = GetMillisecondCount();
+	for ( size_t i=0; i<threadCount; ++i )
+	{
+		ScalingThreadRes* tr = &(threadRes[i]);
+		tr->latencies = latencies.get() + i;
+		switch ( allocatorType )
+		{
+			case USE_PER_THREAD_ALLOCATOR:
+				threads[i] = std::thread( runScalingThread<PerThreadAllocatorUnderTest, ThreadTestRes>, &params, i, tr, &(tr->testRes) );
+				break;
+			case USE_NEW_DELETE:
+				threads[i] = std::thread( runScalingThread<NewDeleteUnderTest, CommonTestResults>, &params, i, tr, &(tr->testRes) );
+				break;
+			case USE_EMPTY_TEST:
+				threads[i] = std::thread( runScalingThread<FakeAllocatorUnderTest, CommonTestResults>, &params, i, tr, &(tr->testRes) );
+				break;
+			default:
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, false );
+		}
+	}
+	for ( size_t i=0; i<threadCount; ++i )
+		threads[i].join();
+	res.dur = GetMillisecondCount() - start;
+	size_t peakRss = GetPeakResidentSetSize();
+	FootprintSummary footprint;
+	if ( samplingInterval )
+	{
+		sampler.stop();
+		footprint = sampler.getSummary();
+	}
+
+	res.workload = workload;
+	res.threadCount = threadCount;
+	res.peakRssGrowth = peakRss > rssBefore ? peakRss - rssBefore : 0;
+	res.steadyRssGrowth = footprint.sampleCount ? (int64_t)footprint.steadyRss - (int64_t)rssBefore : 0;
+	res.vmaCount = footprint.peakMappingCount;
+	res.committedToUsed = footprint.committedToUsed;
+	res.opCount = 0;
+	res.sysAllocCount = 0;
+	res.sysDeallocCount = 0;
+	for ( size_t i=0; i<threadCount; ++i )
+	{
+		res.opCount += threadRes[i].opCount;
+		res.sysAllocCount += threadRes[i].testRes.sysAllocCallCntAfterExit + threadRes[i].testRes.bulkSysAllocCallCntAfterExit;
+		res.sysDeallocCount += threadRes[i].testRes.sysDeallocCallCntAfterExit + threadRes[i].testRes.bulkSysDeallocCallCntAfterExit;
+	}
+	res.opsPerSec = res.dur ? res.opCount * 1000. / res.dur : 0;
+}
+
+void writeResults( const char* prefix, const std::vector<ScalingRes>& results )
+{
+	char path[1024];
+	snprintf( path, sizeof( path ), "%s.csv", prefix );
+	FILE* f = fopen( path, "w" );
+	if ( f != nullptr )
+	{
+		fprintf( f, "workload,allocator,threads,ops,duration_ms,ops_per_sec,peak_rss_growth_kb,steady_rss_growth_kb,vma_count,committed_to_used,sys_alloc_calls,sys_dealloc_calls,ratio_to_new_delete,net_ratio_to_new_delete\n" );
+		for ( const ScalingRes& r : results )
+			fprintf( f, "%s,%s,%zu,%zu,%zu,%.0f,%zu,%" PRId64 ",%zu,%.3f,%" PRIu64 ",%" PRIu64 ",%.3f,%.3f\n", workloadNames[r.workload], r.allocatorName, r.threadCount, r.opCount, r.dur, r.opsPerSec, r.peakRssGrowth >> 10, r.steadyRssGrowth / 1024, r.vmaCount, r.committedToUsed, r.sysAllocCount, r.sysDeallocCount, r.ratioToNewDel, r.netRatioToNewDel );
+		fclose( f );
+	}
+	else
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "cannot write {}", path );
+
+	snprintf( path, sizeof( path ), "%s.json", prefix );
+	f = fopen( path, "w" );
+	if ( f != nullptr )
+	{
+		fprintf( f, "[\n" );
+		for ( size_t i=0; i<results.size(); ++i )
+		{
+			const ScalingRes& r = results[i];
+			fprintf( f, "  {\"workload\": \"%s\", \"allocator\": \"%s\", \"threads\": %zu, \"ops\": %zu, \"duration_ms\": %zu, \"ops_per_sec\": %.0f, \"peak_rss_growth_kb\": %zu, \"steady_rss_growth_kb\": %" PRId64 ", \"vma_count\": %zu, \"committed_to_used\": %.3f, \"sys_alloc_calls\": %" PRIu64 ", \"sys_dealloc_calls\": %" PRIu64 ", \"ratio_to_new_delete\": %.3f, \"net_ratio_to_new_delete\": %.3f}%s\n", workloadNames[r.workload], r.allocatorName, r.threadCount, r.opCount, r.dur, r.opsPerSec, r.peakRssGrowth >> 10, r.steadyRssGrowth / 1024, r.vmaCount, r.committedToUsed, r.sysAllocCount, r.sysDeallocCount, r.ratioToNewDel, r.netRatioToNewDel, i + 1 < results.size() ? "," : "" );
+		}
+		fprintf( f, "]\n" );
+		fclose( f );
+	}
+	else
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "cannot write {}", path );
+}
+
+int main( int argc, char** argv )
+{
+	size_t threadCountMax = std::thread::hardware_concurrency();
+	if ( argc > 1 )
+		threadCountMax = strtoull( argv[1], nullptr, 10 );
+	if ( threadCountMax == 0 )
+		threadCountMax = 1;
+	const char* prefix = argc > 2 ? argv[2] : "scaling_results";
+	size_t samplingInterval = argc > 3 ? strtoull( argv[3], nullptr, 10 ) : 0;
+
+	std::vector<size_t> threadCounts;
+	for ( size_t threadCount=1; threadCount<threadCountMax; threadCount *= 2 )
+		threadCounts.push_back( threadCount );
+	threadCounts.push_back( threadCountMax );
+
+	const size_t allocatorTypes[] = { USE_EMPTY_TEST, USE_NEW_DELETE, USE_PER_THREAD_ALLOCATOR };
+	const char* allocatorNames[] = { "empty", "new-delete", "iibmalloc" };
+
+	std::vector<ScalingRes> results;
+	for ( size_t workload=0; workload<WORKLOAD_COUNT; ++workload )
+		for ( size_t threadCount : threadCounts )
+		{
+			ScalingRes res[3];
+			for ( size_t i=0; i<3; ++i )
+			{
+				doScalingTest( workload, threadCount, allocatorTypes[i], samplingInterval, res[i] );
+				res[i].allocatorName = allocatorNames[i];
+			}
+			for ( size_t i=0; i<3; ++i )
+			{
+				res[i].ratioToNewDel = res[1].opsPerSec ? res[i].opsPerSec / res[1].opsPerSec : 0;
+				res[i].netRatioToNewDel = res[i].dur > res[0].dur ? ( res[1].dur - res[0].dur ) * 1. / ( res[i].dur - res[0].dur ) : 0;
+				nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}, {} threads, {}: {} ops in {} ms ({:.0f} ops/sec), peak RSS growth {} KB, {}/{} calls to OS, {:.3f} ({:.3f}) to new/delete", workloadNames[workload], threadCount, res[i].allocatorName, res[i].opCount, res[i].dur, res[i].opsPerSec, res[i].peakRssGrowth >> 10, res[i].sysAllocCount, res[i].sysDeallocCount, res[i].ratioToNewDel, res[i].netRatioToNewDel );
+				if ( samplingInterval )
+					nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "    steady-state RSS growth {} KB, {} VMAs, committed/used {:.3f}", res[i].steadyRssGrowth / 1024, res[i].vmaCount, res[i].committedToUsed );
+				results.push_back( res[i] );
+			}
+		}
+
+	writeResults( prefix, results );
+	return 0;
+}
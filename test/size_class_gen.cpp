@@ -0,0 +1,250 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: a table of bucket sizes from a size histogram
+ * 
+ * Usage: size_class_gen.bin <histogram> [output header (default: iibmalloc_profiled_bucket_sizes.h)] [max bucket count (default and max: 64)]
+ * 
+ * A histogram is written by a program built with IIBMALLOC_ENABLE_SIZE_HISTOGRAM
+ * (see SizeHistogram; the preload library writes it at exit to a file given by
+ * IIBMALLOC_SIZE_HISTOGRAM). Bucket sizes (multiples of 8, from 8 up to
+ * IibAllocatorBase::MaxBucketSize, both of which are always present) are chosen
+ * to minimize a total number of bytes wasted by bucket items over requested sizes
+ * (dynamic programming over 8-byte granules; sizes above MaxBucketSize are not
+ * served by buckets and are ignored). The output header defines ProfiledBucketSizes,
+ * a schema with constexpr lookup tables, to be used with USE_PROFILED_BUCKET_SIZES
+ * defined (and the header being in an include path).
+ * 
+ * Reported: expected waste (wasted bytes over requested bytes, for allocations
+ * of the histogram) for ExpBucketSizes, HalfExpBucketSizes, QuarterExpBucketSizes
+ * and the generated table, and its reduction compared to HalfExpBucketSizes
+ * (a default schema).
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "test_common.h"
+
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+
+constexpr size_t granule_exp = 3; // as of SizeHistogram
+constexpr size_t max_size = IibAllocatorBase<>::maxBucketSize();
+constexpr size_t granule_count = max_size >> granule_exp; // granule g: sizes ( 8 * ( g - 1 ), 8 * g ]
+constexpr size_t max_bucket_count = 64; // IibAllocatorBase::BucketCount
+
+struct Histogram
+{
+	uint64_t counts[granule_count + 1] = {}; // [0]: size 0, served by the same bucket as granule 1
+	uint64_t bytes[granule_count + 1] = {};
+	uint64_t largeCount = 0;
+	uint64_t largeBytes = 0;
+};
+
+bool readHistogram( const char* path, Histogram& h )
+{
+	FILE* f = fopen( path, "r" );
+	if ( f == nullptr )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "cannot open {}", path );
+		return false;
+	}
+	char line[256];
+	bool ok = true;
+	while ( ok && fgets( line, sizeof( line ), f ) != nullptr )
+	{
+		if ( line[0] == '#' || line[0] == '\n' )
+			continue;
+		unsigned long long sz, cnt, bytes;
+		if ( sscanf( line, "large %llu %llu", &cnt, &bytes ) == 2 )
+		{
+			h.largeCount += cnt;
+			h.largeBytes += bytes;
+		}
+		else if ( sscanf( line, "%llu %llu %llu", &sz, &cnt, &bytes ) == 3 && ( sz & ( ( 1 << granule_exp ) - 1 ) ) == 0 && ( sz >> granule_exp ) <= granule_count )
+		{
+			h.counts[sz >> granule_exp] += cnt;
+			h.bytes[sz >> granule_exp] += bytes;
+		}
+		else
+		{
+			nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "{}: unexpected line: {}", path, line );
+			ok = false;
+		}
+	}
+	fclose( f );
+	return ok;
+}
+
+// Bucket sizes (in granules) minimizing waste, with at most maxCount of them; 1 and granule_count are always included
+std::vector<size_t> buildTable( const Histogram& h, size_t maxCount )
+{
+	// prefix sums: cost of a bucket of granule b serving granules ( a, b ] is 8 * b * ( C[b] - C[a] ) - ( B[b] - B[a] )
+	std::vector<uint64_t> C( granule_count + 1 ), B( granule_count + 1 );
+	C[0] = 0;
+	B[0] = 0;
+	for ( size_t g=1; g<=granule_count; ++g )
+	{
+		C[g] = C[g-1] + h.counts[g] + ( g == 1 ? h.counts[0] : 0 );
+		B[g] = B[g-1] + h.bytes[g] + ( g == 1 ? h.bytes[0] : 0 );
+	}
+	auto cost = [&]( size_t a, size_t b ) { return ( b << granule_exp ) * ( C[b] - C[a] ) - ( B[b] - B[a] ); };
+
+	// waste[k][b]: minimal waste of sizes up to granule b with k buckets, the largest of which is b
+	constexpr uint64_t infinity = UINT64_MAX;
+	std::vector<std::vector<uint64_t>> waste( maxCount + 1, std::vector<uint64_t>( granule_count + 1, infinity ) );
+	std::vector<std::vector<uint16_t>> prev( maxCount + 1, std::vector<uint16_t>( granule_count + 1, 0 ) );
+	waste[1][1] = cost( 0, 1 );
+	for ( size_t k=2; k<=maxCount; ++k )
+		for ( size_t b=k; b<=granule_count; ++b )
+			for ( size_t a=k-1; a<b; ++a )
+				if ( waste[k-1][a] != infinity && waste[k-1][a] + cost( a, b ) < waste[k][b] )
+				{
+					waste[k][b] = waste[k-1][a] + cost( a, b );
+					prev[k][b] = (uint16_t)a;
+				}
+
+	size_t bestK = 1;
+	for ( size_t k=2; k<=maxCount; ++k )
+		if ( waste[k][granule_count] < waste[bestK][granule_count] ) // the smallest count that reaches a minimum
+			bestK = k;
+	std::vector<size_t> ret( bestK );
+	for ( size_t k=bestK, b=granule_count; k>0; b=prev[k][b], --k )
+		ret[k-1] = b;
+	return ret;
+}
+
+struct Waste
+{
+	uint64_t requested = 0;
+	uint64_t wasted = 0;
+	double ratio() const { return requested ? wasted * 1. / requested : 0; }
+};
+
+template<class GetBucketSize>
+Waste calcWaste( const Histogram& h, GetBucketSize getBucketSize )
+{
+	Waste w;
+	for ( size_t g=0; g<=granule_count; ++g )
+		if ( h.counts[g] != 0 )
+		{
+			size_t bucketSz = getBucketSize( g == 0 ? 1 : ( g << granule_exp ) ); // all sizes of a granule are served by the same bucket
+			w.requested += h.bytes[g];
+			w.wasted += bucketSz * h.counts[g] - h.bytes[g];
+		}
+	return w;
+}
+
+template<class BucketSizes>
+Waste calcSchemaWaste( const Histogram& h )
+{
+	typedef IibAllocatorBase<BucketSizes> HeapT;
+	return calcWaste( h, []( size_t sz ) { return HeapT::indexToBucketSize( HeapT::sizeToIndex( sz ) ); } );
+}
+
+bool writeHeader( const char* path, const char* histogramPath, const std::vector<size_t>& table )
+{
+	FILE* f = fopen( path, "w" );
+	if ( f == nullptr )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "cannot open {}", path );
+		return false;
+	}
+	fprintf( f, "// Generated by size_class_gen.bin from %s; do not edit.\n", histogramPath );
+	fprintf( f, "// Bucket size schema for IibAllocatorBase (see ExpBucketSizes), used with USE_PROFILED_BUCKET_SIZES defined.\n\n" );
+	fprintf( f, "#ifndef IIBMALLOC_PROFILED_BUCKET_SIZES_H\n#define IIBMALLOC_PROFILED_BUCKET_SIZES_H\n\n" );
+	fprintf( f, "#include <cstddef>\n#include <cstdint>\n\n" );
+	fprintf( f, "namespace nodecpp::iibmalloc\n{\n\n" );
+	fprintf( f, "struct ProfiledBucketSizes\n{\n" );
+	// beyond a table, sizes keep growing (they are never used for allocation, but are non-decreasing as for other schemas)
+	fprintf( f, "\tstatic constexpr size_t bucket_sizes[%zu] = {", max_bucket_count );
+	for ( size_t i=0; i<max_bucket_count; ++i )
+	{
+		size_t sz = i < table.size() ? ( table[i] << granule_exp ) : ( ( granule_count + ( i - table.size() + 1 ) * granule_count ) << granule_exp );
+		fprintf( f, "%s%zu,", i % 16 == 0 ? "\n\t\t" : " ", sz );
+	}
+	fprintf( f, "\n\t};\n" );
+	fprintf( f, "\t// by ( sz + 7 ) >> 3\n" );
+	fprintf( f, "\tstatic constexpr uint8_t size_to_index[%zu] = {", granule_count + 1 );
+	size_t ix = 0;
+	for ( size_t g=0; g<=granule_count; ++g )
+	{
+		while ( table[ix] < g )
+			++ix;
+		fprintf( f, "%s%zu,", g % 32 == 0 ? "\n\t\t" : " ", ix );
+	}
+	fprintf( f, "\n\t};\n\n" );
+	fprintf( f, "\tstatic constexpr size_t indexToBucketSize( uint8_t ix )\n\t{\n\t\treturn bucket_sizes[ix];\n\t}\n" );
+	fprintf( f, "\tstatic constexpr uint8_t sizeToIndex( uint64_t sz, uint8_t msb )\n\t{\n\t\treturn size_to_index[( sz + 7 ) >> 3];\n\t}\n" );
+	fprintf( f, "};\n\n} // namespace nodecpp::iibmalloc\n\n#endif // IIBMALLOC_PROFILED_BUCKET_SIZES_H\n" );
+	bool ok = ferror( f ) == 0;
+	ok = fclose( f ) == 0 && ok;
+	return ok;
+}
+
+int main( int argc, char** argv )
+{
+	if ( argc < 2 )
+	{
+		printf( "Usage: %s <histogram> [output header] [max bucket count (up to %zu)]\n", argv[0], max_bucket_count );
+		return 1;
+	}
+	const char* outPath = argc > 2 ? argv[2] : "iibmalloc_profiled_bucket_sizes.h";
+	size_t maxCount = argc > 3 ? strtoull( argv[3], nullptr, 10 ) : max_bucket_count;
+	if ( maxCount < 2 || maxCount > max_bucket_count )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "max bucket count must be from 2 to {}", max_bucket_count );
+		return 1;
+	}
+
+	Histogram h;
+	if ( !readHistogram( argv[1], h ) )
+		return 1;
+
+	std::vector<size_t> table = buildTable( h, maxCount );
+	if ( !writeHeader( outPath, argv[1], table ) )
+		return 1;
+
+	Waste res[4] = { calcSchemaWaste<ExpBucketSizes>( h ), calcSchemaWaste<HalfExpBucketSizes>( h ), calcSchemaWaste<QuarterExpBucketSizes>( h ),
+		calcWaste( h, [&]( size_t sz ) { size_t g = ( sz + ( 1 << granule_exp ) - 1 ) >> granule_exp; return *std::lower_bound( table.begin(), table.end(), g ) << granule_exp; } ) };
+	const char* names[4] = { "exp", "half-exp", "quarter-exp", "profiled" };
+	size_t bucketCounts[4] = { IibAllocatorBase<ExpBucketSizes>::sizeToIndexAtCompileTime( max_size ) + 1u, IibAllocatorBase<HalfExpBucketSizes>::sizeToIndexAtCompileTime( max_size ) + 1u, IibAllocatorBase<QuarterExpBucketSizes>::sizeToIndexAtCompileTime( max_size ) + 1u, table.size() };
+
+	uint64_t totalCount = h.largeCount;
+	for ( size_t g=0; g<=granule_count; ++g )
+		totalCount += h.counts[g];
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} allocations, {} bytes of them served by buckets ({} allocations above {} bytes are ignored)", totalCount, res[0].requested, h.largeCount, max_size );
+	for ( size_t i=0; i<4; ++i )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {} buckets, {} bytes wasted ({:.2f}% of requested)", names[i], bucketCounts[i], res[i].wasted, res[i].ratio() * 100 );
+	if ( res[1].wasted != 0 )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "waste reduction compared to half-exp: {:.2f}%", ( 1. - res[3].wasted * 1. / res[1].wasted ) * 100 );
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{} written", outPath );
+
+	return 0;
+}
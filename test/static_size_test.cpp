@@ -0,0 +1,147 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * Per-thread bucket allocator: sizes known at compile time vs. at runtime
+ * 
+ * For a number of object sizes, the same pattern of allocations and
+ * deallocations is run with allocate(sz)/deallocate() (size being opaque to
+ * the compiler), with allocate<sz>()/deallocate<sz>(), and with new/delete of
+ * a class derived from IibAllocated<>; cost per allocation/deallocation pair
+ * (in rdtsc ticks) is reported for each.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "test_common.h"
+
+#include <memory>
+#include <stdio.h>
+
+#ifdef NODECPP_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+constexpr size_t objectsPerRound = 1 << 22;
+constexpr size_t roundCnt = 8;
+constexpr size_t liveObjCnt = 64;
+
+template<size_t sz>
+struct TestObject : public IibAllocated<TestObject<sz>>
+{
+	uint8_t data[sz];
+};
+
+NODECPP_NOINLINE uint64_t runRuntimeSize( volatile size_t& szRef, void** ptrs )
+{
+	size_t sz = szRef;
+	uint64_t start = __rdtsc();
+	for ( size_t r=0; r<roundCnt; ++r )
+		for ( size_t j=0; j<objectsPerRound; j+=liveObjCnt )
+		{
+			for ( size_t i=0; i<liveObjCnt; ++i )
+			{
+				ptrs[i] = g_AllocManager.allocate( sz );
+				*reinterpret_cast<uint8_t*>(ptrs[i]) = (uint8_t)i;
+			}
+			for ( size_t i=0; i<liveObjCnt; ++i )
+				g_AllocManager.deallocate( ptrs[i] );
+		}
+	return __rdtsc() - start;
+}
+
+template<size_t sz>
+NODECPP_NOINLINE uint64_t runStaticSize( void** ptrs )
+{
+	uint64_t start = __rdtsc();
+	for ( size_t r=0; r<roundCnt; ++r )
+		for ( size_t j=0; j<objectsPerRound; j+=liveObjCnt )
+		{
+			for ( size_t i=0; i<liveObjCnt; ++i )
+			{
+				ptrs[i] = g_AllocManager.allocate<sz>();
+				*reinterpret_cast<uint8_t*>(ptrs[i]) = (uint8_t)i;
+			}
+			for ( size_t i=0; i<liveObjCnt; ++i )
+				g_AllocManager.deallocate<sz>( ptrs[i] );
+		}
+	return __rdtsc() - start;
+}
+
+template<size_t sz>
+NODECPP_NOINLINE uint64_t runMixin( TestObject<sz>** objs )
+{
+	uint64_t start = __rdtsc();
+	for ( size_t r=0; r<roundCnt; ++r )
+		for ( size_t j=0; j<objectsPerRound; j+=liveObjCnt )
+		{
+			for ( size_t i=0; i<liveObjCnt; ++i )
+			{
+				objs[i] = new TestObject<sz>;
+				objs[i]->data[0] = (uint8_t)i;
+			}
+			for ( size_t i=0; i<liveObjCnt; ++i )
+				delete objs[i];
+		}
+	return __rdtsc() - start;
+}
+
+template<size_t sz>
+void runForSize( void** ptrs )
+{
+	volatile size_t szRef = sz;
+	runRuntimeSize( szRef, ptrs ); // warming up (buckets get enough pages)
+	uint64_t runtimeSz = runRuntimeSize( szRef, ptrs );
+	uint64_t staticSz = runStaticSize<sz>( ptrs );
+	uint64_t mixin = runMixin<sz>( reinterpret_cast<TestObject<sz>**>( ptrs ) );
+	constexpr double pairCnt = objectsPerRound * roundCnt;
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{},{:.2f},{:.2f},{:.2f}", sz, runtimeSz / pairCnt, staticSz / pairCnt, mixin / pairCnt );
+}
+
+int main()
+{
+	void** ptrs = new void* [liveObjCnt];
+
+	g_AllocManager.initialize();
+	g_AllocManager.enable();
+
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "size,allocate(sz) (ticks/pair),allocate<sz>() (ticks/pair),IibAllocated<> new/delete (ticks/pair)" );
+	runForSize<8>( ptrs );
+	runForSize<24>( ptrs );
+	runForSize<48>( ptrs );
+	runForSize<128>( ptrs );
+	runForSize<200>( ptrs );
+	runForSize<1024>( ptrs );
+	runForSize<4000>( ptrs );
+
+	g_AllocManager.deinitialize();
+	g_AllocManager.disable();
+	delete [] ptrs;
+
+	return 0;
+}
@@ -39,8 +39,13 @@
 
 #ifdef NODECPP_MSVC
 #include <Windows.h>
+#include <Psapi.h>
 #else
 #include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #endif
 
 
@@ -99,3 +104,110 @@ size_t GetMillisecondCount()
 #endif
     return now;
 }
+
+#ifndef NODECPP_MSVC
+static size_t readProcStatusValue( const char* key ) // "VmRSS:", etc; in kB
+{
+	FILE* f = fopen( "/proc/self/status", "r" );
+	if ( f == nullptr )
+		return 0;
+	char line[256];
+	size_t keyLen = strlen( key );
+	size_t ret = 0;
+	while ( fgets( line, sizeof( line ), f ) != nullptr )
+		if ( strncmp( line, key, keyLen ) == 0 )
+		{
+			ret = strtoull( line + keyLen, nullptr, 10 );
+			break;
+		}
+	fclose( f );
+	return ret;
+}
+#endif
+
+size_t GetResidentSetSize()
+{
+#ifdef NODECPP_MSVC
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( !GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+		return 0;
+	return pmc.WorkingSetSize;
+#else
+	FILE* f = fopen( "/proc/self/statm", "r" ); // cheaper than /proc/self/status
+	if ( f == nullptr )
+		return 0;
+	size_t vmSize = 0, resident = 0;
+	int cnt = fscanf( f, "%zu %zu", &vmSize, &resident );
+	fclose( f );
+	return cnt == 2 ? resident * sysconf( _SC_PAGESIZE ) : 0;
+#endif
+}
+
+size_t GetPeakResidentSetSize()
+{
+#ifdef NODECPP_MSVC
+	PROCESS_MEMORY_COUNTERS pmc;
+	if ( !GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) )
+		return 0;
+	return pmc.PeakWorkingSetSize;
+#else
+	return readProcStatusValue( "VmHWM:" ) * 1024;
+#endif
+}
+
+bool ResetPeakResidentSetSize()
+{
+#ifdef NODECPP_MSVC
+	return false; // not supported: peak working set is kept since process start
+#else
+	int fd = open( "/proc/self/clear_refs", O_WRONLY );
+	if ( fd == -1 )
+		return false;
+	bool ret = write( fd, "5", 1 ) == 1; // resets VmHWM to a current RSS (Linux 4.0+)
+	close( fd );
+	return ret;
+#endif
+}
+
+size_t GetAnonymousMemorySize()
+{
+#ifndef NODECPP_MSVC
+	FILE* f = fopen( "/proc/self/smaps_rollup", "r" ); // Linux 4.14+
+	if ( f != nullptr )
+	{
+		char line[256];
+		size_t ret = 0;
+		bool found = false;
+		while ( fgets( line, sizeof( line ), f ) != nullptr )
+			if ( strncmp( line, "Anonymous:", 10 ) == 0 )
+			{
+				ret = strtoull( line + 10, nullptr, 10 ) * 1024;
+				found = true;
+				break;
+			}
+		fclose( f );
+		if ( found )
+			return ret;
+	}
+#endif
+	return GetResidentSetSize();
+}
+
+size_t GetMappingCount()
+{
+#ifdef NODECPP_MSVC
+	return 0;
+#else
+	FILE* f = fopen( "/proc/self/maps", "r" );
+	if ( f == nullptr )
+		return 0;
+	char buff[4096];
+	size_t cnt = 0;
+	size_t readCnt;
+	while ( ( readCnt = fread( buff, 1, sizeof( buff ), f ) ) != 0 )
+		for ( size_t i=0; i<readCnt; ++i )
+			cnt += buff[i] == '\n';
+	fclose( f );
+	return cnt;
+#endif
+}
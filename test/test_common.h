@@ -45,4 +45,10 @@ using namespace nodecpp::iibmalloc;
 int64_t GetMicrosecondCount();
 size_t GetMillisecondCount();
 
+size_t GetResidentSetSize(); // bytes
+size_t GetPeakResidentSetSize(); // bytes, since process start or since last ResetPeakResidentSetSize()
+bool ResetPeakResidentSetSize(); // false where not supported
+size_t GetAnonymousMemorySize(); // bytes of resident anonymous memory (smaps_rollup); falls back to GetResidentSetSize()
+size_t GetMappingCount(); // number of VMAs; 0 where not supported
+
 #endif // ALLOCATOR_TEST_COMMON_H
\ No newline at end of file
@@ -0,0 +1,438 @@
+ /* -------------------------------------------------------------------------------
+ * Copyright (c) 2018, OLogN Technologies AG
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the OLogN Technologies AG nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL OLogN Technologies AG BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * -------------------------------------------------------------------------------
+ * 
+ * 
+ * Per-thread bucket allocator: replay of recorded allocation traces
+ * 
+ * Usage: trace_replay.bin <trace file> [all|empty|newdel|iibmalloc]
+ * 
+ * A trace (see src/iibmalloc_trace.h) is recorded by running an application
+ * with the preload library built with IIBMALLOC_ENABLE_TRACE_RECORDER and
+ * IIBMALLOC_TRACE=<trace file> set. Each recorded thread is replayed by its own
+ * thread against each allocator under test; an object freed (or reallocated)
+ * by a thread other than the one that allocated it is waited for if it is not
+ * allocated yet. Objects that are still alive at the end of a trace are freed
+ * by their allocating threads after all threads are done with a trace.
+ * 
+ * Reported: duration and throughput, peak RSS growth, and per-operation latency
+ * percentiles (in rdtsc ticks) for allocations, deallocations and reallocations.
+ * 
+ * -------------------------------------------------------------------------------*/
+
+
+#include "random_test.h"
+#include "latency_histogram.h"
+#include "../src/iibmalloc_trace.h"
+
+#include <vector>
+#include <unordered_map>
+#include <queue>
+#include <atomic>
+
+enum ReplayOpType : uint8_t { REPLAY_ALLOC, REPLAY_DEALLOC, REPLAY_REALLOC };
+
+struct ReplayOp
+{
+	uint64_t size; // alloc, realloc
+	uint32_t objIdx; // for realloc, the object after reallocation
+	uint32_t oldObjIdx; // realloc only
+	ReplayOpType type;
+};
+
+struct ReplayTrace
+{
+	std::vector<std::vector<ReplayOp>> threads;
+	std::vector<std::vector<uint32_t>> leaked; // by allocating thread
+	std::vector<uint64_t> objSizes;
+	size_t opCount = 0;
+	size_t unknownDeallocCount = 0; // of objects allocated before recording started
+	size_t unknownReallocCount = 0; // replayed as allocations
+};
+
+bool loadTrace( const char* path, ReplayTrace& trace )
+{
+	FILE* f = fopen( path, "rb" );
+	if ( f == nullptr )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "cannot open {}", path );
+		return false;
+	}
+	TraceFileHeader header;
+	if ( fread( &header, sizeof( header ), 1, f ) != 1 || memcmp( header.magic, TraceFileHeader::magic_value, sizeof( header.magic ) ) != 0 || header.version != TraceFileHeader::current_version || header.recordSize != sizeof( TraceRecord ) )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::error>( "{} is not a trace of a supported version", path );
+		fclose( f );
+		return false;
+	}
+
+	std::vector<std::vector<TraceRecord>> records; // by recorded thread
+	TraceChunkHeader chunk;
+	while ( fread( &chunk, sizeof( chunk ), 1, f ) == 1 )
+	{
+		if ( chunk.threadIdx >= records.size() )
+			records.resize( chunk.threadIdx + 1 );
+		std::vector<TraceRecord>& threadRecords = records[chunk.threadIdx];
+		size_t offset = threadRecords.size();
+		threadRecords.resize( offset + chunk.recordCount );
+		size_t readCnt = fread( threadRecords.data() + offset, sizeof( TraceRecord ), chunk.recordCount, f );
+		if ( readCnt != chunk.recordCount ) // truncated trace (say, a recording process was killed)
+		{
+			threadRecords.resize( offset + readCnt );
+			break;
+		}
+	}
+	fclose( f );
+
+	// objects are identified by walking records of all threads in timestamp order (addresses are reused); records of each thread are taken in their order
+	trace.threads.resize( records.size() );
+	trace.leaked.resize( records.size() );
+	std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> liveObjects; // address -> (object, allocating thread)
+	std::vector<uint32_t> pendingReallocFrom( records.size(), UINT32_MAX );
+	std::vector<size_t> cursors( records.size(), 0 );
+	auto later = [&]( uint32_t a, uint32_t b ) { return records[a][cursors[a]].timestamp > records[b][cursors[b]].timestamp; };
+	std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(later)> queue( later );
+	for ( uint32_t i=0; i<records.size(); ++i )
+		if ( !records[i].empty() )
+			queue.push( i );
+
+	auto newObject = [&]( uint64_t ptr, size_t size, uint32_t threadIdx ) {
+		NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, trace.objSizes.size() < UINT32_MAX );
+		uint32_t objIdx = (uint32_t)trace.objSizes.size();
+		trace.objSizes.push_back( size );
+		liveObjects[ptr] = std::make_pair( objIdx, threadIdx );
+		return objIdx;
+	};
+
+	while ( !queue.empty() )
+	{
+		uint32_t threadIdx = queue.top();
+		queue.pop();
+		const TraceRecord& rec = records[threadIdx][cursors[threadIdx]];
+		std::vector<ReplayOp>& ops = trace.threads[threadIdx];
+		switch ( rec.op() )
+		{
+			case TraceOp::alloc:
+				ops.push_back( { rec.size(), newObject( rec.ptr, rec.size(), threadIdx ), 0, REPLAY_ALLOC } );
+				break;
+			case TraceOp::dealloc:
+			{
+				auto it = liveObjects.find( rec.ptr );
+				if ( it == liveObjects.end() )
+				{
+					++(trace.unknownDeallocCount);
+					break;
+				}
+				ops.push_back( { 0, it->second.first, 0, REPLAY_DEALLOC } );
+				liveObjects.erase( it );
+				break;
+			}
+			case TraceOp::reallocFrom:
+			{
+				auto it = liveObjects.find( rec.ptr );
+				if ( it != liveObjects.end() )
+				{
+					pendingReallocFrom[threadIdx] = it->second.first;
+					liveObjects.erase( it ); // an address may be taken by another thread before reallocTo
+				}
+				break;
+			}
+			case TraceOp::reallocTo:
+			{
+				uint32_t oldObjIdx = pendingReallocFrom[threadIdx];
+				pendingReallocFrom[threadIdx] = UINT32_MAX;
+				uint32_t objIdx = newObject( rec.ptr, rec.size(), threadIdx );
+				if ( oldObjIdx != UINT32_MAX )
+					ops.push_back( { rec.size(), objIdx, oldObjIdx, REPLAY_REALLOC } );
+				else
+				{
+					++(trace.unknownReallocCount);
+					ops.push_back( { rec.size(), objIdx, 0, REPLAY_ALLOC } );
+				}
+				break;
+			}
+		}
+		if ( ++(cursors[threadIdx]) < records[threadIdx].size() )
+			queue.push( threadIdx );
+	}
+
+	for ( auto& obj : liveObjects )
+		trace.leaked[obj.second.second].push_back( obj.second.first );
+	for ( auto& ops : trace.threads )
+		trace.opCount += ops.size();
+	return true;
+}
+
+struct ReplayThreadRes
+{
+	ThreadTestRes testRes;
+	LatencyHistogram allocLatency;
+	LatencyHistogram deallocLatency;
+	LatencyHistogram reallocLatency;
+};
+
+struct ReplayParams
+{
+	const ReplayTrace* trace;
+	std::atomic<void*>* objects; // by object index; nullptr until allocated
+	MEM_ACCESS_TYPE mat;
+	size_t allocatorType;
+	std::atomic<size_t> readyCount;
+	std::atomic<size_t> doneCount;
+};
+
+struct ReplayRes
+{
+	size_t dur;
+	size_t peakRssGrowth;
+	LatencyHistogram allocLatency;
+	LatencyHistogram deallocLatency;
+	LatencyHistogram reallocLatency;
+};
+
+NODECPP_FORCEINLINE void* waitForObject( std::atomic<void*>& obj )
+{
+	void* ptr;
+	while ( ( ptr = obj.load( std::memory_order_acquire ) ) == nullptr ) // allocated by another thread that is not there yet
+		std::this_thread::yield();
+	return ptr;
+}
+
+template<MEM_ACCESS_TYPE mat>
+NODECPP_FORCEINLINE void accessObject( void* ptr, size_t sz )
+{
+	if constexpr ( mat == MEM_ACCESS_TYPE::full )
+		memset( ptr, (uint8_t)sz, sz );
+	else if constexpr ( mat == MEM_ACCESS_TYPE::single )
+	{
+		if ( sz )
+			*reinterpret_cast<uint8_t*>( ptr ) = (uint8_t)sz;
+	}
+}
+
+void waitForAllThreads( std::atomic<size_t>& counter, size_t threadCount )
+{
+	counter.fetch_add( 1 );
+	while ( counter.load() < threadCount )
+		std::this_thread::yield();
+}
+
+template< class AllocatorUnderTest, MEM_ACCESS_TYPE mat>
+void replayThread( AllocatorUnderTest& allocatorUnderTest, ReplayParams& params, size_t threadIdx, ReplayThreadRes& res )
+{
+	const std::vector<ReplayOp>& ops = params.trace->threads[threadIdx];
+	std::atomic<void*>* objects = params.objects;
+	size_t threadCount = params.trace->threads.size();
+
+	allocatorUnderTest.init( threadIdx );
+	allocatorUnderTest.doWhateverAfterSetupPhase();
+	waitForAllThreads( params.readyCount, threadCount );
+
+	for ( size_t i=0; i<ops.size(); ++i )
+	{
+		const ReplayOp& op = ops[i];
+		if ( i % 10000 == 0 ) // as in randomPos_RandomSize()
+			allocatorUnderTest.doWhateverWithinMainLoopPhase();
+		switch ( op.type )
+		{
+			case REPLAY_ALLOC:
+			{
+				uint64_t start = __rdtsc();
+				void* ptr = allocatorUnderTest.allocate( op.size );
+				res.allocLatency.record( __rdtsc() - start );
+				accessObject<mat>( ptr, op.size );
+				objects[op.objIdx].store( ptr, std::memory_order_release );
+				break;
+			}
+			case REPLAY_DEALLOC:
+			{
+				void* ptr = waitForObject( objects[op.objIdx] );
+				uint64_t start = __rdtsc();
+				allocatorUnderTest.deallocate( ptr );
+				res.deallocLatency.record( __rdtsc() - start );
+				break;
+			}
+			case REPLAY_REALLOC:
+			{
+				void* oldPtr = waitForObject( objects[op.oldObjIdx] );
+				uint64_t start = __rdtsc();
+				void* ptr = allocatorUnderTest.reallocate( oldPtr, params.trace->objSizes[op.oldObjIdx], op.size );
+				res.reallocLatency.record( __rdtsc() - start );
+				accessObject<mat>( ptr, op.size );
+				objects[op.objIdx].store( ptr, std::memory_order_release );
+				break;
+			}
+		}
+	}
+	allocatorUnderTest.doWhateverAfterMainLoopPhase();
+
+	waitForAllThreads( params.doneCount, threadCount ); // no objects of this thread are freed by others from now on
+	for ( uint32_t objIdx : params.trace->leaked[threadIdx] )
+		allocatorUnderTest.deallocate( objects[objIdx].load( std::memory_order_relaxed ) );
+	allocatorUnderTest.doWhateverAfterCleanupPhase();
+
+	allocatorUnderTest.deinit();
+}
+
+template< class AllocatorUnderTest, class ThreadResT>
+void runReplayThread( ReplayParams* params, size_t threadIdx, ReplayThreadRes* res, ThreadResT* testRes )
+{
+	AllocatorUnderTest allocator( testRes );
+	switch ( params->mat )
+	{
+		case MEM_ACCESS_TYPE::none:
+			replayThread<AllocatorUnderTest,MEM_ACCESS_TYPE::none>( allocator, *params, threadIdx, *res );
+			break;
+		case MEM_ACCESS_TYPE::single:
+			replayThread<AllocatorUnderTest,MEM_ACCESS_TYPE::single>( allocator, *params, threadIdx, *res );
+			break;
+		case MEM_ACCESS_TYPE::full:
+			replayThread<AllocatorUnderTest,MEM_ACCESS_TYPE::full>( allocator, *params, threadIdx, *res );
+			break;
+	}
+}
+
+void doReplay( ReplayParams& params, ReplayRes& replayRes )
+{
+	size_t threadCount = params.trace->threads.size();
+	std::vector<ReplayThreadRes> threadRes( threadCount );
+	std::vector<std::thread> threads( threadCount );
+	memset( (void*)(params.objects), 0, sizeof( std::atomic<void*> ) * params.trace->objSizes.size() );
+	params.readyCount = 0;
+	params.doneCount = 0;
+
+	ResetPeakResidentSetSize();
+	size_t rssBefore = GetPeakResidentSetSize(); // a current RSS if reset above is supported
+	size_t start = GetMillisecondCount();
+	for ( size_t i=0; i<threadCount; ++i )
+	{
+		ReplayThreadRes* res = &(threadRes[i]);
+		switch ( params.allocatorType )
+		{
+			case USE_PER_THREAD_ALLOCATOR:
+				threads[i] = std::thread( runReplayThread<PerThreadAllocatorUnderTest, ThreadTestRes>, &params, i, res, &(res->testRes) );
+				break;
+			case USE_NEW_DELETE:
+				threads[i] = std::thread( runReplayThread<NewDeleteUnderTest, CommonTestResults>, &params, i, res, &(res->testRes) );
+				break;
+			case USE_EMPTY_TEST:
+				threads[i] = std::thread( runReplayThread<FakeAllocatorUnderTest, CommonTestResults>, &params, i, res, &(res->testRes) );
+				break;
+			default:
+				NODECPP_ASSERT(nodecpp::iibmalloc::module_id, nodecpp::assert::AssertLevel::critical, false );
+		}
+	}
+	for ( size_t i=0; i<threadCount; ++i )
+		threads[i].join();
+	replayRes.dur = GetMillisecondCount() - start;
+	size_t peakRss = GetPeakResidentSetSize();
+	replayRes.peakRssGrowth = peakRss > rssBefore ? peakRss - rssBefore : 0;
+
+	replayRes.allocLatency.clear();
+	replayRes.deallocLatency.clear();
+	replayRes.reallocLatency.clear();
+	for ( size_t i=0; i<threadCount; ++i )
+	{
+		replayRes.allocLatency.merge( threadRes[i].allocLatency );
+		replayRes.deallocLatency.merge( threadRes[i].deallocLatency );
+		replayRes.reallocLatency.merge( threadRes[i].reallocLatency );
+	}
+}
+
+void printReplayRes( const char* name, const ReplayTrace& trace, const ReplayRes& res )
+{
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {} threads made {} operations in {} ms ({:.0f} ops/sec); peak RSS growth: {} KB", name, trace.threads.size(), trace.opCount, res.dur, res.dur ? trace.opCount * 1000. / res.dur : 0., res.peakRssGrowth >> 10 );
+	res.allocLatency.print( "    ", "allocate (ticks)" );
+	res.deallocLatency.print( "    ", "deallocate (ticks)" );
+	if ( res.reallocLatency.count() )
+		res.reallocLatency.print( "    ", "reallocate (ticks)" );
+}
+
+void runReplayComparison( ReplayParams& params, ReplayRes* res ) // res: by USE_EMPTY_TEST, USE_NEW_DELETE, USE_PER_THREAD_ALLOCATOR
+{
+	size_t allocatorType = params.allocatorType;
+
+	if ( allocatorType & USE_EMPTY_TEST )
+	{
+		params.allocatorType = USE_EMPTY_TEST;
+		doReplay( params, res[0] );
+		printReplayRes( "Empty", *(params.trace), res[0] );
+	}
+
+	if ( allocatorType & USE_NEW_DELETE )
+	{
+		params.allocatorType = USE_NEW_DELETE;
+		doReplay( params, res[1] );
+		printReplayRes( "new/delete", *(params.trace), res[1] );
+	}
+
+	if ( allocatorType & USE_PER_THREAD_ALLOCATOR )
+	{
+		params.allocatorType = USE_PER_THREAD_ALLOCATOR;
+		doReplay( params, res[2] );
+		printReplayRes( "iibmalloc", *(params.trace), res[2] );
+	}
+
+	if ( allocatorType == TRY_ALL )
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Performance summary: ({} - {}) / ({} - {}) = {}", res[1].dur, res[0].dur, res[2].dur, res[0].dur, (res[1].dur - res[0].dur) * 1. / (res[2].dur - res[0].dur) );
+	params.allocatorType = allocatorType; // restore
+}
+
+int main( int argc, char** argv )
+{
+	if ( argc < 2 )
+	{
+		nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "Usage: {} <trace file> [all|empty|newdel|iibmalloc]", argv[0] );
+		return 1;
+	}
+
+	ReplayParams params;
+	params.allocatorType = TRY_ALL;
+	if ( argc > 2 )
+	{
+		if ( strcmp( argv[2], "empty" ) == 0 )
+			params.allocatorType = USE_EMPTY_TEST;
+		else if ( strcmp( argv[2], "newdel" ) == 0 )
+			params.allocatorType = USE_NEW_DELETE;
+		else if ( strcmp( argv[2], "iibmalloc" ) == 0 )
+			params.allocatorType = USE_PER_THREAD_ALLOCATOR;
+	}
+	params.mat = MEM_ACCESS_TYPE::full;
+
+	ReplayTrace trace;
+	if ( !loadTrace( argv[1], trace ) )
+		return 1;
+	nodecpp::log::log<nodecpp::iibmalloc::module_id, nodecpp::log::LogLevel::info>( "{}: {} threads, {} operations over {} objects ({} objects still alive at the end); dropped {} deallocations and replayed {} reallocations as allocations of objects allocated before recording started", argv[1], trace.threads.size(), trace.opCount, trace.objSizes.size(), [&]() { size_t cnt = 0; for ( auto& l : trace.leaked ) cnt += l.size(); return cnt; }(), trace.unknownDeallocCount, trace.unknownReallocCount );
+
+	params.trace = &trace;
+	params.objects = new std::atomic<void*>[ trace.objSizes.size() ];
+
+	ReplayRes res[3];
+	runReplayComparison( params, res );
+
+	delete [] params.objects;
+	return 0;
+}